@@ -7,6 +7,12 @@
 #include "../lexer/lexer.h"
 
 struct ASTNode {
+    // Preorder number within the AST last passed to CodeGenerator::generate(),
+    // which is how a profile refers to the node; NO_NODE_ID if it was not part
+    // of one
+    static const uint32_t NO_NODE_ID = UINT32_MAX;
+    uint32_t nodeId = NO_NODE_ID;
+    
     virtual ~ASTNode() = default;
     virtual void print(std::ostream& out) const = 0;
 };
@@ -36,6 +42,24 @@ struct BinaryExpr : public ASTNode {
     }
 };
 
+// `left && right` or `left || right`. The right side is only evaluated when
+// the left one does not decide the result, which is a bool.
+struct LogicalExpr : public ASTNode {
+    Token op;
+    std::unique_ptr<ASTNode> left, right;
+
+    LogicalExpr(Token op, std::unique_ptr<ASTNode> left, std::unique_ptr<ASTNode> right)
+        : op(op), left(std::move(left)), right(std::move(right)) {}
+    
+    void print(std::ostream& out) const override {
+        out << "(";
+        left->print(out);
+        out << " " << op.value << " ";
+        right->print(out);
+        out << ")";
+    }
+};
+
 struct VariableExpr : public ASTNode {
     Token name;
     VariableExpr(Token name) : name(name) {}
@@ -56,6 +80,69 @@ struct AssignmentExpr : public ASTNode {
     }
 };
 
+struct CallExpr : public ASTNode {
+    Token callee;
+    std::vector<std::unique_ptr<ASTNode>> arguments;
+    CallExpr(Token callee, std::vector<std::unique_ptr<ASTNode>> arguments)
+        : callee(callee), arguments(std::move(arguments)) {}
+
+    void print(std::ostream& out) const override {
+        out << callee.value << "(";
+        for (size_t i = 0; i < arguments.size(); i++) {
+            if (i > 0) out << ", ";
+            arguments[i]->print(out);
+        }
+        out << ")";
+    }
+};
+
+// `{key: value, ...}`
+struct MapExpr : public ASTNode {
+    std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>> entries;
+    MapExpr(std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>> entries)
+        : entries(std::move(entries)) {}
+
+    void print(std::ostream& out) const override {
+        out << "{";
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i > 0) out << ", ";
+            entries[i].first->print(out);
+            out << ": ";
+            entries[i].second->print(out);
+        }
+        out << "}";
+    }
+};
+
+// `object[key]`
+struct IndexExpr : public ASTNode {
+    std::unique_ptr<ASTNode> object, key;
+    IndexExpr(std::unique_ptr<ASTNode> object, std::unique_ptr<ASTNode> key)
+        : object(std::move(object)), key(std::move(key)) {}
+
+    void print(std::ostream& out) const override {
+        object->print(out);
+        out << "[";
+        key->print(out);
+        out << "]";
+    }
+};
+
+// `object[key] = value`
+struct IndexAssignExpr : public ASTNode {
+    std::unique_ptr<ASTNode> object, key, value;
+    IndexAssignExpr(std::unique_ptr<ASTNode> object, std::unique_ptr<ASTNode> key, std::unique_ptr<ASTNode> value)
+        : object(std::move(object)), key(std::move(key)), value(std::move(value)) {}
+
+    void print(std::ostream& out) const override {
+        object->print(out);
+        out << "[";
+        key->print(out);
+        out << "] = ";
+        value->print(out);
+    }
+};
+
 // Statements
 struct Statement : public ASTNode {};
 
@@ -148,4 +235,120 @@ struct WhileStmt : public Statement {
     }
 };
 
+// `for (var variable in iterable) body`
+struct ForInStmt : public Statement {
+    Token variable;
+    std::unique_ptr<ASTNode> iterable;
+    std::unique_ptr<Statement> body;
+    ForInStmt(Token variable, std::unique_ptr<ASTNode> iterable, std::unique_ptr<Statement> body)
+        : variable(variable), iterable(std::move(iterable)), body(std::move(body)) {}
+
+    void print(std::ostream& out) const override {
+        out << "for (var " << variable.value << " in ";
+        iterable->print(out);
+        out << ") ";
+        body->print(out);
+    }
+};
+
+struct FunctionStmt : public Statement {
+    Token name;
+    std::vector<Token> params;
+    std::vector<std::unique_ptr<Statement>> body;
+    FunctionStmt(Token name, std::vector<Token> params, std::vector<std::unique_ptr<Statement>> body)
+        : name(name), params(std::move(params)), body(std::move(body)) {}
+
+    void print(std::ostream& out) const override {
+        out << "fun " << name.value << "(";
+        for (size_t i = 0; i < params.size(); i++) {
+            if (i > 0) out << ", ";
+            out << params[i].value;
+        }
+        out << ") {\n";
+        for (const auto& stmt : body) {
+            out << "  ";
+            stmt->print(out);
+            out << "\n";
+        }
+        out << "}";
+    }
+};
+
+// `parallel for (var i = start; i < end; i = i + step) reduce(kind var, ...) body`
+struct ParallelForStmt : public Statement {
+    Token variable;
+    std::unique_ptr<ASTNode> start, end;
+    bool inclusive;  // `<=` rather than `<`
+    int step;
+    std::vector<std::pair<Token, Token>> reductions;  // (kind, variable)
+    std::unique_ptr<Statement> body;
+    ParallelForStmt(Token variable, std::unique_ptr<ASTNode> start, std::unique_ptr<ASTNode> end,
+                    bool inclusive, int step, std::vector<std::pair<Token, Token>> reductions,
+                    std::unique_ptr<Statement> body)
+        : variable(variable), start(std::move(start)), end(std::move(end)), inclusive(inclusive),
+          step(step), reductions(std::move(reductions)), body(std::move(body)) {}
+
+    void print(std::ostream& out) const override {
+        out << "parallel for (var " << variable.value << " = ";
+        start->print(out);
+        out << "; " << variable.value << (inclusive ? " <= " : " < ");
+        end->print(out);
+        out << "; " << variable.value << " = " << variable.value << " + " << step << ")";
+        if (!reductions.empty()) {
+            out << " reduce(";
+            for (size_t i = 0; i < reductions.size(); i++) {
+                if (i > 0) out << ", ";
+                out << reductions[i].first.value << " " << reductions[i].second.value;
+            }
+            out << ")";
+        }
+        out << " ";
+        body->print(out);
+    }
+};
+
+struct ReturnStmt : public Statement {
+    std::unique_ptr<ASTNode> value;  // May be null for a bare `return;`
+    ReturnStmt(std::unique_ptr<ASTNode> value) : value(std::move(value)) {}
+
+    void print(std::ostream& out) const override {
+        out << "return";
+        if (value) {
+            out << " ";
+            value->print(out);
+        }
+        out << ";";
+    }
+};
+
+// `spawn body` runs the body as a task, concurrently with the code after it
+struct SpawnStmt : public Statement {
+    std::unique_ptr<Statement> body;
+    SpawnStmt(std::unique_ptr<Statement> body) : body(std::move(body)) {}
+
+    void print(std::ostream& out) const override {
+        out << "spawn ";
+        body->print(out);
+    }
+};
+
+// `import "file";` makes the functions of another module callable. Only
+// meaningful at the top level of a module (see modules/modules.h), which
+// removes it before code generation.
+struct ImportStmt : public Statement {
+    Token path;  // The string literal
+    ImportStmt(Token path) : path(path) {}
+
+    void print(std::ostream& out) const override {
+        out << "import \"" << path.value << "\";";
+    }
+};
+
+// `checkpoint;` marks where `--snapshot` saves the VM state
+struct CheckpointStmt : public Statement {
+    void print(std::ostream& out) const override {
+        out << "checkpoint;";
+    }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "batch.h"
+#include "../codegen/codegen.h"
+#include "../codegen/vm.h"
+#include "../runtime/thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct ScriptResult {
+    std::string output;
+    int status = 0;
+    bool done = false;
+};
+
+static std::vector<std::string> collectScripts(const std::string& source) {
+    std::vector<std::string> scripts;
+    if (fs::is_directory(source)) {
+        for (const auto& entry : fs::directory_iterator(source)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".compii") {
+                scripts.push_back(entry.path().string());
+            }
+        }
+        std::sort(scripts.begin(), scripts.end());
+        return scripts;
+    }
+    
+    std::ifstream list(source);
+    if (!list.is_open()) {
+        throw std::runtime_error("Could not open " + source);
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty()) {
+            scripts.push_back(line);
+        }
+    }
+    return scripts;
+}
+
+// Runs one script; stdout and stderr of the script share one buffer
+static void runScript(const std::string& path, ScriptResult& result) {
+    std::ostringstream output;
+    try {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open " + path);
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        
+        BytecodeProgram program = compileSource(buffer.str());
+        VirtualMachine vm(output, output);
+        result.status = vm.execute(program) ? 0 : 1;
+    } catch (const std::exception& e) {
+        output << "Error: " << e.what() << "\n";
+        result.status = 1;
+    }
+    result.output = output.str();
+}
+
+int runBatch(const std::string& source, size_t jobs, std::ostream& out, std::ostream& err) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> scripts = collectScripts(source);
+    std::vector<ScriptResult> results(scripts.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+    
+    ThreadPool pool(jobs);
+    for (size_t i = 0; i < scripts.size(); i++) {
+        pool.submit([&, i] {
+            ScriptResult result;
+            runScript(scripts[i], result);
+            std::lock_guard<std::mutex> lock(mutex);
+            results[i] = std::move(result);
+            results[i].done = true;
+            finished.notify_all();
+        });
+    }
+    
+    // Stream results in input order as soon as each prefix is complete
+    size_t failed = 0;
+    for (size_t i = 0; i < scripts.size(); i++) {
+        ScriptResult result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return results[i].done; });
+            result = std::move(results[i]);
+            results[i].output.clear();
+        }
+        if (result.status != 0) failed++;
+        out << "==> " << scripts[i] << " (exit " << result.status << ")\n" << result.output;
+    }
+    out.flush();
+    pool.wait();
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    err << std::fixed << std::setprecision(3)
+        << "[batch] " << scripts.size() << " scripts, " << failed << " failed, "
+        << seconds << " s, " << std::setprecision(1)
+        << (seconds > 0 ? scripts.size() / seconds : 0.0) << " scripts/s, "
+        << pool.size() << " threads" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <ostream>
+#include <string>
+
+// Compiles and runs many scripts in one process on a work-stealing thread
+// pool. `source` is a directory (every *.compii file in it, sorted by name)
+// or a text file listing one script path per line. Each script gets its
+// own VirtualMachine; its output and exit status are written to `out` in
+// input order, followed by a throughput summary on `err`.
+//
+// Returns 0 if every script succeeded, 1 otherwise.
+int runBatch(const std::string& source, size_t jobs, std::ostream& out, std::ostream& err);
+
+#endif
@@ -0,0 +1,118 @@
+// Checks that the VM's allocations per loop iteration stay where they are:
+// none for integer, double, call and parallel loops and string comparisons,
+// one per string concatenation. Each program runs under --stats at two
+// iteration counts; the difference in the execute phase's allocations must
+// be the expected count per iteration times the difference in iterations.
+//   node check_allocations.js [path/to/compii]
+const { spawnSync } = require("child_process");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+
+const compii = path.resolve(process.argv[2] || path.join(__dirname, "..", "compii"));
+const SMALL = 1000;
+const LARGE = 3000;
+
+// `N` is replaced by the iteration count
+const cases = [
+  {
+    name: "integer loop",
+    perIteration: 0,
+    code: `var sum = 0;
+var i = 0;
+while (i < N) {
+    sum = sum + i * 3 - 1;
+    i = i + 1;
+}
+print(sum);`,
+  },
+  {
+    name: "double loop",
+    perIteration: 0,
+    code: `var x = 0.5;
+var i = 0;
+while (i < N) {
+    x = x * 1.0001 + 0.25 / 2.0;
+    i = i + 1;
+}
+print(x);`,
+  },
+  {
+    name: "calls",
+    perIteration: 0,
+    code: `fun step(a, b) {
+    return a + b;
+}
+var total = 0;
+for (var i = 0; i < N; i = i + 1) {
+    total = step(total, i);
+}
+print(total);`,
+  },
+  {
+    name: "parallel loop",
+    perIteration: 0,
+    code: `var total = 0;
+parallel for (var i = 0; i < N; i = i + 1) reduce(sum total) {
+    total = total + i;
+}
+print(total);`,
+  },
+  {
+    name: "string comparison",
+    perIteration: 0,
+    code: `var a = "alpha" + 1;
+var b = "alpha" + 2;
+var less = 0;
+for (var i = 0; i < N; i = i + 1) {
+    if (a < b && a != b) {
+        less = less + 1;
+    }
+}
+print(less);`,
+  },
+  {
+    name: "string concatenation",
+    perIteration: 1,
+    code: `var s = "";
+for (var i = 0; i < N; i = i + 1) {
+    s = "item " + i;
+}
+print(s);`,
+  },
+];
+
+function executeAllocations(file) {
+  const result = spawnSync(compii, ["--stats", file], {
+    encoding: "utf8",
+    env: { ...process.env, COMPII_THREADS: "2" },
+  });
+  if (result.status !== 0) {
+    throw new Error(`${file}: ${result.stderr || result.error}`);
+  }
+  const lines = result.stderr.trim().split("\n");
+  const stats = JSON.parse(lines[lines.length - 1]);
+  const phase = stats.phases.find((p) => p.name === "execute");
+  return phase.allocations;
+}
+
+const dir = fs.mkdtempSync(path.join(os.tmpdir(), "compii-alloc-"));
+let failed = 0;
+try {
+  for (const c of cases) {
+    const counts = [SMALL, LARGE].map((n) => {
+      const file = path.join(dir, `${c.name.replace(/ /g, "_")}_${n}.compii`);
+      fs.writeFileSync(file, c.code.replace(/\bN\b/g, String(n)));
+      return executeAllocations(file);
+    });
+    const expected = c.perIteration * (LARGE - SMALL);
+    const actual = counts[1] - counts[0];
+    const ok = actual === expected;
+    if (!ok) failed++;
+    console.log(`${ok ? "ok  " : "FAIL"} ${c.name}: ${counts[0]} allocations for ${SMALL} iterations, ` +
+      `${counts[1]} for ${LARGE} (expected ${c.perIteration} per iteration)`);
+  }
+} finally {
+  fs.rmSync(dir, { recursive: true, force: true });
+}
+process.exit(failed ? 1 : 0);
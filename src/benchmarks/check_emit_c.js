@@ -0,0 +1,152 @@
+// Checks that --emit-c and the VM agree: each program is run by the VM,
+// then compiled to C, built with $CC (default cc) and run, and the two must
+// print the same output and errors and exit with the same status.
+//   node check_emit_c.js [path/to/compii]
+const { spawnSync } = require("child_process");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+
+const compii = path.resolve(process.argv[2] || path.join(__dirname, "..", "compii"));
+const cc = process.env.CC || "cc";
+
+const cases = [
+  {
+    name: "integer arithmetic",
+    code: `var a = 17;
+var b = 5;
+print(a + b);
+print(a - b * 3);
+print(a / b);
+print((0 - a) / b);
+print(9223372036854775807 - 1);
+print(0xFF * 2);
+var big = 9007199254740993;
+print(big == 9007199254740992);
+print(big > 9007199254740992);`,
+  },
+  {
+    name: "double and mixed arithmetic",
+    code: `print(0.1 + 0.2);
+print(2.5 * 2);
+print(7 / 2.0);
+print(1e21);
+print(1 + 2.5);
+print("n=" + 3 + 0.5);
+print("5" * 2);
+print(3 < 3.5);
+print("abc" < "abd");
+print("x" == false);`,
+  },
+  {
+    name: "functions",
+    code: `fun factorial(n) {
+    if (n < 2) {
+        return 1;
+    }
+    return n * factorial(n - 1);
+}
+fun count(n, acc) {
+    if (n == 0) {
+        return acc;
+    }
+    return count(n - 1, acc + n);
+}
+var calls = 0;
+fun bump() {
+    calls = calls + 1;
+}
+print(factorial(20));
+print(count(100000, 0));
+bump();
+bump();
+print(calls);
+print(bump());`,
+  },
+  {
+    name: "loops",
+    code: `var total = 0;
+for (var i = 0; i < 1000; i = i + 1) {
+    total = total + i;
+    for (var j = 0; j < 3; j = j + 1) {
+        total = total - j;
+    }
+}
+print(total);
+var k = 10;
+while (k > 0 && total > 0) {
+    k = k - 3;
+}
+print(k);
+var s = 0;
+var text = "";
+parallel for (var p = 0; p < 100; p = p + 1) reduce(sum s) {
+    s = s + p;
+}
+parallel for (var q = 0; q < 5; q = q + 1) reduce(sum text) {
+    text = text + q;
+}
+print(s);
+print(text);`,
+  },
+  {
+    name: "division by zero",
+    code: `print("before");
+var zero = 0;
+print(1 / zero);
+print("after");`,
+  },
+  {
+    name: "integer overflow",
+    code: `var x = 9223372036854775807;
+print(x);
+print(x + 1);`,
+  },
+  {
+    name: "error inside a function",
+    code: `fun parse(text) {
+    return text * 1;
+}
+print(parse("12"));
+print(parse("twelve"));`,
+  },
+];
+
+function run(command, args) {
+  const result = spawnSync(command, args, { encoding: "utf8", env: { ...process.env, COMPII_THREADS: "2" } });
+  if (result.error) throw result.error;
+  return { status: result.status, stdout: result.stdout, stderr: result.stderr };
+}
+
+const dir = fs.mkdtempSync(path.join(os.tmpdir(), "compii-emit-c-"));
+let failed = 0;
+try {
+  for (const c of cases) {
+    const base = path.join(dir, c.name.replace(/ /g, "_"));
+    fs.writeFileSync(`${base}.compii`, c.code);
+    const expected = run(compii, [`${base}.compii`]);
+    let problem = null;
+    const emitted = run(compii, ["--emit-c", `${base}.c`, `${base}.compii`]);
+    if (emitted.status !== 0) {
+      problem = `--emit-c failed: ${emitted.stderr.trim()}`;
+    } else {
+      const built = run(cc, ["-O1", "-o", base, `${base}.c`, "-lm"]);
+      if (built.status !== 0) {
+        problem = `${cc} failed: ${built.stderr.trim()}`;
+      } else {
+        const actual = run(base, []);
+        for (const field of ["stdout", "stderr", "status"]) {
+          if (actual[field] !== expected[field]) {
+            problem = `${field} differs\n  vm: ${JSON.stringify(expected[field])}\n  c:  ${JSON.stringify(actual[field])}`;
+            break;
+          }
+        }
+      }
+    }
+    if (problem) failed++;
+    console.log(`${problem ? "FAIL" : "ok  "} ${c.name}${problem ? `: ${problem}` : ""}`);
+  }
+} finally {
+  fs.rmSync(dir, { recursive: true, force: true });
+}
+process.exit(failed ? 1 : 0);
@@ -0,0 +1,54 @@
+// Writes identifiers/identifiers.compii: straight-line generated code that
+// is mostly variable references, to time the compiler's front end (run it
+// with --stats). Pass a statement count to write more or less.
+//   node make_identifiers.js [statements]
+const fs = require("fs");
+const path = require("path");
+
+const statements = Number(process.argv[2] || 1000000);
+const globals = 5000;
+const functions = 2000;
+const localsPerFunction = 20;
+
+// A fixed seed, so every run writes the same file
+let seed = 12345;
+function random(n) {
+  seed = (seed * 1103515245 + 12345) % 2147483648;
+  return Math.floor(seed / 65536) % n;
+}
+
+const dir = path.join(__dirname, "identifiers");
+fs.mkdirSync(dir, { recursive: true });
+const out = fs.openSync(path.join(dir, "identifiers.compii"), "w");
+
+let chunk = "";
+for (let g = 0; g < globals; g++) {
+  chunk += `var counter_${g} = ${g};\n`;
+}
+const perFunction = Math.floor(statements / 2 / functions);
+for (let f = 0; f < functions; f++) {
+  chunk += `fun update_${f}(first_value, second_value) {\n`;
+  for (let l = 0; l < localsPerFunction; l++) {
+    chunk += `    var local_${l} = first_value + ${l};\n`;
+  }
+  for (let s = 0; s < perFunction; s++) {
+    chunk += `    local_${random(localsPerFunction)} = local_${random(localsPerFunction)} + ` +
+      `counter_${random(globals)} - second_value;\n`;
+  }
+  chunk += `    return local_0;\n}\n`;
+  fs.writeSync(out, chunk);
+  chunk = "";
+}
+for (let s = 0; s < statements / 2; s++) {
+  const g = random(globals);
+  chunk += s % 50 === 0
+    ? `counter_${g} = update_${random(functions)}(counter_${random(globals)}, counter_${random(globals)});\n`
+    : `counter_${g} = counter_${random(globals)} + counter_${random(globals)} - counter_${g};\n`;
+  if (chunk.length > 1 << 20) {
+    fs.writeSync(out, chunk);
+    chunk = "";
+  }
+}
+chunk += `print(counter_0 + counter_1);\n`;
+fs.writeSync(out, chunk);
+fs.closeSync(out);
@@ -0,0 +1,30 @@
+// Writes access.log for log_scan.compii: about 1 GB of lines like
+// "503 GET /api/items 12ms". Pass a size in megabytes to write less.
+//   node make_log.js [megabytes]
+const fs = require("fs");
+const path = require("path");
+
+const megabytes = Number(process.argv[2] || 1024);
+const statuses = ["200", "200", "200", "201", "204", "301", "304", "404", "500", "503"];
+const methods = ["GET", "GET", "POST", "PUT", "DELETE"];
+const routes = ["/api/items", "/api/users/42", "/static/app.js", "/index.html", "/api/orders?page=3"];
+
+// A fixed seed, so every run writes the same file
+let seed = 12345;
+function random(n) {
+  seed = (seed * 1103515245 + 12345) % 2147483648;
+  return Math.floor(seed / 65536) % n;  // The low bits repeat quickly
+}
+
+const out = fs.openSync(path.join(__dirname, "access.log"), "w");
+const target = megabytes * 1024 * 1024;
+let written = 0;
+while (written < target) {
+  let chunk = "";
+  for (let i = 0; i < 10000; i++) {
+    chunk += `${statuses[random(statuses.length)]} ${methods[random(methods.length)]} ` +
+      `${routes[random(routes.length)]} ${random(900) + 1}ms\n`;
+  }
+  written += fs.writeSync(out, chunk);
+}
+fs.closeSync(out);
@@ -0,0 +1,61 @@
+// Writes the map_lookup benchmarks into benchmarks/map_lookup/: for 10, 1k
+// and 1M integer keys, a program that looks keys up in a map literal and
+// one that looks them up with a function made of one if per key. Both
+// print the same total.
+//   node make_map_lookup.js
+const fs = require("fs");
+const path = require("path");
+
+const sizes = [
+  { name: "10", keys: 10, lookups: 2000000 },
+  { name: "1k", keys: 1000, lookups: 200000 },
+  { name: "1m", keys: 1000000, lookups: 200 },
+];
+
+const dir = path.join(__dirname, "map_lookup");
+fs.mkdirSync(dir, { recursive: true });
+
+const valueOf = (key) => key * 3 + 1;
+
+const gcd = (a, b) => (b === 0 ? a : gcd(b, a % b));
+
+// Keys are visited about 0.618 of the key count apart, so that even a few
+// lookups land all over the if-chain. The step shares no factor with the
+// key count, so every key is reached before any repeats.
+function loop(keys, lookups, lookup) {
+  let step = Math.round(keys * 0.618);
+  while (gcd(step, keys) !== 1) {
+    step++;
+  }
+  return `var total = 0;
+var key = 0;
+var i = 0;
+while (i < ${lookups}) {
+    total = total + ${lookup};
+    key = key + ${step};
+    if (key >= ${keys}) {
+        key = key - ${keys};
+    }
+    i = i + 1;
+}
+print(total);
+`;
+}
+
+for (const { name, keys, lookups } of sizes) {
+  const header = `// Generated by make_map_lookup.js: ${lookups} lookups among ${keys} integer keys\n`;
+
+  const entries = [];
+  for (let key = 0; key < keys; key++) {
+    entries.push(`${key}: ${valueOf(key)}`);
+  }
+  fs.writeFileSync(path.join(dir, `map_${name}.compii`),
+    header + `var table = {${entries.join(", ")}};\n` + loop(keys, lookups, "table[key]"));
+
+  const chain = [];
+  for (let key = 0; key < keys; key++) {
+    chain.push(`    if (k == ${key}) { return ${valueOf(key)}; }\n`);
+  }
+  fs.writeFileSync(path.join(dir, `if_${name}.compii`),
+    header + `fun lookup(k) {\n${chain.join("")}    return 0;\n}\n` + loop(keys, lookups, "lookup(key)"));
+}
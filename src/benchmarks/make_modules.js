@@ -0,0 +1,73 @@
+// Writes modules/: a program of 100 modules of 10k statements each, and
+// main.compii importing them all, to time rebuilds with --module-cache.
+// Every module imports the one before it and calls one of its functions.
+// With --edit <n>, only rewrites the top-level code of module 50 to add n,
+// as a one-module change.
+//   node make_modules.js [--edit <n>]
+const fs = require("fs");
+const path = require("path");
+
+const modules = 100;
+const statementsPerModule = 10000;
+const globalsPerModule = 50;
+const functionsPerModule = 20;
+const localsPerFunction = 10;
+const editArg = process.argv.indexOf("--edit");
+const edit = editArg >= 0 ? Number(process.argv[editArg + 1]) : null;
+
+const dir = path.join(__dirname, "modules");
+fs.mkdirSync(dir, { recursive: true });
+
+const name = (m) => `module_${String(m).padStart(3, "0")}`;
+
+function writeModule(m, revision) {
+  // A fixed seed per module, so every run writes the same files
+  let seed = 12345 + m;
+  const random = (n) => {
+    seed = (seed * 1103515245 + 12345) % 2147483648;
+    return Math.floor(seed / 65536) % n;
+  };
+  const global = (g) => `m${m}_counter_${g}`;
+
+  let text = `// Generated by make_modules.js\n`;
+  if (m > 0) {
+    text += `import "${name(m - 1)}.compii";\n`;
+  }
+  for (let g = 0; g < globalsPerModule; g++) {
+    text += `var ${global(g)} = ${g};\n`;
+  }
+  const perFunction = Math.floor(statementsPerModule / 2 / functionsPerModule);
+  for (let f = 0; f < functionsPerModule; f++) {
+    text += `fun m${m}_update_${f}(first_value, second_value) {\n`;
+    for (let l = 0; l < localsPerFunction; l++) {
+      text += `    var local_${l} = first_value + ${l};\n`;
+    }
+    for (let s = 0; s < perFunction; s++) {
+      text += `    local_${random(localsPerFunction)} = local_${random(localsPerFunction)} + ` +
+        `${global(random(globalsPerModule))} - second_value;\n`;
+    }
+    text += `    return local_0;\n}\n`;
+  }
+  for (let s = 0; s < statementsPerModule / 2; s++) {
+    const g = random(globalsPerModule);
+    const callee = m > 0 && s % 100 === 0 ? `m${m - 1}_update_${random(functionsPerModule)}`
+      : `m${m}_update_${random(functionsPerModule)}`;
+    text += s % 50 === 0
+      ? `${global(g)} = ${callee}(${global(random(globalsPerModule))}, ${global(random(globalsPerModule))});\n`
+      : `${global(g)} = ${global(random(globalsPerModule))} + ${global(random(globalsPerModule))} - ${global(g)};\n`;
+  }
+  text += `${global(0)} = ${global(0)} + ${revision};\n`;
+  fs.writeFileSync(path.join(dir, `${name(m)}.compii`), text);
+}
+
+if (edit !== null) {
+  writeModule(50, edit);
+} else {
+  let main = `// Generated by make_modules.js\n`;
+  for (let m = 0; m < modules; m++) {
+    writeModule(m, 0);
+    main += `import "${name(m)}.compii";\n`;
+  }
+  main += `print(m0_counter_0 + m${modules - 1}_counter_0);\n`;
+  fs.writeFileSync(path.join(dir, "main.compii"), main);
+}
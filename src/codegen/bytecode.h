@@ -5,6 +5,8 @@
 #include <string>
 #include <variant>
 #include <unordered_map>
+#include "../runtime/object.h"
+#include "../runtime/string_ref.h"
 
 // Bytecode instruction types
 enum class OpCode {
@@ -15,6 +17,8 @@ enum class OpCode {
     // Variable operations
     STORE,      // Store top of stack in variable
     LOAD,       // Load variable onto stack
+    STORE_LOCAL, // Store top of stack in a slot of the current call frame
+    LOAD_LOCAL,  // Load a slot of the current call frame onto stack
     
     // Arithmetic operations
     ADD,        // Add top two values
@@ -22,6 +26,12 @@ enum class OpCode {
     MUL,        // Multiply top two values
     DIV,        // Divide top two values
     
+    // Guarded arithmetic, emitted where a profile only saw integers: the
+    // integer case is inline and anything else behaves like ADD/SUB/MUL
+    ADD_INT,
+    SUB_INT,
+    MUL_INT,
+    
     // Comparison operations
     CMP_EQ,     // Equal
     CMP_NE,     // Not equal
@@ -33,16 +43,116 @@ enum class OpCode {
     // Control flow
     JMP,        // Unconditional jump
     JMP_IF_FALSE, // Jump if top of stack is false
+    JMP_IF_TRUE,  // Jump if top of stack is true
+    
+    // Compare and branch: pop two values, compare them like the CMP_xx of
+    // the same name and jump if the result is FALSE. Branching on the false
+    // outcome keeps NaN comparisons identical to CMP_xx + JMP_IF_FALSE.
+    JEQ,
+    JNE,
+    JLT,
+    JLE,
+    JGT,
+    JGE,
+    
+    // Guarded compare and branch, emitted where a profile only saw integers:
+    // the same as the J opcodes without `_INT` for any operands
+    JEQ_INT,
+    JNE_INT,
+    JLT_INT,
+    JLE_INT,
+    JGT_INT,
+    JGE_INT,
+    
+    // Back edge of a counted loop: step the counter and jump to the body
+    // while the loop condition holds (operand: counted loop index)
+    LOOP_INC_JMP,
+    
+    // Iteration (see iterator.h)
+    ITER,       // Pop a value, push an iterator over it
+    ITER_NEXT,  // Pop an iterator, push its next value; once there is none, push false and jump (operand: exit pc)
+    
+    // Functions
+    CALL,       // Call function (operand: function index)
+    TAIL_CALL,  // Call function reusing the current frame
+    RET,        // Return top of stack to the caller
     
-    // I/O
+    // Parallel loops
+    PAR_FOR,    // Run a loop body over a range on the thread pool (operand: loop index)
+    PAR_END,    // End of one parallel loop iteration
+    
+    // Tasks and channels (see tasks.h)
+    SPAWN,      // Start a task at the next instruction, continue after its TASK_END (operand: pc of TASK_END)
+    TASK_END,   // End of a task body
+    CHAN_NEW,   // Pop a capacity, push a new channel
+    SEND,       // Pop a value and a channel, send the value; waits while the channel is full
+    RECV,       // Pop a channel, push the next value received from it; waits while there is none
+    
+    // Maps (see map.h)
+    MAP_NEW,    // Push a new map (operand: number of keys to make room for)
+    MAP_INSERT, // Pop a value and a key, add them to the map now on top
+    INDEX,      // Pop a key and a map, push the key's value
+    INDEX_SET,  // Pop a value, a key and a map, set the key to the value, push the value
+    MAP_HAS,    // Pop a key and a map, push whether the map has the key
+    MAP_DELETE, // Pop a key and a map, remove the key, push whether it was there
+    MAP_SIZE,   // Pop a map, push its number of keys
+    
+    // I/O (see runtime/input.h)
+    READ_LINE,  // Push the next line of standard input, or false at its end
+    READ_ALL,   // Pop a path, push the whole file ("-": the rest of standard input)
+    LINES,      // Pop a path, push an iterator over the file's lines ("-": standard input)
     PRINT,      // Print top of stack
     
     // Program control
+    SNAPSHOT,   // Save the VM state if a snapshot was requested (see snapshot.h)
     HALT        // Stop execution
 };
 
-// Value types that can be stored in bytecode
-using Value = std::variant<int, double, bool, std::string>;
+// Opcodes whose result depends on input from outside the program
+inline bool readsInput(OpCode op) {
+    return op >= OpCode::READ_LINE && op <= OpCode::LINES;
+}
+
+// Opcodes that create or use maps
+inline bool isMapOp(OpCode op) {
+    return op >= OpCode::MAP_NEW && op <= OpCode::MAP_SIZE;
+}
+
+// JMP_IF_FALSE, JMP_IF_TRUE and the compare-and-branch opcodes
+inline bool isConditionalJump(OpCode op) {
+    return op >= OpCode::JMP_IF_FALSE && op <= OpCode::JGE_INT;
+}
+
+// The comparison a compare-and-branch opcode performs
+inline OpCode fusedComparison(OpCode op) {
+    OpCode first = op >= OpCode::JEQ_INT ? OpCode::JEQ_INT : OpCode::JEQ;
+    return static_cast<OpCode>(static_cast<int>(OpCode::CMP_EQ) + (static_cast<int>(op) - static_cast<int>(first)));
+}
+
+// The opcode a guarded integer opcode behaves like; other opcodes map to
+// themselves
+inline OpCode genericOp(OpCode op) {
+    if (op >= OpCode::ADD_INT && op <= OpCode::MUL_INT) {
+        return static_cast<OpCode>(static_cast<int>(OpCode::ADD) + (static_cast<int>(op) - static_cast<int>(OpCode::ADD_INT)));
+    }
+    if (op >= OpCode::JEQ_INT && op <= OpCode::JGE_INT) {
+        return static_cast<OpCode>(static_cast<int>(OpCode::JEQ) + (static_cast<int>(op) - static_cast<int>(OpCode::JEQ_INT)));
+    }
+    return op;
+}
+
+// The guarded integer version of ADD, SUB, MUL or a compare-and-branch
+inline OpCode integerOp(OpCode op) {
+    if (op >= OpCode::ADD && op <= OpCode::MUL) {
+        return static_cast<OpCode>(static_cast<int>(OpCode::ADD_INT) + (static_cast<int>(op) - static_cast<int>(OpCode::ADD)));
+    }
+    return static_cast<OpCode>(static_cast<int>(OpCode::JEQ_INT) + (static_cast<int>(op) - static_cast<int>(OpCode::JEQ)));
+}
+
+// Value types. Strings are immutable; string literals are interned when the
+// bytecode is generated. Objects (channels, maps, iterators) only exist at
+// run time and never appear in bytecode.
+using Value = std::variant<int64_t, double, bool, StringRef, ObjectRef>;
 
 // A single bytecode instruction
 struct Instruction {
@@ -53,10 +163,64 @@ struct Instruction {
     Instruction(OpCode op, Value operand) : op(op), operand(operand) {}
 };
 
+// A compiled function. Arguments occupy the first `arity` slots of the
+// frame, followed by the function's own locals.
+struct FunctionInfo {
+    std::string name;
+    size_t entry = 0;       // Index of the first instruction
+    int arity = 0;
+    int localCount = 0;     // Total frame slots, arguments included
+};
+
+enum class ReductionKind { SUM, MIN, MAX, CONCAT };
+
+// A variable combined across the chunks of a parallel loop
+struct Reduction {
+    ReductionKind kind;
+    bool local;     // Frame slot rather than global
+    int slot;
+};
+
+// A `parallel for` over [start, end) or [start, end]; the bounds are popped
+// by PAR_FOR. The body occupies [bodyStart, bodyEnd), bodyEnd being PAR_END.
+struct ParallelLoopInfo {
+    size_t bodyStart = 0;
+    size_t bodyEnd = 0;
+    bool inductionLocal = false;
+    int inductionSlot = 0;
+    bool inclusive = false;
+    int step = 1;
+    std::vector<Reduction> reductions;
+};
+
+// A loop closed by `i = i + step` (or `- step`) whose condition compares `i`
+// with a number literal or a variable. LOOP_INC_JMP performs the increment
+// and re-tests the condition in one instruction; the condition is only
+// compiled as code before the first iteration.
+struct CountedLoopInfo {
+    size_t bodyStart = 0;   // Where LOOP_INC_JMP jumps back to
+    bool counterLocal = false;
+    int counterSlot = 0;
+    OpCode stepOp = OpCode::ADD;  // ADD or SUB, as written
+    int64_t step = 1;
+    OpCode compare = OpCode::CMP_LT;  // Loop continues while this is true
+    bool limitIsSlot = false;
+    bool limitLocal = false;
+    int limitSlot = 0;
+    Value limit = int64_t{0};  // When !limitIsSlot
+};
+
 // A complete bytecode program
 struct BytecodeProgram {
     std::vector<Instruction> instructions;
     std::unordered_map<std::string, size_t> labels;  // For jump targets
+    std::vector<FunctionInfo> functions;
+    std::vector<ParallelLoopInfo> parallelLoops;
+    std::vector<CountedLoopInfo> countedLoops;
+    size_t globalCount = 0;  // Number of global variable slots
+    // First instruction of the top-level code. It runs up to the next
+    // function entry; only streamed programs put functions before it.
+    size_t mainEntry = 0;
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,813 @@
+#include "c_emitter.h"
+#include "verifier.h"
+#include "vm.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Runtime shared by every generated file. It mirrors vm.cpp: strings are
+// reference counted (literals are immortal), numbers are formatted like
+// runtime/number_format.h, and runtime errors are reported in the VM's words.
+const char* RUNTIME = R"(#ifdef __GNUC__
+/* Not every program uses every helper, label and array */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wunused-label"
+#endif
+
+#include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { T_INT, T_DOUBLE, T_BOOL, T_STR };
+enum { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE };
+
+#define STR_IMMORTAL ((size_t)-1)
+
+typedef struct Str {
+    size_t refs;
+    size_t len;
+    char data[];
+} Str;
+
+typedef struct {
+    int tag;
+    union { int64_t i; double d; int b; Str* s; } as;
+} Value;
+
+typedef struct {
+    size_t site;  /* Call site to return to */
+    size_t base;  /* Caller's frame base */
+} Frame;
+
+/* Errors inside a parallel loop body are reported at the loop, as in the VM */
+static long rt_par_pc = -1;
+static int rt_par_depth = 0;
+
+static void rt_error(long pc, const char* message) {
+    fflush(stdout);
+    if (rt_par_depth > 0) pc = rt_par_pc;
+    fprintf(stderr, "Runtime error at PC %ld: Runtime error: %s\n", pc, message);
+    exit(1);
+}
+
+static inline Value v_int(int64_t i) { Value v; v.tag = T_INT; v.as.i = i; return v; }
+static inline Value v_double(double d) { Value v; v.tag = T_DOUBLE; v.as.d = d; return v; }
+static inline Value v_bool(int b) { Value v; v.tag = T_BOOL; v.as.b = b != 0; return v; }
+static inline Value v_str(Str* s) { Value v; v.tag = T_STR; v.as.s = s; return v; }
+
+static inline Value v_copy(Value v) {
+    if (v.tag == T_STR && v.as.s->refs != STR_IMMORTAL) v.as.s->refs++;
+    return v;
+}
+
+static inline void v_drop(Value v) {
+    if (v.tag == T_STR && v.as.s->refs != STR_IMMORTAL && --v.as.s->refs == 0) free(v.as.s);
+}
+
+static Str* str_alloc(size_t len) {
+    Str* s = (Str*)malloc(sizeof(Str) + len + 1);
+    if (!s) rt_error(-1, "Out of memory");
+    s->refs = 1;
+    s->len = len;
+    s->data[len] = '\0';
+    return s;
+}
+
+static Str* str_literal(const char* data, size_t len) {
+    Str* s = str_alloc(len);
+    memcpy(s->data, data, len);
+    s->refs = STR_IMMORTAL;
+    return s;
+}
+
+/* Whether the decimal `c` reads back as `x`. `c` and `all`, the 19-digit
+   rounding of `x`, are integers in units of its 19th digit; `gap_lo` and
+   `gap_hi` are half the distances to the doubles around `x` in those units,
+   or NaN when they cannot be computed. Only decimals too close to call go
+   through strtod. */
+static int fmt_reads_back(double x, unsigned long long all, unsigned long long c, int exp19, double gap_lo,
+                          double gap_hi) {
+    char text[40];
+    double gap = c > all ? gap_hi : gap_lo;
+    double dist = (double)(c > all ? c - all : all - c);
+    if (dist + 0.5 < gap * (1 - 1e-9)) return 1;
+    if (dist - 0.5 > gap * (1 + 1e-9)) return 0;
+    snprintf(text, sizeof text, "%llue%d", c, exp19 - 18);
+    return strtod(text, NULL) == x;
+}
+
+/* Significant digits of the shortest decimal that reads back as `x`, a
+   positive finite double, as an integer; `*exp` receives the exponent of its
+   first digit. Of several such decimals it is the closest to `x`, as with
+   std::to_chars. */
+static unsigned long long fmt_shortest(double x, int* exp) {
+    char text[40];
+    int count, exp19, i;
+    unsigned long long all = 0, scale, kept, other;
+    double unit, gap_lo = NAN, gap_hi = NAN;
+    const char* p;
+    if (x < 9007199254740992.0 && x == floor(x)) {
+        /* Integers this small are exact, so their digits are the shortest */
+        kept = (unsigned long long)x;
+        for (*exp = -1, other = kept; other; other /= 10) (*exp)++;
+        return kept;
+    }
+    /* Candidates are roundings of the first 19 digits; 17 digits always read
+       back as `x`. Decimals of up to 15 digits survive a round trip through
+       a double, so if any of them reads back as `x`, it is the 15-digit
+       rounding with its trailing zeros dropped. Subnormals are less precise
+       and are searched from one digit up. */
+    snprintf(text, sizeof text, "%.18e", x);
+    for (p = text; *p != 'e'; p++) {
+        if (*p != '.') all = all * 10 + (unsigned)(*p - '0');
+    }
+    exp19 = atoi(p + 1);
+    if (exp19 > -290 && x < DBL_MAX) {
+        unit = pow(10, exp19 - 18);
+        gap_lo = (x - nextafter(x, 0)) / 2 / unit;
+        gap_hi = (nextafter(x, INFINITY) - x) / 2 / unit;
+    }
+    for (count = fpclassify(x) == FP_SUBNORMAL ? 1 : 15;; count++) {
+        for (scale = 1, i = count; i < 19; i++) scale *= 10;
+        kept = all / scale * scale;
+        if (kept == all) break;
+        if (2 * (all - kept) == scale) {
+            /* A tie in the 19 digits: round the exact value instead */
+            snprintf(text, sizeof text, "%.*e", count - 1, x);
+            for (p = text, kept = 0; *p != 'e'; p++) {
+                if (*p != '.') kept = kept * 10 + (unsigned)(*p - '0');
+            }
+            kept *= atoi(p + 1) > exp19 ? scale * 10 : scale;
+        } else if (2 * (all - kept) > scale) {
+            kept += scale;
+        }
+        if (count == 17 || fmt_reads_back(x, all, kept, exp19, gap_lo, gap_hi)) break;
+        /* The rounding can fall just outside the values that read back as
+           `x` while the next decimal on the other side of `x` is inside */
+        other = kept > all ? kept - scale : kept + scale;
+        if (fmt_reads_back(x, all, other, exp19, gap_lo, gap_hi)) {
+            kept = other;
+            break;
+        }
+    }
+    kept /= scale;
+    for (*exp = exp19 - count, other = kept; other; other /= 10) (*exp)++;
+    return kept;
+}
+
+/* Shortest text that reads back as `d`, as std::to_chars writes it: fixed or
+   scientific notation, whichever is shorter, fixed on a tie. `out` has room
+   for 32 characters. */
+static size_t fmt_double(double d, char* out) {
+    char reversed[24], digits[24];
+    int count, exp, i, fixed_len, sci_len;
+    unsigned long long m;
+    size_t n = 0;
+    if (isnan(d)) return (size_t)sprintf(out, signbit(d) ? "-nan" : "nan");
+    if (isinf(d)) return (size_t)sprintf(out, d < 0 ? "-inf" : "inf");
+    if (d == 0) return (size_t)sprintf(out, signbit(d) ? "-0" : "0");
+    for (m = fmt_shortest(fabs(d), &exp), i = 0; m; m /= 10) reversed[i++] = (char)('0' + m % 10);
+    for (count = 0; i > 0; count++) digits[count] = reversed[--i];
+    while (count > 1 && digits[count - 1] == '0') count--;
+    sci_len = count + (count > 1) + (exp <= -100 || exp >= 100 ? 5 : 4);
+    fixed_len = exp >= count - 1 ? exp + 1 : exp >= 0 ? count + 1 : count + 1 - exp;
+    if (fixed_len <= sci_len && exp >= count - 1) {
+        return (size_t)sprintf(out, "%.0f", d);  /* An integer: all its digits */
+    }
+    if (signbit(d)) out[n++] = '-';
+    if (fixed_len <= sci_len && exp >= 0) {
+        memcpy(out + n, digits, (size_t)exp + 1);
+        n += (size_t)exp + 1;
+        out[n++] = '.';
+        memcpy(out + n, digits + exp + 1, (size_t)(count - exp - 1));
+        n += (size_t)(count - exp - 1);
+    } else if (fixed_len <= sci_len) {
+        out[n++] = '0';
+        out[n++] = '.';
+        memset(out + n, '0', (size_t)(-exp - 1));
+        n += (size_t)(-exp - 1);
+        memcpy(out + n, digits, (size_t)count);
+        n += (size_t)count;
+    } else {
+        out[n++] = digits[0];
+        if (count > 1) {
+            out[n++] = '.';
+            memcpy(out + n, digits + 1, (size_t)count - 1);
+            n += (size_t)count - 1;
+        }
+        n += (size_t)sprintf(out + n, "e%c%02d", exp < 0 ? '-' : '+', exp < 0 ? -exp : exp);
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* Text of a value in string concatenation */
+static const char* v_text(Value v, char* scratch, size_t* len) {
+    switch (v.tag) {
+        case T_STR: *len = v.as.s->len; return v.as.s->data;
+        case T_INT: *len = (size_t)sprintf(scratch, "%" PRId64, v.as.i); return scratch;
+        case T_DOUBLE: *len = fmt_double(v.as.d, scratch); return scratch;
+        default: *len = v.as.b ? 4 : 5; return v.as.b ? "true" : "false";
+    }
+}
+
+/* Integer +, -, * and / stop with the VM's error where the result does not
+   fit in 64 bits */
+static int64_t i_arith(char op, int64_t x, int64_t y, long pc) {
+    int64_t r;
+    int overflow;
+    switch (op) {
+#ifdef __GNUC__
+        case '+': overflow = __builtin_add_overflow(x, y, &r); break;
+        case '-': overflow = __builtin_sub_overflow(x, y, &r); break;
+        case '*': overflow = __builtin_mul_overflow(x, y, &r); break;
+#else
+        case '+':
+            overflow = y > 0 ? x > INT64_MAX - y : x < INT64_MIN - y;
+            r = overflow ? 0 : x + y;
+            break;
+        case '-':
+            overflow = y < 0 ? x > INT64_MAX + y : x < INT64_MIN + y;
+            r = overflow ? 0 : x - y;
+            break;
+        case '*':
+            overflow = x > 0 ? (y > 0 ? x > INT64_MAX / y : y < INT64_MIN / x)
+                             : (y > 0 ? x < INT64_MIN / y : x != 0 && y < INT64_MAX / x);
+            r = overflow ? 0 : x * y;
+            break;
+#endif
+        default:
+            if (y == 0) rt_error(pc, "Division by zero");
+            overflow = x == INT64_MIN && y == -1;
+            r = overflow ? 0 : x / y;
+            break;
+    }
+    if (overflow) rt_error(pc, "Integer overflow");
+    return r;
+}
+
+static Value v_number(Value v, long pc) {
+    char* end;
+    switch (v.tag) {
+        case T_INT:
+        case T_DOUBLE:
+            return v;
+        case T_BOOL:
+            return v_int(v.as.b ? 1 : 0);
+        default:
+            errno = 0;
+            if (memchr(v.as.s->data, '.', v.as.s->len)) {
+                double d = strtod(v.as.s->data, &end);
+                if (end == v.as.s->data || errno == ERANGE) rt_error(pc, "Invalid number format");
+                return v_double(d);
+            } else {
+                long long i = strtoll(v.as.s->data, &end, 10);
+                if (end == v.as.s->data || errno == ERANGE) rt_error(pc, "Invalid number format");
+                return v_int(i);
+            }
+    }
+}
+
+static Value v_arith(char op, Value a, Value b, long pc) {
+    Value y = v_number(b, pc);
+    Value x = v_number(a, pc);
+    double dx, dy;
+    v_drop(a);
+    v_drop(b);
+    if (x.tag == T_INT && y.tag == T_INT) {
+        return v_int(i_arith(op, x.as.i, y.as.i, pc));
+    }
+    dx = x.tag == T_INT ? (double)x.as.i : x.as.d;
+    dy = y.tag == T_INT ? (double)y.as.i : y.as.d;
+    switch (op) {
+        case '+': return v_double(dx + dy);
+        case '-': return v_double(dx - dy);
+        case '*': return v_double(dx * dy);
+        default:
+            if (dy == 0) rt_error(pc, "Division by zero");
+            return v_double(dx / dy);
+    }
+}
+
+static Value v_add(Value a, Value b, long pc) {
+    if (a.tag == T_STR || b.tag == T_STR) {
+        char scratchA[32], scratchB[32];
+        size_t la, lb;
+        const char* ta = v_text(a, scratchA, &la);
+        const char* tb = v_text(b, scratchB, &lb);
+        Str* s = str_alloc(la + lb);
+        memcpy(s->data, ta, la);
+        memcpy(s->data + la, tb, lb);
+        v_drop(a);
+        v_drop(b);
+        return v_str(s);
+    }
+    return v_arith('+', a, b, pc);
+}
+
+static Value v_cmp(int op, Value a, Value b, long pc) {
+    int c;
+    if ((op == CMP_EQ || op == CMP_NE) &&
+        ((a.tag == T_STR && b.tag == T_BOOL) || (a.tag == T_BOOL && b.tag == T_STR))) {
+        v_drop(a);
+        v_drop(b);
+        return v_bool(op == CMP_NE);
+    }
+    if (a.tag == T_STR && b.tag == T_STR) {
+        size_t la = a.as.s->len, lb = b.as.s->len;
+        c = memcmp(a.as.s->data, b.as.s->data, la < lb ? la : lb);
+        if (c == 0) c = (la > lb) - (la < lb);
+        v_drop(a);
+        v_drop(b);
+    } else {
+        Value y = v_number(b, pc);
+        Value x = v_number(a, pc);
+        v_drop(a);
+        v_drop(b);
+        if (x.tag != T_INT || y.tag != T_INT) {
+            /* Two integers compare exactly, anything else as doubles */
+            double dx = x.tag == T_INT ? (double)x.as.i : x.as.d;
+            double dy = y.tag == T_INT ? (double)y.as.i : y.as.d;
+            switch (op) {
+                case CMP_EQ: return v_bool(dx == dy);
+                case CMP_NE: return v_bool(dx != dy);
+                case CMP_LT: return v_bool(dx < dy);
+                case CMP_LE: return v_bool(dx <= dy);
+                case CMP_GT: return v_bool(dx > dy);
+                default: return v_bool(dx >= dy);
+            }
+        }
+        c = (x.as.i > y.as.i) - (x.as.i < y.as.i);
+    }
+    switch (op) {
+        case CMP_EQ: return v_bool(c == 0);
+        case CMP_NE: return v_bool(c != 0);
+        case CMP_LT: return v_bool(c < 0);
+        case CMP_LE: return v_bool(c <= 0);
+        case CMP_GT: return v_bool(c > 0);
+        default: return v_bool(c >= 0);
+    }
+}
+
+static int v_truthy(Value v) {
+    int result;
+    switch (v.tag) {
+        case T_BOOL: result = v.as.b; break;
+        case T_INT: result = v.as.i != 0; break;
+        case T_DOUBLE: result = v.as.d != 0.0; break;
+        default: result = v.as.s->len != 0; break;
+    }
+    v_drop(v);
+    return result;
+}
+
+static void v_print(Value v) {
+    char text[32];
+    switch (v.tag) {
+        case T_INT: printf("%" PRId64 "\n", v.as.i); break;
+        case T_DOUBLE: fmt_double(v.as.d, text); puts(text); break;
+        case T_BOOL: puts(v.as.b ? "true" : "false"); break;
+        default: fwrite(v.as.s->data, 1, v.as.s->len, stdout); putchar('\n'); break;
+    }
+    v_drop(v);
+}
+)";
+
+// C string literal for arbitrary bytes
+std::string quote(const std::string& text) {
+    std::string out = "\"";
+    char buffer[8];
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\' || c == '?') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c >= 0x20 && c < 0x7F) {
+            out += static_cast<char>(c);
+        } else {
+            std::snprintf(buffer, sizeof(buffer), "\\%03o", c);
+            out += buffer;
+        }
+    }
+    return out + "\"";
+}
+
+std::string intLiteral(int64_t value) {
+    if (value == INT64_MIN) {
+        return "(-INT64_C(9223372036854775807) - 1)";
+    }
+    return "INT64_C(" + std::to_string(value) + ")";
+}
+
+std::string doubleLiteral(double value) {
+    if (std::isnan(value)) return "NAN";
+    if (std::isinf(value)) return value < 0 ? "(-INFINITY)" : "INFINITY";
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%a", value);
+    return buffer;
+}
+
+class CEmitter {
+public:
+    CEmitter(const BytecodeProgram& program, std::ostream& out)
+        : program(program), out(out), bounds(verify(program)) {}
+
+    void emit() {
+        for (const auto& instr : program.instructions) {
+            if (instr.op >= OpCode::SPAWN && instr.op <= OpCode::RECV) {
+                throw std::runtime_error("--emit-c does not support spawn and channels");
+            }
+            if (readsInput(instr.op) || instr.op == OpCode::ITER || instr.op == OpCode::ITER_NEXT) {
+                throw std::runtime_error("--emit-c does not support input and for-in loops");
+            }
+            if (isMapOp(instr.op)) {
+                throw std::runtime_error("--emit-c does not support maps");
+            }
+        }
+        collectStrings();
+        size_t stackSlots = std::max(VirtualMachine::STACK_SLOTS, bounds.mainDepth);
+
+        out << "/* Generated by compii --emit-c */\n" << RUNTIME << "\n";
+        out << "#define STACK_SLOTS " << stackSlots << "\n";
+        out << "#define MAX_CALL_DEPTH " << VirtualMachine::MAX_CALL_DEPTH << "\n\n";
+        out << "int main(void) {\n";
+        out << "    static Value stack[STACK_SLOTS];\n";
+        out << "    static Frame frames[MAX_CALL_DEPTH];\n";
+        if (program.globalCount > 0) {
+            out << "    static Value globals[" << program.globalCount << "];\n";
+        }
+        if (!strings.empty()) {
+            out << "    static Str* strings[" << strings.size() << "];\n";
+        }
+        out << "    size_t sp = 0, base = 0, fp = 0, i;\n";
+        out << "    (void)frames; (void)base; (void)fp; (void)i;\n";
+        out << "    static char output[1 << 16];\n";
+        out << "    setvbuf(stdout, output, _IOFBF, sizeof(output));\n";
+        if (program.globalCount > 0) {
+            out << "    for (i = 0; i < " << program.globalCount << "; i++) globals[i] = v_int(0);\n";
+        }
+        for (const auto& [text, index] : strings) {
+            out << "    strings[" << index << "] = str_literal(" << quote(text) << ", " << text.size() << ");\n";
+        }
+        out << "\n";
+        if (program.mainEntry != 0) {
+            out << "    goto L" << program.mainEntry << ";\n";
+        }
+
+        for (size_t pc = 0; pc < program.instructions.size(); pc++) {
+            out << "L" << pc << ": ";
+            emitInstruction(pc, program.instructions[pc]);
+        }
+
+        // Functions that are only ever inlined still have their RET
+        bool hasReturn = std::any_of(program.instructions.begin(), program.instructions.end(),
+                                     [](const Instruction& instr) { return instr.op == OpCode::RET; });
+        if (hasReturn) {
+            out << "do_return: {\n"
+                << "    Value result = stack[--sp];\n"
+                << "    while (sp > base) v_drop(stack[--sp]);\n"
+                << "    stack[sp++] = result;\n"
+                << "    fp--;\n"
+                << "    base = frames[fp].base;\n"
+                << "    switch (frames[fp].site) {\n";
+            for (size_t site = 0; site < returnSites.size(); site++) {
+                out << "        case " << site << ": goto L" << returnSites[site] << ";\n";
+            }
+            out << "        default: abort();\n    }\n}\n";
+        }
+        out << "done:\n    fflush(stdout);\n    return 0;\n}\n";
+    }
+
+private:
+    const BytecodeProgram& program;
+    std::ostream& out;
+    StackBounds bounds;
+    std::map<std::string, size_t> strings;  // Literal text -> index in strings[]
+    std::vector<size_t> returnSites;        // Call site -> pc to continue at
+
+    void collectStrings() {
+        for (const auto& instr : program.instructions) {
+            if (instr.op == OpCode::PUSH && std::holds_alternative<StringRef>(instr.operand)) {
+                strings.emplace(std::get<StringRef>(instr.operand).str(), strings.size());
+            }
+        }
+    }
+
+    std::string valueExpr(const Value& value) {
+        if (auto* i = std::get_if<int64_t>(&value)) return "v_int(" + intLiteral(*i) + ")";
+        if (auto* d = std::get_if<double>(&value)) return "v_double(" + doubleLiteral(*d) + ")";
+        if (auto* b = std::get_if<bool>(&value)) return *b ? "v_bool(1)" : "v_bool(0)";
+        return "v_str(strings[" + std::to_string(strings.at(std::get<StringRef>(value).str())) + "])";
+    }
+
+    static std::string slotExpr(bool local, size_t index) {
+        return local ? "stack[base + " + std::to_string(index) + "]" : "globals[" + std::to_string(index) + "]";
+    }
+
+    // Variables a parallel loop body writes, other than its induction
+    // variable and reductions. Iterations see private copies of them in the
+    // VM, so the sequential loop restores them afterwards.
+    std::vector<std::pair<bool, size_t>> privateSlots(const ParallelLoopInfo& loop) {
+        std::vector<std::pair<bool, size_t>> slots;
+        auto shared = [&](bool local, size_t index) {
+            if (loop.inductionLocal == local && static_cast<size_t>(loop.inductionSlot) == index) return true;
+            for (const auto& reduction : loop.reductions) {
+                if (reduction.local == local && static_cast<size_t>(reduction.slot) == index) return true;
+            }
+            return false;
+        };
+        for (size_t pc = loop.bodyStart; pc < loop.bodyEnd; pc++) {
+            const Instruction& instr = program.instructions[pc];
+            std::pair<bool, size_t> slot;
+            if (instr.op == OpCode::STORE || instr.op == OpCode::STORE_LOCAL) {
+                slot = {instr.op == OpCode::STORE_LOCAL, indexOperand(instr)};
+            } else if (instr.op == OpCode::LOOP_INC_JMP) {
+                const CountedLoopInfo& counted = program.countedLoops[indexOperand(instr)];
+                slot = {counted.counterLocal, counted.counterSlot};
+            } else {
+                continue;
+            }
+            if (!shared(slot.first, slot.second) &&
+                std::find(slots.begin(), slots.end(), slot) == slots.end()) {
+                slots.push_back(slot);
+            }
+        }
+        return slots;
+    }
+
+    void emitInstruction(size_t pc, const Instruction& instr) {
+        std::string at = std::to_string(pc);
+        switch (instr.op) {
+            case OpCode::PUSH:
+                out << "stack[sp++] = " << valueExpr(instr.operand) << ";\n";
+                break;
+            case OpCode::POP:
+                out << "v_drop(stack[--sp]);\n";
+                break;
+            case OpCode::LOAD:
+            case OpCode::LOAD_LOCAL:
+                out << "stack[sp] = v_copy(" << slotExpr(instr.op == OpCode::LOAD_LOCAL, indexOperand(instr))
+                    << "); sp++;\n";
+                break;
+            case OpCode::STORE:
+            case OpCode::STORE_LOCAL: {
+                std::string slot = slotExpr(instr.op == OpCode::STORE_LOCAL, indexOperand(instr));
+                out << "sp--; v_drop(" << slot << "); " << slot << " = stack[sp];\n";
+                break;
+            }
+            case OpCode::ADD:
+                out << "sp--; stack[sp - 1] = v_add(stack[sp - 1], stack[sp], " << at << ");\n";
+                break;
+            case OpCode::SUB:
+            case OpCode::MUL:
+            case OpCode::DIV: {
+                char op = instr.op == OpCode::SUB ? '-' : instr.op == OpCode::MUL ? '*' : '/';
+                out << "sp--; stack[sp - 1] = v_arith('" << op << "', stack[sp - 1], stack[sp], " << at << ");\n";
+                break;
+            }
+            case OpCode::ADD_INT:
+            case OpCode::SUB_INT:
+            case OpCode::MUL_INT: {
+                int index = static_cast<int>(instr.op) - static_cast<int>(OpCode::ADD_INT);
+                const char op = "+-*"[index];
+                out << "sp--; if (stack[sp - 1].tag == T_INT && stack[sp].tag == T_INT) stack[sp - 1].as.i = "
+                    << "i_arith('" << op << "', stack[sp - 1].as.i, stack[sp].as.i, " << at << "); else stack[sp - 1] = ";
+                if (instr.op == OpCode::ADD_INT) {
+                    out << "v_add(stack[sp - 1], stack[sp], " << at << ");\n";
+                } else {
+                    out << "v_arith('" << op << "', stack[sp - 1], stack[sp], " << at << ");\n";
+                }
+                break;
+            }
+            case OpCode::CMP_EQ:
+            case OpCode::CMP_NE:
+            case OpCode::CMP_LT:
+            case OpCode::CMP_LE:
+            case OpCode::CMP_GT:
+            case OpCode::CMP_GE: {
+                static const std::map<OpCode, const char*> names = {
+                    {OpCode::CMP_EQ, "CMP_EQ"}, {OpCode::CMP_NE, "CMP_NE"}, {OpCode::CMP_LT, "CMP_LT"},
+                    {OpCode::CMP_LE, "CMP_LE"}, {OpCode::CMP_GT, "CMP_GT"}, {OpCode::CMP_GE, "CMP_GE"}};
+                out << "sp--; stack[sp - 1] = v_cmp(" << names.at(instr.op) << ", stack[sp - 1], stack[sp], "
+                    << at << ");\n";
+                break;
+            }
+            case OpCode::JMP:
+                out << "goto L" << indexOperand(instr) << ";\n";
+                break;
+            case OpCode::JMP_IF_FALSE:
+                out << "if (!v_truthy(stack[--sp])) goto L" << indexOperand(instr) << ";\n";
+                break;
+            case OpCode::JMP_IF_TRUE:
+                out << "if (v_truthy(stack[--sp])) goto L" << indexOperand(instr) << ";\n";
+                break;
+            case OpCode::JEQ:
+            case OpCode::JNE:
+            case OpCode::JLT:
+            case OpCode::JLE:
+            case OpCode::JGT:
+            case OpCode::JGE: {
+                static const char* const names[] = {"CMP_EQ", "CMP_NE", "CMP_LT", "CMP_LE", "CMP_GT", "CMP_GE"};
+                const char* name = names[static_cast<int>(instr.op) - static_cast<int>(OpCode::JEQ)];
+                out << "sp -= 2; if (!v_cmp(" << name << ", stack[sp], stack[sp + 1], " << at
+                    << ").as.b) goto L" << indexOperand(instr) << ";\n";
+                break;
+            }
+            case OpCode::JEQ_INT:
+            case OpCode::JNE_INT:
+            case OpCode::JLT_INT:
+            case OpCode::JLE_INT:
+            case OpCode::JGT_INT:
+            case OpCode::JGE_INT: {
+                static const char* const names[] = {"CMP_EQ", "CMP_NE", "CMP_LT", "CMP_LE", "CMP_GT", "CMP_GE"};
+                static const char* const operators[] = {"==", "!=", "<", "<=", ">", ">="};
+                int compare = static_cast<int>(instr.op) - static_cast<int>(OpCode::JEQ_INT);
+                out << "sp -= 2; if (stack[sp].tag == T_INT && stack[sp + 1].tag == T_INT ? !(stack[sp].as.i "
+                    << operators[compare] << " stack[sp + 1].as.i) : !v_cmp(" << names[compare]
+                    << ", stack[sp], stack[sp + 1], " << at << ").as.b) goto L" << indexOperand(instr) << ";\n";
+                break;
+            }
+            case OpCode::LOOP_INC_JMP:
+                emitLoopIncJmp(pc, program.countedLoops[indexOperand(instr)]);
+                break;
+            case OpCode::CALL:
+                emitCall(pc, instr);
+                break;
+            case OpCode::TAIL_CALL:
+                emitTailCall(pc, instr);
+                break;
+            case OpCode::RET:
+                out << "goto do_return;\n";
+                break;
+            case OpCode::PRINT:
+                out << "v_print(stack[--sp]);\n";
+                break;
+            case OpCode::PAR_FOR:
+                emitParallelFor(pc, indexOperand(instr));
+                break;
+            case OpCode::PAR_END:
+                emitParallelEnd(pc);
+                break;
+            case OpCode::SNAPSHOT:
+                out << ";  /* checkpoint: snapshots are a VM feature */\n";
+                break;
+            case OpCode::SPAWN:
+            case OpCode::TASK_END:
+            case OpCode::CHAN_NEW:
+            case OpCode::SEND:
+            case OpCode::RECV:
+            case OpCode::MAP_NEW:
+            case OpCode::MAP_INSERT:
+            case OpCode::INDEX:
+            case OpCode::INDEX_SET:
+            case OpCode::MAP_HAS:
+            case OpCode::MAP_DELETE:
+            case OpCode::MAP_SIZE:
+            case OpCode::ITER:
+            case OpCode::ITER_NEXT:
+            case OpCode::READ_LINE:
+            case OpCode::READ_ALL:
+            case OpCode::LINES:
+                break;  // Rejected by emit()
+            case OpCode::HALT:
+                out << "goto done;\n";
+                break;
+        }
+    }
+
+    // Integer counter and limit are stepped and compared in place, anything
+    // else goes through the generic helpers like separate instructions would
+    void emitLoopIncJmp(size_t pc, const CountedLoopInfo& loop) {
+        static const char* const names[] = {"CMP_EQ", "CMP_NE", "CMP_LT", "CMP_LE", "CMP_GT", "CMP_GE"};
+        static const char* const operators[] = {"==", "!=", "<", "<=", ">", ">="};
+        int compare = static_cast<int>(loop.compare) - static_cast<int>(OpCode::CMP_EQ);
+        std::string counter = slotExpr(loop.counterLocal, loop.counterSlot);
+        std::string limit = loop.limitIsSlot ? slotExpr(loop.limitLocal, loop.limitSlot) : valueExpr(loop.limit);
+        bool add = loop.stepOp == OpCode::ADD;
+        out << "{\n"
+            << "    Value limit = " << limit << ";\n"
+            << "    if (" << counter << ".tag == T_INT && limit.tag == T_INT) {\n"
+            << "        " << counter << ".as.i = i_arith('" << (add ? "+" : "-") << "', " << counter << ".as.i, "
+            << intLiteral(loop.step) << ", " << pc << ");\n"
+            << "        if (" << counter << ".as.i " << operators[compare]
+            << " limit.as.i) goto L" << loop.bodyStart << ";\n"
+            << "    } else {\n"
+            << "        " << counter << " = " << (add ? "v_add(" : "v_arith('-', ") << counter << ", v_int("
+            << intLiteral(loop.step) << "), " << pc << ");\n"
+            << "        if (v_cmp(" << names[compare] << ", v_copy(" << counter << "), v_copy(limit), " << pc
+            << ").as.b) goto L" << loop.bodyStart << ";\n"
+            << "    }\n"
+            << "}\n";
+    }
+
+    std::string overflowMessage(const FunctionInfo& fn) {
+        return quote("Stack overflow in call to '" + fn.name + "'");
+    }
+
+    void emitCall(size_t pc, const Instruction& instr) {
+        size_t index = indexOperand(instr);
+        const FunctionInfo& fn = program.functions[index];
+        size_t site = returnSites.size();
+        returnSites.push_back(pc + 1);
+        out << "{\n"
+            << "    size_t callee = sp - " << fn.arity << ";\n"
+            << "    if (fp >= MAX_CALL_DEPTH || callee + " << fn.localCount + bounds.functionDepth[index]
+            << " > STACK_SLOTS) rt_error(" << pc << ", " << overflowMessage(fn) << ");\n"
+            << "    frames[fp].site = " << site << ";\n"
+            << "    frames[fp].base = base;\n"
+            << "    fp++;\n"
+            << "    base = callee;\n"
+            << "    while (sp < base + " << fn.localCount << ") stack[sp++] = v_int(0);\n"
+            << "    goto L" << fn.entry << ";\n"
+            << "}\n";
+    }
+
+    void emitTailCall(size_t pc, const Instruction& instr) {
+        size_t index = indexOperand(instr);
+        const FunctionInfo& fn = program.functions[index];
+        out << "{\n"
+            << "    size_t args = sp - " << fn.arity << ";\n"
+            << "    if (base + " << fn.localCount + bounds.functionDepth[index]
+            << " > STACK_SLOTS) rt_error(" << pc << ", " << overflowMessage(fn) << ");\n"
+            << "    for (i = base; i < args; i++) v_drop(stack[i]);\n"
+            << "    for (i = 0; i < " << fn.arity << "; i++) stack[base + i] = stack[args + i];\n"
+            << "    for (sp = base + " << fn.arity << "; sp < base + " << fn.localCount
+            << "; sp++) stack[sp] = v_int(0);\n"
+            << "    goto L" << fn.entry << ";\n"
+            << "}\n";
+    }
+
+    // The loop keeps its state on the value stack below the body's values:
+    // the saved private variables, then start, iteration count and the
+    // current iteration.
+    void emitParallelFor(size_t pc, size_t loopIndex) {
+        const ParallelLoopInfo& loop = program.parallelLoops[loopIndex];
+        std::string induction = slotExpr(loop.inductionLocal, loop.inductionSlot);
+        out << "{\n"
+            << "    Value last = stack[--sp], first = stack[--sp];\n"
+            << "    int64_t start, n;\n"
+            << "    if (first.tag != T_INT || last.tag != T_INT) rt_error(" << pc
+            << ", \"parallel for bounds must be integers\");\n"
+            << "    start = first.as.i;\n"
+            << "    n = last.as.i + " << (loop.inclusive ? 1 : 0) << ";\n"
+            << "    n = start < n ? (n - start + " << loop.step - 1 << ") / " << loop.step << " : 0;\n";
+        for (const auto& [local, index] : privateSlots(loop)) {
+            out << "    stack[sp++] = v_copy(" << slotExpr(local, index) << ");\n";
+        }
+        out << "    stack[sp++] = v_int(start);\n"
+            << "    stack[sp++] = v_int(n);\n"
+            << "    stack[sp++] = v_int(0);\n"
+            << "    if (rt_par_depth++ == 0) rt_par_pc = " << pc << ";\n"
+            << "    if (n == 0) goto P" << loopIndex << ";\n"
+            << "    v_drop(" << induction << ");\n"
+            << "    " << induction << " = v_int(start);\n"
+            << "}\n";
+    }
+
+    void emitParallelEnd(size_t pc) {
+        size_t loopIndex = 0;
+        while (program.parallelLoops[loopIndex].bodyEnd != pc) loopIndex++;
+        const ParallelLoopInfo& loop = program.parallelLoops[loopIndex];
+        std::string induction = slotExpr(loop.inductionLocal, loop.inductionSlot);
+        auto slots = privateSlots(loop);
+        out << "{\n"
+            << "    int64_t k = ++stack[sp - 1].as.i;\n"
+            << "    if (k < stack[sp - 2].as.i) {\n"
+            << "        v_drop(" << induction << ");\n"
+            << "        " << induction << " = v_int(stack[sp - 3].as.i + k * " << loop.step << ");\n"
+            << "        goto L" << loop.bodyStart << ";\n"
+            << "    }\n"
+            << "}\n"
+            << "P" << loopIndex << ": {\n"
+            << "    int64_t n = stack[sp - 2].as.i, start = stack[sp - 3].as.i;\n"
+            << "    sp -= 3;\n";
+        for (auto it = slots.rbegin(); it != slots.rend(); ++it) {
+            std::string slot = slotExpr(it->first, it->second);
+            out << "    v_drop(" << slot << ");\n"
+                << "    " << slot << " = stack[--sp];\n";
+        }
+        out << "    v_drop(" << induction << ");\n"
+            << "    " << induction << " = v_int(start + n * " << loop.step << ");\n"
+            << "    rt_par_depth--;\n"
+            << "    goto L" << loop.bodyEnd + 1 << ";\n"
+            << "}\n";
+    }
+};
+
+} // namespace
+
+void emitC(const BytecodeProgram& program, std::ostream& out) {
+    CEmitter(program, out).emit();
+}
@@ -0,0 +1,15 @@
+#ifndef C_EMITTER_H
+#define C_EMITTER_H
+
+#include "bytecode.h"
+#include <ostream>
+
+// Translates a program into a standalone C file that behaves like running it
+// in the VM: one label per instruction, the value stack, frames and globals
+// in arrays local to main(), and a small runtime implementing the Value
+// semantics of vm.cpp. Parallel loops run their iterations sequentially;
+// tasks, channels, input and for-in loops are not supported. The program is
+// verified first; throws std::runtime_error if it is invalid or uses them.
+void emitC(const BytecodeProgram& program, std::ostream& out);
+
+#endif
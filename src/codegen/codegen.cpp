@@ -1,21 +1,127 @@
 #include "codegen.h"
+#include "../parser/parser.h"
+#include <algorithm>
 #include <stdexcept>
 
-CodeGenerator::CodeGenerator() {
+BytecodeProgram compileSource(const std::string& source) {
+    SymbolTable symbols;
+    Lexer lexer(source, symbols);
+    Parser parser(lexer.tokenize());
+    auto block = std::make_unique<BlockStmt>(parser.parse());
+    CodeGenerator generator(symbols);
+    return generator.generate(block.get());
+}
+
+static void walkAST(ASTNode* node, const std::function<void(ASTNode*)>& visit);
+
+CodeGenerator::CodeGenerator(SymbolTable& symbols) : symbols(symbols) {
     enterScope(); // Start with global scope
 }
 
+void CodeGenerator::bind(std::vector<size_t>& bySymbol, Symbol symbol, size_t value) {
+    if (symbol >= bySymbol.size()) {
+        bySymbol.resize(std::max<size_t>(symbols.size(), symbol + 1));
+    }
+    bySymbol[symbol] = value;
+}
+
+void CodeGenerator::clearFunctions() {
+    for (FunctionStmt* fn : functionDecls) {
+        bind(functionIndices, fn->name.symbol, 0);
+    }
+    functionDecls.clear();
+    definedFunctions = 0;
+}
+
 BytecodeProgram CodeGenerator::generate(ASTNode* ast) {
     program = BytecodeProgram(); // Reset program
+    clearFunctions();
+    resolver = nullptr;
+    sites.clear();
+    uint32_t nodeCount = 0;
+    walkAST(ast, [&](ASTNode* node) { node->nodeId = nodeCount++; });
     
     // Handle multiple statements
     if (auto* block = dynamic_cast<BlockStmt*>(ast)) {
+        declareFunctions(block);
         generateBlock(block);
     } else {
         generateStmt(static_cast<Statement*>(ast));
     }
     
     emit(OpCode::HALT); // End program
+    generateColdBlocks();
+    
+    // Function bodies live after the top-level code
+    for (size_t i = 0; i < definedFunctions; i++) {
+        generateFunction(i);
+    }
+    
+    program.globalCount = globals.size();
+    return program;
+}
+
+BytecodeUnit CodeGenerator::generateUnit(BlockStmt* block, const FunctionResolver& functionResolver) {
+    program = BytecodeProgram();
+    clearFunctions();
+    // Global slots are numbered per unit
+    for (Symbol global : globals) {
+        bind(globalSlots, global, 0);
+    }
+    globals.clear();
+    resolver = functionResolver;
+    
+    declareFunctions(block);
+    generateBlock(block);
+    
+    BytecodeUnit unit;
+    unit.mainLength = program.instructions.size();
+    for (size_t i = 0; i < definedFunctions; i++) {
+        generateFunction(i);
+    }
+    
+    unit.instructions = std::move(program.instructions);
+    for (Symbol global : globals) {
+        unit.globals.push_back(symbols.name(global));
+    }
+    unit.functions = std::move(program.functions);
+    unit.definedFunctions = definedFunctions;
+    unit.parallelLoops = std::move(program.parallelLoops);
+    unit.countedLoops = std::move(program.countedLoops);
+    for (size_t i = definedFunctions; i < unit.functions.size(); i++) {
+        unit.dependencies.emplace_back(unit.functions[i].name, 0);
+    }
+    resolver = nullptr;
+    return unit;
+}
+
+const BytecodeProgram& CodeGenerator::generateNext(Statement* stmt) {
+    program.instructions.erase(program.instructions.begin() + functionCodeEnd, program.instructions.end());
+    program.parallelLoops.erase(program.parallelLoops.begin() + functionLoopCount, program.parallelLoops.end());
+    program.countedLoops.erase(program.countedLoops.begin() + functionCountedLoopCount, program.countedLoops.end());
+    
+    if (auto* fn = dynamic_cast<FunctionStmt*>(stmt)) {
+        if (lookup(functionIndices, fn->name.symbol)) {
+            throw std::runtime_error("Function '" + fn->name.value + "' is already defined");
+        }
+        FunctionInfo info;
+        info.name = fn->name.value;
+        info.arity = static_cast<int>(fn->params.size());
+        functionDecls.push_back(fn);
+        bind(functionIndices, fn->name.symbol, functionDecls.size());
+        program.functions.push_back(info);
+        definedFunctions = functionDecls.size();
+        generateFunction(definedFunctions - 1);
+        functionCodeEnd = program.instructions.size();
+        functionLoopCount = program.parallelLoops.size();
+        functionCountedLoopCount = program.countedLoops.size();
+    } else {
+        generateStmt(stmt);
+    }
+    
+    program.mainEntry = functionCodeEnd;
+    emit(OpCode::HALT);
+    program.globalCount = globals.size();
     return program;
 }
 
@@ -24,45 +130,91 @@ void CodeGenerator::generateExpr(ASTNode* expr) {
         generateLiteral(literal);
     } else if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
         generateBinary(binary);
+    } else if (auto* logical = dynamic_cast<LogicalExpr*>(expr)) {
+        generateLogical(logical);
     } else if (auto* variable = dynamic_cast<VariableExpr*>(expr)) {
         generateVariable(variable);
     } else if (auto* assignment = dynamic_cast<AssignmentExpr*>(expr)) {
         generateAssignment(assignment);
+    } else if (auto* call = dynamic_cast<CallExpr*>(expr)) {
+        generateCall(call);
+    } else if (auto* map = dynamic_cast<MapExpr*>(expr)) {
+        generateMap(map);
+    } else if (auto* index = dynamic_cast<IndexExpr*>(expr)) {
+        generateExpr(index->object.get());
+        generateExpr(index->key.get());
+        emit(OpCode::INDEX);
+    } else if (auto* indexAssign = dynamic_cast<IndexAssignExpr*>(expr)) {
+        generateExpr(indexAssign->object.get());
+        generateExpr(indexAssign->key.get());
+        generateExpr(indexAssign->value.get());
+        emit(OpCode::INDEX_SET);
     }
 }
 
 void CodeGenerator::generateStmt(Statement* stmt) {
     if (auto* exprStmt = dynamic_cast<ExpressionStmt*>(stmt)) {
-        generateExpr(exprStmt->expression.get());
-        emit(OpCode::POP); // Discard result
+        auto* call = dynamic_cast<CallExpr*>(exprStmt->expression.get());
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(exprStmt->expression.get())) {
+            // STORE already consumes the value, nothing left to discard
+            generateExpr(assignment->value.get());
+            emitStore(resolveVariable(assignment->name.symbol));
+        } else if (call && isBuiltinCall(call)) {
+            generateBuiltin(call, true);
+        } else {
+            generateExpr(exprStmt->expression.get());
+            emit(OpCode::POP); // Discard result
+        }
     } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
         generateVarDecl(varDecl);
     } else if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt)) {
         generateIf(ifStmt);
     } else if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt)) {
         generateWhile(whileStmt);
+    } else if (auto* forIn = dynamic_cast<ForInStmt*>(stmt)) {
+        generateForIn(forIn);
     } else if (auto* block = dynamic_cast<BlockStmt*>(stmt)) {
         generateBlock(block);
     } else if (auto* print = dynamic_cast<PrintStmt*>(stmt)) {
-        generatePrint(print);
-        emit(OpCode::POP); // Pop after print statement
+        generatePrint(print); // PRINT consumes its operand
+    } else if (auto* ret = dynamic_cast<ReturnStmt*>(stmt)) {
+        generateReturn(ret);
+    } else if (auto* parallel = dynamic_cast<ParallelForStmt*>(stmt)) {
+        generateParallelFor(parallel);
+    } else if (auto* spawn = dynamic_cast<SpawnStmt*>(stmt)) {
+        generateSpawn(spawn);
+    } else if (dynamic_cast<CheckpointStmt*>(stmt)) {
+        if (currentFunction || inParallelBody || inTaskBody) {
+            throw std::runtime_error("checkpoint is only allowed in top-level code");
+        }
+        emit(OpCode::SNAPSHOT);
+    } else if (auto* import = dynamic_cast<ImportStmt*>(stmt)) {
+        // Top-level imports never get here when compiling modules
+        throw std::runtime_error("import \"" + import->path.value + "\" must be at the top level of a file, "
+                                 "and is not supported with --incremental, --stream or --batch");
+    } else if (auto* fn = dynamic_cast<FunctionStmt*>(stmt)) {
+        // Top-level functions are hoisted by declareFunctions()
+        size_t index = lookup(functionIndices, fn->name.symbol);
+        if (currentFunction || !index || functionDecls[index - 1] != fn) {
+            throw std::runtime_error("Functions must be declared at top level");
+        }
     }
 }
 
 void CodeGenerator::generateLiteral(LiteralExpr* expr) {
+    const Literal& literal = expr->token.literal;
     if (expr->token.type == TokenType::NUMBER) {
-        // Convert string to number
-        try {
-            if (expr->token.value.find('.') != std::string::npos) {
-                emit(OpCode::PUSH, std::stod(expr->token.value));
-            } else {
-                emit(OpCode::PUSH, std::stoi(expr->token.value));
-            }
-        } catch (...) {
+        if (auto* i = std::get_if<int64_t>(&literal)) {
+            emit(OpCode::PUSH, *i);
+        } else if (auto* d = std::get_if<double>(&literal)) {
+            emit(OpCode::PUSH, *d);
+        } else {
             throw std::runtime_error("Invalid number literal: " + expr->token.value);
         }
+    } else if (expr->token.type == TokenType::BOOLEAN) {
+        emit(OpCode::PUSH, std::get<bool>(literal));
     } else {
-        emit(OpCode::PUSH, expr->token.value);
+        emit(OpCode::PUSH, StringRef::intern(expr->token.value));
     }
 }
 
@@ -70,15 +222,17 @@ void CodeGenerator::generateBinary(BinaryExpr* expr) {
     generateExpr(expr->left.get());
     generateExpr(expr->right.get());
     
+    addSite(expr, SiteKind::OPERANDS, program.instructions.size());
+    bool integers = integerSite(expr);
     switch (expr->op.type) {
         case TokenType::PLUS:
-            emit(OpCode::ADD);
+            emit(integers ? OpCode::ADD_INT : OpCode::ADD);
             break;
         case TokenType::MINUS:
-            emit(OpCode::SUB);
+            emit(integers ? OpCode::SUB_INT : OpCode::SUB);
             break;
         case TokenType::STAR:
-            emit(OpCode::MUL);
+            emit(integers ? OpCode::MUL_INT : OpCode::MUL);
             break;
         case TokenType::SLASH:
             emit(OpCode::DIV);
@@ -106,15 +260,81 @@ void CodeGenerator::generateBinary(BinaryExpr* expr) {
     }
 }
 
+void CodeGenerator::generateLogical(LogicalExpr* expr) {
+    std::vector<size_t> falseJumps;
+    generateBranch(expr, false, falseJumps);
+    emit(OpCode::PUSH, true);
+    size_t endJump = program.instructions.size();
+    emit(OpCode::JMP, 0);
+    patchJumps(falseJumps, program.instructions.size());
+    emit(OpCode::PUSH, false);
+    program.instructions[endJump].operand = static_cast<int64_t>(program.instructions.size());
+}
+
+// Compare-and-branch opcode for a comparison operator; the opcode jumps when
+// the comparison is false
+static bool fusedJump(TokenType type, OpCode& op) {
+    switch (type) {
+        case TokenType::EQUAL_EQUAL: op = OpCode::JEQ; return true;
+        case TokenType::BANG_EQUAL: op = OpCode::JNE; return true;
+        case TokenType::LESS: op = OpCode::JLT; return true;
+        case TokenType::LESS_EQUAL: op = OpCode::JLE; return true;
+        case TokenType::GREATER: op = OpCode::JGT; return true;
+        case TokenType::GREATER_EQUAL: op = OpCode::JGE; return true;
+        default: return false;
+    }
+}
+
+void CodeGenerator::generateBranch(ASTNode* condition, bool jumpIf, std::vector<size_t>& jumps) {
+    if (auto* logical = dynamic_cast<LogicalExpr*>(condition)) {
+        bool isAnd = logical->op.type == TokenType::AND;
+        if (isAnd != jumpIf) {
+            // `a && b` is false, and `a || b` true, as soon as either side is
+            generateBranch(logical->left.get(), jumpIf, jumps);
+            generateBranch(logical->right.get(), jumpIf, jumps);
+        } else {
+            // The left side can only decide the other outcome: skip the right
+            // side then, otherwise the right side decides
+            std::vector<size_t> skip;
+            generateBranch(logical->left.get(), !jumpIf, skip);
+            generateBranch(logical->right.get(), jumpIf, jumps);
+            patchJumps(skip, program.instructions.size());
+        }
+        return;
+    }
+    
+    OpCode fused;
+    auto* binary = dynamic_cast<BinaryExpr*>(condition);
+    if (!jumpIf && binary && fusedJump(binary->op.type, fused)) {
+        generateExpr(binary->left.get());
+        generateExpr(binary->right.get());
+        jumps.push_back(program.instructions.size());
+        addSite(binary, SiteKind::OPERANDS, program.instructions.size());
+        emit(integerSite(binary) ? integerOp(fused) : fused, 0);
+        return;
+    }
+    
+    generateExpr(condition);
+    jumps.push_back(program.instructions.size());
+    emit(jumpIf ? OpCode::JMP_IF_TRUE : OpCode::JMP_IF_FALSE, 0);  // Pops the condition
+}
+
+void CodeGenerator::patchJumps(const std::vector<size_t>& jumps, size_t target) {
+    for (size_t jump : jumps) {
+        program.instructions[jump].operand = static_cast<int64_t>(target);
+    }
+}
+
 void CodeGenerator::generateVariable(VariableExpr* expr) {
-    size_t index = getVariableIndex(expr->name.value);
-    emit(OpCode::LOAD, static_cast<int>(index));
+    emitLoad(resolveVariable(expr->name.symbol));
 }
 
 void CodeGenerator::generateAssignment(AssignmentExpr* expr) {
+    // Used as an expression: store, then leave the value on the stack
     generateExpr(expr->value.get());
-    size_t index = getVariableIndex(expr->name.value);
-    emit(OpCode::STORE, static_cast<int>(index));
+    Slot slot = resolveVariable(expr->name.symbol);
+    emitStore(slot);
+    emitLoad(slot);
 }
 
 void CodeGenerator::generateVarDecl(VarDeclStmt* stmt) {
@@ -123,28 +343,32 @@ void CodeGenerator::generateVarDecl(VarDeclStmt* stmt) {
     } else {
         emit(OpCode::PUSH, 0); // Default value
     }
-    size_t index = getVariableIndex(stmt->name.value);
-    emit(OpCode::STORE, static_cast<int>(index));
+    emitStore(declareVariable(stmt->name.symbol));
 }
 
 void CodeGenerator::generateIf(IfStmt* stmt) {
-    generateExpr(stmt->condition.get());
-    
-    // Jump if false
-    size_t elseJump = program.instructions.size();
-    emit(OpCode::JMP_IF_FALSE, 0); // Placeholder for jump target
-    emit(OpCode::POP);  // Pop condition after test
+    // Jumps to the else branch, patched below
+    std::vector<size_t> elseJumps;
+    addSite(stmt, SiteKind::IF_ENTRY, program.instructions.size());
+    generateBranch(stmt->condition.get(), false, elseJumps);
+    for (size_t jump : elseJumps) {
+        addSite(stmt, SiteKind::TO_ELSE, jump);
+    }
     
     // Then branch
     generateStmt(stmt->thenBranch.get());
     
-    if (stmt->elseBranch) {
+    if (stmt->elseBranch && isColdElse(stmt)) {
+        // The then branch falls through to the code after the if, without
+        // the jump over the else branch
+        coldBlocks.push_back({stmt->elseBranch.get(), elseJumps, program.instructions.size()});
+    } else if (stmt->elseBranch) {
         // Jump over else branch
         size_t endJump = program.instructions.size();
         emit(OpCode::JMP, 0); // Placeholder for jump target
         
-        // Update if-false jump
-        program.instructions[elseJump].operand = static_cast<int>(program.instructions.size());
+        // Update if-false jumps
+        patchJumps(elseJumps, program.instructions.size());
         
         // Else branch
         generateStmt(stmt->elseBranch.get());
@@ -152,21 +376,25 @@ void CodeGenerator::generateIf(IfStmt* stmt) {
         // Update end jump
         program.instructions[endJump].operand = static_cast<int>(program.instructions.size());
     } else {
-        // Update if-false jump
-        program.instructions[elseJump].operand = static_cast<int>(program.instructions.size());
+        // Update if-false jumps
+        patchJumps(elseJumps, program.instructions.size());
     }
 }
 
-void CodeGenerator::generateWhile(WhileStmt* stmt) {
-    size_t loopStart = program.instructions.size();
+void CodeGenerator::generateWhile(WhileStmt* stmt, Symbol initName, int64_t initValue) {
+    CountedLoop counted;
+    if (matchCountedLoop(stmt, counted)) {
+        if (counted.counter != initName || !generateUnrolled(stmt, counted, initValue)) {
+            generateCountedLoop(stmt, counted);
+        }
+        return;
+    }
     
-    // Condition
-    generateExpr(stmt->condition.get());
+    size_t loopStart = program.instructions.size();
     
-    // Jump if false
-    size_t exitJump = program.instructions.size();
-    emit(OpCode::JMP_IF_FALSE, 0); // Placeholder for jump target
-    emit(OpCode::POP);  // Pop condition after test
+    // Condition, jumping out when false
+    std::vector<size_t> exitJumps;
+    generateBranch(stmt->condition.get(), false, exitJumps);
     
     // Body
     if (auto* block = dynamic_cast<BlockStmt*>(stmt->body.get())) {
@@ -178,14 +406,221 @@ void CodeGenerator::generateWhile(WhileStmt* stmt) {
     // Jump back to condition
     emit(OpCode::JMP, static_cast<int>(loopStart));
     
-    // Update exit jump
-    program.instructions[exitJump].operand = static_cast<int>(program.instructions.size());
+    // Update exit jumps
+    patchJumps(exitJumps, program.instructions.size());
+}
+
+// The iterator stays in a hidden variable rather than on the stack, so the
+// body runs on an empty stack like any other loop body. ITER_NEXT leaves
+// false in place of an exhausted iterator, and storing it lets go of the
+// iterator.
+void CodeGenerator::generateForIn(ForInStmt* stmt) {
+    generateExpr(stmt->iterable.get());
+    emit(OpCode::ITER);
+    Slot iterator = declareVariable(hiddenSymbol(iteratorSymbols, "$iter", forInDepth));
+    emitStore(iterator);
+    
+    size_t loopStart = program.instructions.size();
+    emitLoad(iterator);
+    size_t next = program.instructions.size();
+    emit(OpCode::ITER_NEXT, static_cast<int64_t>(0));
+    enterScope();
+    emitStore(declareVariable(stmt->variable.symbol));
+    forInDepth++;
+    generateStmt(stmt->body.get());
+    forInDepth--;
+    exitScope();
+    emit(OpCode::JMP, static_cast<int64_t>(loopStart));
+    
+    program.instructions[next].operand = static_cast<int64_t>(program.instructions.size());
+    emitStore(iterator);
+}
+
+bool CodeGenerator::matchCountedLoop(WhileStmt* stmt, CountedLoop& loop) {
+    auto* condition = dynamic_cast<BinaryExpr*>(stmt->condition.get());
+    auto* body = dynamic_cast<BlockStmt*>(stmt->body.get());
+    OpCode fused;
+    if (!condition || !body || body->statements.empty() || !fusedJump(condition->op.type, fused)) {
+        return false;
+    }
+    auto* counter = dynamic_cast<VariableExpr*>(condition->left.get());
+    auto* limit = dynamic_cast<LiteralExpr*>(condition->right.get());
+    if (!counter || !(dynamic_cast<VariableExpr*>(condition->right.get()) ||
+                      (limit && limit->token.type == TokenType::NUMBER))) {
+        return false;
+    }
+    
+    auto* increment = dynamic_cast<ExpressionStmt*>(body->statements.back().get());
+    auto* assignment = increment ? dynamic_cast<AssignmentExpr*>(increment->expression.get()) : nullptr;
+    auto* value = assignment ? dynamic_cast<BinaryExpr*>(assignment->value.get()) : nullptr;
+    if (!value || assignment->name.symbol != counter->name.symbol ||
+        (value->op.type != TokenType::PLUS && value->op.type != TokenType::MINUS)) {
+        return false;
+    }
+    auto* base = dynamic_cast<VariableExpr*>(value->left.get());
+    auto* step = dynamic_cast<LiteralExpr*>(value->right.get());
+    const int64_t* constant = step ? std::get_if<int64_t>(&step->token.literal) : nullptr;
+    if (!base || base->name.symbol != counter->name.symbol || !constant || step->token.type != TokenType::NUMBER) {
+        return false;
+    }
+    
+    loop.counter = counter->name.symbol;
+    loop.compare = fusedComparison(fused);
+    loop.stepOp = value->op.type == TokenType::PLUS ? OpCode::ADD : OpCode::SUB;
+    loop.step = *constant;
+    return true;
+}
+
+// The condition is compiled once, as the test before the first iteration;
+// LOOP_INC_JMP takes the place of the increment and the jump back to it
+void CodeGenerator::generateCountedLoop(WhileStmt* stmt, const CountedLoop& loop) {
+    std::vector<size_t> exitJumps;
+    generateBranch(stmt->condition.get(), false, exitJumps);
+    
+    CountedLoopInfo info;
+    Slot counter = resolveVariable(loop.counter);
+    info.counterLocal = counter.local;
+    info.counterSlot = static_cast<int>(counter.index);
+    info.stepOp = loop.stepOp;
+    info.step = loop.step;
+    info.compare = loop.compare;
+    ASTNode* limit = static_cast<BinaryExpr*>(stmt->condition.get())->right.get();
+    if (auto* variable = dynamic_cast<VariableExpr*>(limit)) {
+        Slot slot = resolveVariable(variable->name.symbol);
+        info.limitIsSlot = true;
+        info.limitLocal = slot.local;
+        info.limitSlot = static_cast<int>(slot.index);
+    } else {
+        const Literal& literal = static_cast<LiteralExpr*>(limit)->token.literal;
+        if (auto* i = std::get_if<int64_t>(&literal)) {
+            info.limit = *i;
+        } else {
+            info.limit = std::get<double>(literal);
+        }
+    }
+    info.bodyStart = program.instructions.size();
+    
+    auto& statements = static_cast<BlockStmt*>(stmt->body.get())->statements;
+    enterScope();
+    for (size_t i = 0; i + 1 < statements.size(); i++) {
+        generateStmt(statements[i].get());
+    }
+    exitScope();
+    
+    size_t index = program.countedLoops.size();
+    program.countedLoops.push_back(std::move(info));
+    emit(OpCode::LOOP_INC_JMP, static_cast<int>(index));
+    patchJumps(exitJumps, program.instructions.size());
+}
+
+// Comparison of two integers as the VM makes it, exactly
+static bool compareConstants(OpCode op, int64_t a, int64_t b) {
+    switch (op) {
+        case OpCode::CMP_EQ: return a == b;
+        case OpCode::CMP_NE: return a != b;
+        case OpCode::CMP_LT: return a < b;
+        case OpCode::CMP_LE: return a <= b;
+        case OpCode::CMP_GT: return a > b;
+        default: return a >= b;
+    }
+}
+
+// Copies the body once per iteration when the counter starts at a known
+// integer, the limit is an integer literal, the trip count is small and the
+// body never writes the counter. Each copy after the first stores the
+// counter's value for that iteration, so the copies need no test and no
+// jump. Returns false, having emitted nothing, for any other loop.
+bool CodeGenerator::generateUnrolled(WhileStmt* stmt, const CountedLoop& loop, int64_t start) {
+    const size_t maxTrips = 8;
+    const size_t maxNodes = 128;  // Body nodes times trip count
+    
+    auto* limit = dynamic_cast<LiteralExpr*>(static_cast<BinaryExpr*>(stmt->condition.get())->right.get());
+    const int64_t* end = limit ? std::get_if<int64_t>(&limit->token.literal) : nullptr;
+    if (!end) return false;
+    std::vector<int64_t> values;
+    int64_t value = start;
+    while (compareConstants(loop.compare, value, *end)) {
+        if (values.size() == maxTrips) return false;
+        values.push_back(value);
+        bool overflow = loop.stepOp == OpCode::ADD ? __builtin_add_overflow(value, loop.step, &value)
+                                                   : __builtin_sub_overflow(value, loop.step, &value);
+        if (overflow) return false;
+    }
+    
+    auto& statements = static_cast<BlockStmt*>(stmt->body.get())->statements;
+    if (values.size() * countNodes(stmt->body.get()) > maxNodes) return false;
+    Slot counter = resolveVariable(loop.counter);
+    bool written = false;
+    for (size_t i = 0; i + 1 < statements.size(); i++) {
+        walkAST(statements[i].get(), [&](ASTNode* node) {
+            if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+                written |= assignment->name.symbol == loop.counter;
+            } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+                written |= varDecl->name.symbol == loop.counter;
+            } else if (auto* parallel = dynamic_cast<ParallelForStmt*>(node)) {
+                written |= parallel->variable.symbol == loop.counter;
+            } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+                written |= forIn->variable.symbol == loop.counter;
+            } else if (auto* call = dynamic_cast<CallExpr*>(node); call && !counter.local && !isBuiltinCall(call)) {
+                size_t index = lookupFunction(call->callee, call->arguments.size());
+                std::vector<FunctionStmt*> visiting;
+                written |= findGlobalWrite(functionDecls[index], visiting) != NO_SYMBOL;
+            }
+        });
+    }
+    if (written) return false;
+    
+    for (size_t k = 0; k < values.size(); k++) {
+        if (k > 0) {
+            emit(OpCode::PUSH, values[k]);
+            emitStore(counter);
+        }
+        enterScope();
+        for (size_t i = 0; i + 1 < statements.size(); i++) {
+            generateStmt(statements[i].get());
+        }
+        exitScope();
+    }
+    if (!values.empty()) {
+        emit(OpCode::PUSH, value);
+        emitStore(counter);
+    }
+    return true;
+}
+
+// `var i = <integer>;` or `i = <integer>;`
+static bool constantInit(Statement* stmt, Symbol& name, int64_t& value) {
+    ASTNode* initializer = nullptr;
+    if (auto* varDecl = dynamic_cast<VarDeclStmt*>(stmt)) {
+        name = varDecl->name.symbol;
+        initializer = varDecl->initializer.get();
+    } else if (auto* exprStmt = dynamic_cast<ExpressionStmt*>(stmt)) {
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(exprStmt->expression.get())) {
+            name = assignment->name.symbol;
+            initializer = assignment->value.get();
+        }
+    }
+    auto* literal = dynamic_cast<LiteralExpr*>(initializer);
+    const int64_t* constant = literal ? std::get_if<int64_t>(&literal->token.literal) : nullptr;
+    if (!constant || literal->token.type != TokenType::NUMBER) return false;
+    value = *constant;
+    return true;
 }
 
 void CodeGenerator::generateBlock(BlockStmt* stmt) {
     enterScope();
+    // A desugared `for` is its initializer followed by the loop
+    Symbol initName = NO_SYMBOL;
+    int64_t initValue = 0;
     for (auto& statement : stmt->statements) {
-        generateStmt(statement.get());
+        if (auto* whileStmt = dynamic_cast<WhileStmt*>(statement.get())) {
+            generateWhile(whileStmt, initName, initValue);
+        } else {
+            generateStmt(statement.get());
+        }
+        if (!constantInit(statement.get(), initName, initValue)) {
+            initName = NO_SYMBOL;
+        }
     }
     exitScope();
 }
@@ -195,6 +630,570 @@ void CodeGenerator::generatePrint(PrintStmt* stmt) {
     emit(OpCode::PRINT);
 }
 
+void CodeGenerator::declareFunctions(BlockStmt* block) {
+    for (auto& statement : block->statements) {
+        if (auto* fn = dynamic_cast<FunctionStmt*>(statement.get())) {
+            if (lookup(functionIndices, fn->name.symbol)) {
+                throw std::runtime_error("Function '" + fn->name.value + "' is already defined");
+            }
+            FunctionInfo info;
+            info.name = fn->name.value;
+            info.arity = static_cast<int>(fn->params.size());
+            functionDecls.push_back(fn);
+            bind(functionIndices, fn->name.symbol, functionDecls.size());
+            program.functions.push_back(info);
+        }
+    }
+    definedFunctions = functionDecls.size();
+}
+
+void CodeGenerator::generateFunction(size_t index) {
+    FunctionStmt* fn = functionDecls[index];
+    FunctionContext context{fn, {}};
+    currentFunction = &context;
+    for (const auto& param : fn->params) {
+        if (lookup(localSlots, param.symbol)) {
+            for (Symbol local : context.locals) {
+                bind(localSlots, local, 0);
+            }
+            currentFunction = nullptr;
+            throw std::runtime_error("Duplicate parameter '" + param.value + "' in function '" + fn->name.value + "'");
+        }
+        declareVariable(param.symbol);
+    }
+    
+    program.functions[index].entry = program.instructions.size();
+    for (auto& statement : fn->body) {
+        generateStmt(statement.get());
+    }
+    // Falling off the end returns null
+    emit(OpCode::PUSH, StringRef::intern("null"));
+    emit(OpCode::RET);
+    generateColdBlocks();
+    program.functions[index].localCount = static_cast<int>(context.locals.size());
+    for (Symbol local : context.locals) {
+        bind(localSlots, local, 0);
+    }
+    currentFunction = nullptr;
+}
+
+size_t CodeGenerator::lookupFunction(const Token& name, size_t argCount) {
+    size_t index = lookup(functionIndices, name.symbol);
+    if (!index && resolver) {
+        // Import the declaration; its body is compiled in another unit
+        if (FunctionStmt* fn = resolver(name.symbol)) {
+            FunctionInfo info;
+            info.name = fn->name.value;
+            info.arity = static_cast<int>(fn->params.size());
+            functionDecls.push_back(fn);
+            index = functionDecls.size();
+            bind(functionIndices, name.symbol, index);
+            program.functions.push_back(info);
+        }
+    }
+    if (!index) {
+        throw std::runtime_error("Undefined function '" + name.value + "'");
+    }
+    const FunctionInfo& info = program.functions[index - 1];
+    if (static_cast<size_t>(info.arity) != argCount) {
+        throw std::runtime_error("Function '" + name.value + "' expects " + std::to_string(info.arity) +
+                                 " arguments but got " + std::to_string(argCount));
+    }
+    return index - 1;
+}
+
+// Counts the nodes of an expression made only of literals, variables and
+// binary operators; returns -1 for anything else (calls, assignments).
+static int simpleExprSize(ASTNode* expr) {
+    if (dynamic_cast<LiteralExpr*>(expr) || dynamic_cast<VariableExpr*>(expr)) {
+        return 1;
+    }
+    if (auto* binary = dynamic_cast<BinaryExpr*>(expr)) {
+        int left = simpleExprSize(binary->left.get());
+        int right = simpleExprSize(binary->right.get());
+        if (left < 0 || right < 0) return -1;
+        return left + right + 1;
+    }
+    return -1;
+}
+
+bool CodeGenerator::isInlinable(FunctionStmt* fn) {
+    // Only `return <expr>;` bodies without calls, so never recursive
+    const int maxInlineNodes = 16;
+    if (fn->body.size() != 1) return false;
+    auto* ret = dynamic_cast<ReturnStmt*>(fn->body[0].get());
+    if (!ret || !ret->value) return false;
+    int size = simpleExprSize(ret->value.get());
+    return size > 0 && size <= maxInlineNodes;
+}
+
+void CodeGenerator::generateCall(CallExpr* expr) {
+    if (isBuiltinCall(expr)) {
+        generateBuiltin(expr, false);
+        return;
+    }
+    size_t index = lookupFunction(expr->callee, expr->arguments.size());
+    FunctionStmt* callee = functionDecls[index];
+    if (isInlinable(callee)) {
+        generateInlineCall(expr, callee);
+        return;
+    }
+    
+    // Arguments are left in place and become the callee's first frame slots
+    for (auto& argument : expr->arguments) {
+        generateExpr(argument.get());
+    }
+    emit(OpCode::CALL, static_cast<int>(index));
+}
+
+void CodeGenerator::generateMap(MapExpr* expr) {
+    emit(OpCode::MAP_NEW, static_cast<int64_t>(expr->entries.size()));
+    for (auto& entry : expr->entries) {
+        generateExpr(entry.first.get());
+        generateExpr(entry.second.get());
+        emit(OpCode::MAP_INSERT);
+    }
+}
+
+void CodeGenerator::generateInlineCall(CallExpr* expr, FunctionStmt* callee) {
+    // Evaluate every argument before binding any, then spill into temporaries
+    for (auto& argument : expr->arguments) {
+        generateExpr(argument.get());
+    }
+    std::vector<std::pair<Symbol, Slot>> bindings;
+    std::vector<Slot> temps;
+    for (size_t i = 0; i < callee->params.size(); i++) {
+        temps.push_back(allocateTemp(i));
+        bindings.emplace_back(callee->params[i].symbol, temps.back());
+    }
+    for (size_t i = temps.size(); i-- > 0;) {
+        emitStore(temps[i]);
+    }
+    
+    auto* ret = static_cast<ReturnStmt*>(callee->body[0].get());
+    const auto* saved = inlineParams;
+    inlineParams = &bindings;
+    generateExpr(ret->value.get());
+    inlineParams = saved;
+}
+
+void CodeGenerator::generateReturn(ReturnStmt* stmt) {
+    if (!currentFunction) {
+        throw std::runtime_error("Cannot return from top-level code");
+    }
+    
+    // A call in tail position reuses the current frame
+    if (auto* call = dynamic_cast<CallExpr*>(stmt->value.get()); call && !isBuiltinCall(call)) {
+        size_t index = lookupFunction(call->callee, call->arguments.size());
+        if (!isInlinable(functionDecls[index])) {
+            for (auto& argument : call->arguments) {
+                generateExpr(argument.get());
+            }
+            emit(OpCode::TAIL_CALL, static_cast<int>(index));
+            return;
+        }
+    }
+    
+    if (stmt->value) {
+        generateExpr(stmt->value.get());
+    } else {
+        emit(OpCode::PUSH, StringRef::intern("null"));
+    }
+    emit(OpCode::RET);
+}
+
+// Calls `visit` on `node` and every statement and expression below it
+static void walkAST(ASTNode* node, const std::function<void(ASTNode*)>& visit) {
+    if (!node) return;
+    visit(node);
+    if (auto* binary = dynamic_cast<BinaryExpr*>(node)) {
+        walkAST(binary->left.get(), visit);
+        walkAST(binary->right.get(), visit);
+    } else if (auto* logical = dynamic_cast<LogicalExpr*>(node)) {
+        walkAST(logical->left.get(), visit);
+        walkAST(logical->right.get(), visit);
+    } else if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+        walkAST(assignment->value.get(), visit);
+    } else if (auto* call = dynamic_cast<CallExpr*>(node)) {
+        for (auto& argument : call->arguments) walkAST(argument.get(), visit);
+    } else if (auto* map = dynamic_cast<MapExpr*>(node)) {
+        for (auto& entry : map->entries) {
+            walkAST(entry.first.get(), visit);
+            walkAST(entry.second.get(), visit);
+        }
+    } else if (auto* index = dynamic_cast<IndexExpr*>(node)) {
+        walkAST(index->object.get(), visit);
+        walkAST(index->key.get(), visit);
+    } else if (auto* indexAssign = dynamic_cast<IndexAssignExpr*>(node)) {
+        walkAST(indexAssign->object.get(), visit);
+        walkAST(indexAssign->key.get(), visit);
+        walkAST(indexAssign->value.get(), visit);
+    } else if (auto* exprStmt = dynamic_cast<ExpressionStmt*>(node)) {
+        walkAST(exprStmt->expression.get(), visit);
+    } else if (auto* print = dynamic_cast<PrintStmt*>(node)) {
+        walkAST(print->expression.get(), visit);
+    } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+        walkAST(varDecl->initializer.get(), visit);
+    } else if (auto* block = dynamic_cast<BlockStmt*>(node)) {
+        for (auto& statement : block->statements) walkAST(statement.get(), visit);
+    } else if (auto* ifStmt = dynamic_cast<IfStmt*>(node)) {
+        walkAST(ifStmt->condition.get(), visit);
+        walkAST(ifStmt->thenBranch.get(), visit);
+        walkAST(ifStmt->elseBranch.get(), visit);
+    } else if (auto* whileStmt = dynamic_cast<WhileStmt*>(node)) {
+        walkAST(whileStmt->condition.get(), visit);
+        walkAST(whileStmt->body.get(), visit);
+    } else if (auto* fn = dynamic_cast<FunctionStmt*>(node)) {
+        for (auto& statement : fn->body) walkAST(statement.get(), visit);
+    } else if (auto* ret = dynamic_cast<ReturnStmt*>(node)) {
+        walkAST(ret->value.get(), visit);
+    } else if (auto* parallel = dynamic_cast<ParallelForStmt*>(node)) {
+        walkAST(parallel->start.get(), visit);
+        walkAST(parallel->end.get(), visit);
+        walkAST(parallel->body.get(), visit);
+    } else if (auto* spawn = dynamic_cast<SpawnStmt*>(node)) {
+        walkAST(spawn->body.get(), visit);
+    } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+        walkAST(forIn->iterable.get(), visit);
+        walkAST(forIn->body.get(), visit);
+    }
+}
+
+void CodeGenerator::addSite(ASTNode* node, SiteKind kind, size_t pc) {
+    if (node->nodeId != ASTNode::NO_NODE_ID) {
+        sites.push_back({pc, node->nodeId, kind});
+    }
+}
+
+// Whether the profile only saw two integers at the arithmetic or comparison
+// `node`
+bool CodeGenerator::integerSite(ASTNode* node) {
+    return profile && node->nodeId != ASTNode::NO_NODE_ID && profile->integersOnly(node->nodeId);
+}
+
+// Whether the if's else branch ran less often than its then branch. Only
+// safe to move if compiling it later resolves its variables the same way:
+// inside functions, names not yet declared as locals would be resolved
+// against declarations that come after the if.
+bool CodeGenerator::isColdElse(IfStmt* stmt) {
+    if (!profile || stmt->nodeId == ASTNode::NO_NODE_ID || inParallelBody || inTaskBody) {
+        return false;
+    }
+    const Profile::Branch* branch = profile->branch(stmt->nodeId);
+    if (!branch || branch->elseCount >= branch->thenCount) {
+        return false;
+    }
+    bool movable = true;
+    walkAST(stmt->elseBranch.get(), [&](ASTNode* node) {
+        Symbol name = NO_SYMBOL;
+        if (auto* variable = dynamic_cast<VariableExpr*>(node)) {
+            name = variable->name.symbol;
+        } else if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+            name = assignment->name.symbol;
+        } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+            name = varDecl->name.symbol;
+        } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+            name = forIn->variable.symbol;
+        } else if (dynamic_cast<ParallelForStmt*>(node) || dynamic_cast<SpawnStmt*>(node)) {
+            movable = false;
+        }
+        if (name != NO_SYMBOL && currentFunction && !lookup(localSlots, name)) {
+            movable = false;
+        }
+    });
+    return movable;
+}
+
+// Cold blocks go after the code that was just compiled, in the same code
+// region. They can contain ifs with cold else branches of their own.
+void CodeGenerator::generateColdBlocks() {
+    for (size_t i = 0; i < coldBlocks.size(); i++) {
+        ColdBlock block = coldBlocks[i];
+        patchJumps(block.jumps, program.instructions.size());
+        generateStmt(block.body);
+        emit(OpCode::JMP, static_cast<int64_t>(block.resume));
+    }
+    coldBlocks.clear();
+}
+
+size_t countNodes(ASTNode* node) {
+    size_t count = 0;
+    walkAST(node, [&](ASTNode*) { count++; });
+    return count;
+}
+
+void CodeGenerator::generateParallelFor(ParallelForStmt* stmt) {
+    if (inParallelBody) {
+        throw std::runtime_error("parallel for cannot be nested");
+    }
+    checkParallelBody(stmt);
+    
+    generateExpr(stmt->start.get());
+    generateExpr(stmt->end.get());
+    
+    ParallelLoopInfo loop;
+    Slot induction = declareVariable(stmt->variable.symbol);
+    loop.inductionLocal = induction.local;
+    loop.inductionSlot = static_cast<int>(induction.index);
+    loop.inclusive = stmt->inclusive;
+    loop.step = stmt->step;
+    for (const auto& reduction : stmt->reductions) {
+        Reduction r;
+        Symbol kind = reduction.first.symbol;
+        r.kind = kind == SymbolTable::SUM ? ReductionKind::SUM
+               : kind == SymbolTable::MIN ? ReductionKind::MIN
+               : kind == SymbolTable::MAX ? ReductionKind::MAX
+               : ReductionKind::CONCAT;
+        Slot slot = resolveVariable(reduction.second.symbol);
+        r.local = slot.local;
+        r.slot = static_cast<int>(slot.index);
+        loop.reductions.push_back(r);
+    }
+    
+    size_t loopIndex = program.parallelLoops.size();
+    program.parallelLoops.emplace_back();
+    emit(OpCode::PAR_FOR, static_cast<int>(loopIndex));
+    
+    loop.bodyStart = program.instructions.size();
+    inParallelBody = true;
+    generateStmt(stmt->body.get());
+    inParallelBody = false;
+    loop.bodyEnd = program.instructions.size();
+    emit(OpCode::PAR_END);
+    
+    program.parallelLoops[loopIndex] = std::move(loop);
+}
+
+// Iterations run concurrently on private copies of the variables, so the
+// body may only write variables it declares itself and the reductions.
+void CodeGenerator::checkParallelBody(ParallelForStmt* stmt) {
+    std::vector<Symbol> allowed;
+    for (const auto& reduction : stmt->reductions) {
+        if (reduction.second.symbol == stmt->variable.symbol) {
+            throw std::runtime_error("Loop variable '" + stmt->variable.value + "' cannot be a reduction");
+        }
+        allowed.push_back(reduction.second.symbol);
+    }
+    walkAST(stmt->body.get(), [&](ASTNode* node) {
+        if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+            allowed.push_back(varDecl->name.symbol);
+        } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+            allowed.push_back(forIn->variable.symbol);
+        }
+    });
+    
+    walkAST(stmt->body.get(), [&](ASTNode* node) {
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+            const std::string& name = assignment->name.value;
+            if (assignment->name.symbol == stmt->variable.symbol) {
+                throw std::runtime_error("parallel for body cannot assign loop variable '" + name + "'");
+            }
+            if (std::find(allowed.begin(), allowed.end(), assignment->name.symbol) == allowed.end()) {
+                throw std::runtime_error("parallel for body writes shared variable '" + name +
+                                         "'; declare it in the body or as a reduction");
+            }
+        } else if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+            if (varDecl->name.symbol == stmt->variable.symbol) {
+                throw std::runtime_error("parallel for body cannot redeclare loop variable '" + varDecl->name.value + "'");
+            }
+        } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+            if (forIn->variable.symbol == stmt->variable.symbol) {
+                throw std::runtime_error("parallel for body cannot redeclare loop variable '" + forIn->variable.value + "'");
+            }
+        } else if (Symbol map = mapWriteTarget(node);
+                   map != NO_SYMBOL && std::find(allowed.begin(), allowed.end(), map) == allowed.end()) {
+            throw std::runtime_error("parallel for body changes shared map '" + symbols.name(map) +
+                                     "'; declare it in the body");
+        } else if (dynamic_cast<ReturnStmt*>(node)) {
+            throw std::runtime_error("Cannot return from inside a parallel for body");
+        } else if (dynamic_cast<SpawnStmt*>(node)) {
+            throw std::runtime_error("spawn cannot be used inside a parallel for body");
+        } else if (auto* call = dynamic_cast<CallExpr*>(node)) {
+            if (isBuiltinCall(call)) {
+                Symbol name = call->callee.symbol;
+                if (name == SymbolTable::CHANNEL || name == SymbolTable::SEND || name == SymbolTable::RECV) {
+                    throw std::runtime_error("Channels cannot be used inside a parallel for body");
+                }
+                return;
+            }
+            size_t index = lookupFunction(call->callee, call->arguments.size());
+            std::vector<FunctionStmt*> visiting;
+            Symbol global = findGlobalWrite(functionDecls[index], visiting);
+            if (global != NO_SYMBOL) {
+                throw std::runtime_error("parallel for body calls '" + call->callee.value +
+                                         "', which writes global variable '" + symbols.name(global) + "'");
+            }
+        }
+    });
+}
+
+// Returns the name of a global variable that `fn`, or a function it calls,
+// may assign; empty if there is none.
+Symbol CodeGenerator::findGlobalWrite(FunctionStmt* fn, std::vector<FunctionStmt*>& visiting) {
+    if (std::find(visiting.begin(), visiting.end(), fn) != visiting.end()) {
+        return NO_SYMBOL;
+    }
+    visiting.push_back(fn);
+    
+    std::vector<Symbol> locals;
+    for (const auto& param : fn->params) {
+        locals.push_back(param.symbol);
+    }
+    walkAST(fn, [&](ASTNode* node) {
+        if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+            locals.push_back(varDecl->name.symbol);
+        } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+            locals.push_back(forIn->variable.symbol);
+        }
+    });
+    
+    Symbol found = NO_SYMBOL;
+    walkAST(fn, [&](ASTNode* node) {
+        if (found != NO_SYMBOL) return;
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+            if (std::find(locals.begin(), locals.end(), assignment->name.symbol) == locals.end()) {
+                found = assignment->name.symbol;
+            }
+        } else if (Symbol map = mapWriteTarget(node);
+                   map != NO_SYMBOL && std::find(locals.begin(), locals.end(), map) == locals.end()) {
+            found = map;
+        } else if (auto* call = dynamic_cast<CallExpr*>(node); call && !isBuiltinCall(call)) {
+            size_t index = lookupFunction(call->callee, call->arguments.size());
+            found = findGlobalWrite(functionDecls[index], visiting);
+        }
+    });
+    return found;
+}
+
+Symbol CodeGenerator::mapWriteTarget(ASTNode* node) {
+    ASTNode* map = nullptr;
+    if (auto* indexAssign = dynamic_cast<IndexAssignExpr*>(node)) {
+        map = indexAssign->object.get();
+    } else if (auto* call = dynamic_cast<CallExpr*>(node);
+               call && call->callee.symbol == SymbolTable::DELETE && isBuiltinCall(call) && !call->arguments.empty()) {
+        map = call->arguments[0].get();
+    }
+    while (auto* index = dynamic_cast<IndexExpr*>(map)) {
+        map = index->object.get();
+    }
+    auto* variable = dynamic_cast<VariableExpr*>(map);
+    return variable ? variable->name.symbol : NO_SYMBOL;
+}
+
+void CodeGenerator::generateSpawn(SpawnStmt* stmt) {
+    if (inParallelBody) {
+        throw std::runtime_error("spawn cannot be used inside a parallel for body");
+    }
+    checkTaskBody(stmt);
+    
+    // SPAWN's operand is the pc of the TASK_END closing the body
+    size_t spawn = program.instructions.size();
+    emit(OpCode::SPAWN, static_cast<int64_t>(0));
+    bool saved = inTaskBody;
+    inTaskBody = true;
+    generateStmt(stmt->body.get());
+    inTaskBody = saved;
+    program.instructions[spawn].operand = static_cast<int64_t>(program.instructions.size());
+    emit(OpCode::TASK_END);
+}
+
+// A task runs on private copies of the variables, as a parallel loop
+// iteration does, so its body may only write variables it declares itself.
+// Tasks talk to each other and to the main program over channels.
+void CodeGenerator::checkTaskBody(SpawnStmt* stmt) {
+    std::vector<Symbol> allowed;
+    walkAST(stmt->body.get(), [&](ASTNode* node) {
+        if (auto* varDecl = dynamic_cast<VarDeclStmt*>(node)) {
+            allowed.push_back(varDecl->name.symbol);
+        } else if (auto* parallel = dynamic_cast<ParallelForStmt*>(node)) {
+            allowed.push_back(parallel->variable.symbol);
+        } else if (auto* forIn = dynamic_cast<ForInStmt*>(node)) {
+            allowed.push_back(forIn->variable.symbol);
+        }
+    });
+    
+    walkAST(stmt->body.get(), [&](ASTNode* node) {
+        if (auto* assignment = dynamic_cast<AssignmentExpr*>(node)) {
+            if (std::find(allowed.begin(), allowed.end(), assignment->name.symbol) == allowed.end()) {
+                throw std::runtime_error("spawn body writes shared variable '" + assignment->name.value +
+                                         "'; declare it in the body or send the value over a channel");
+            }
+        } else if (Symbol map = mapWriteTarget(node);
+                   map != NO_SYMBOL && std::find(allowed.begin(), allowed.end(), map) == allowed.end()) {
+            throw std::runtime_error("spawn body changes shared map '" + symbols.name(map) +
+                                     "'; declare it in the body or send the map over a channel");
+        } else if (dynamic_cast<ReturnStmt*>(node)) {
+            throw std::runtime_error("Cannot return from inside a spawn body");
+        } else if (auto* call = dynamic_cast<CallExpr*>(node); call && !isBuiltinCall(call)) {
+            size_t index = lookupFunction(call->callee, call->arguments.size());
+            std::vector<FunctionStmt*> visiting;
+            Symbol global = findGlobalWrite(functionDecls[index], visiting);
+            if (global != NO_SYMBOL) {
+                throw std::runtime_error("spawn body calls '" + call->callee.value +
+                                         "', which writes global variable '" + symbols.name(global) + "'");
+            }
+        }
+    });
+}
+
+namespace {
+
+struct Builtin {
+    size_t arity;
+    OpCode op;
+};
+
+// Indexed by symbol from SymbolTable::CHANNEL on
+const Builtin BUILTINS[] = {
+    {1, OpCode::CHAN_NEW},    // channel
+    {2, OpCode::SEND},        // send
+    {1, OpCode::RECV},        // recv
+    {0, OpCode::READ_LINE},   // readLine
+    {1, OpCode::READ_ALL},    // readAll
+    {1, OpCode::LINES},       // lines
+    {2, OpCode::MAP_HAS},     // has
+    {2, OpCode::MAP_DELETE},  // delete
+    {1, OpCode::MAP_SIZE},    // size
+};
+static_assert(sizeof(BUILTINS) / sizeof(BUILTINS[0]) == SymbolTable::WORD_COUNT - SymbolTable::CHANNEL,
+              "every builtin word needs an entry");
+
+const Builtin* findBuiltin(Symbol name) {
+    if (name < SymbolTable::CHANNEL || name >= SymbolTable::WORD_COUNT) {
+        return nullptr;
+    }
+    return &BUILTINS[name - SymbolTable::CHANNEL];
+}
+
+}  // namespace
+
+bool CodeGenerator::isBuiltinCall(CallExpr* call) {
+    Symbol name = call->callee.symbol;
+    return findBuiltin(name) && !lookup(functionIndices, name) && !(resolver && resolver(name));
+}
+
+void CodeGenerator::generateBuiltin(CallExpr* call, bool statement) {
+    const Builtin& builtin = *findBuiltin(call->callee.symbol);
+    if (call->arguments.size() != builtin.arity) {
+        throw std::runtime_error("Function '" + call->callee.value + "' expects " + std::to_string(builtin.arity) +
+                                 " arguments but got " + std::to_string(call->arguments.size()));
+    }
+    for (auto& argument : call->arguments) {
+        generateExpr(argument.get());
+    }
+    if (builtin.op == OpCode::SEND) {
+        if (!statement) {
+            throw std::runtime_error("send(...) has no value; use it as a statement");
+        }
+        emit(OpCode::SEND);
+        return;
+    }
+    emit(builtin.op);
+    if (statement) {
+        emit(OpCode::POP);
+    }
+}
+
 void CodeGenerator::emit(OpCode op) {
     program.instructions.emplace_back(op);
 }
@@ -203,17 +1202,66 @@ void CodeGenerator::emit(OpCode op, Value operand) {
     program.instructions.emplace_back(op, operand);
 }
 
-size_t CodeGenerator::getVariableIndex(const std::string& name) {
+size_t CodeGenerator::getVariableIndex(Symbol name) {
     // Check if variable already exists in global scope
-    auto it = variables.find(name);
-    if (it != variables.end()) {
-        return it->second;
+    if (size_t slot = lookup(globalSlots, name)) {
+        return slot - 1;
     }
     
     // Add to global scope
-    size_t index = variables.size();
-    variables[name] = index;
-    return index;
+    globals.push_back(name);
+    bind(globalSlots, name, globals.size());
+    return globals.size() - 1;
+}
+
+CodeGenerator::Slot CodeGenerator::resolveVariable(Symbol name) {
+    if (inlineParams) {
+        // Inlined bodies only see their parameters and globals
+        for (const auto& binding : *inlineParams) {
+            if (binding.first == name) {
+                return binding.second;
+            }
+        }
+        return {false, getVariableIndex(name)};
+    }
+    if (currentFunction) {
+        if (size_t slot = lookup(localSlots, name)) {
+            return {true, slot - 1};
+        }
+    }
+    return {false, getVariableIndex(name)};
+}
+
+CodeGenerator::Slot CodeGenerator::declareVariable(Symbol name) {
+    if (currentFunction) {
+        if (size_t slot = lookup(localSlots, name)) {
+            return {true, slot - 1};
+        }
+        auto& locals = currentFunction->locals;
+        locals.push_back(name);
+        bind(localSlots, name, locals.size());
+        return {true, locals.size() - 1};
+    }
+    return {false, getVariableIndex(name)};
+}
+
+Symbol CodeGenerator::hiddenSymbol(std::vector<Symbol>& cache, const char* prefix, size_t n) {
+    while (cache.size() <= n) {
+        cache.push_back(symbols.intern(prefix + std::to_string(cache.size())));
+    }
+    return cache[n];
+}
+
+CodeGenerator::Slot CodeGenerator::allocateTemp(size_t n) {
+    return declareVariable(hiddenSymbol(inlineSymbols, "$inline", n));
+}
+
+void CodeGenerator::emitLoad(Slot slot) {
+    emit(slot.local ? OpCode::LOAD_LOCAL : OpCode::LOAD, static_cast<int>(slot.index));
+}
+
+void CodeGenerator::emitStore(Slot slot) {
+    emit(slot.local ? OpCode::STORE_LOCAL : OpCode::STORE, static_cast<int>(slot.index));
 }
 
 void CodeGenerator::enterScope() {
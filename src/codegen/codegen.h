@@ -2,28 +2,129 @@
 #define CODEGEN_H
 
 #include "../ast/ast.h"
+#include "../profile/profile.h"
 #include "bytecode.h"
+#include "linker.h"
+#include <functional>
 #include <unordered_map>
 #include <stack>
 #include <string>
 
 class CodeGenerator {
 public:
-    CodeGenerator();
+    // `symbols` names the identifiers of every AST compiled, and must outlive
+    // the generator
+    explicit CodeGenerator(SymbolTable& symbols);
     
     // Generate bytecode from AST
     BytecodeProgram generate(ASTNode* ast);
     
+    // Looks up a function declared outside the statements being compiled
+    using FunctionResolver = std::function<FunctionStmt*(Symbol)>;
+    
+    // Generate a relocatable unit (see linker.h) from top-level statements.
+    // Calls to functions not declared in `block` go through `resolver`.
+    BytecodeUnit generateUnit(BlockStmt* block, const FunctionResolver& resolver);
+    
+    // Streaming: compiles one top-level statement at a time on a fresh
+    // generator. Function bodies stay at the start of the program; the code
+    // of the previous statement is replaced by this one's, which ends in HALT
+    // and starts at mainEntry. Functions must be declared before they are
+    // called, and their ASTs must outlive the generator.
+    const BytecodeProgram& generateNext(Statement* stmt);
+    
+    // Profile-guided compilation (see profile/profile.h). generate() lays
+    // out ifs and picks opcodes by `profile`, which must outlive the calls,
+    // and reports where each profiled construct ended up in profileSites().
+    void setProfile(const Profile* value) { profile = value; }
+    const std::vector<ProfileSite>& profileSites() const { return sites; }
+    
 private:
     // Current bytecode program being generated
     BytecodeProgram program;
     
-    // Symbol table for variables
-    std::unordered_map<std::string, size_t> variables;
+    SymbolTable& symbols;
+    
+    // Variables, functions and the like are found by symbol in vectors that
+    // hold their index + 1, or 0 for symbols that have none. The vectors grow
+    // as symbols are bound.
+    static size_t lookup(const std::vector<size_t>& bySymbol, Symbol symbol) {
+        return symbol < bySymbol.size() ? bySymbol[symbol] : 0;
+    }
+    void bind(std::vector<size_t>& bySymbol, Symbol symbol, size_t value);
+    
+    // Global slots by symbol, and the symbol of every global slot
+    std::vector<size_t> globalSlots;
+    std::vector<Symbol> globals;
     
     // Stack of scopes for nested blocks
     std::stack<std::unordered_map<std::string, size_t>> scopes;
     
+    // A resolved variable: either a global slot or a slot in the current frame
+    struct Slot {
+        bool local;
+        size_t index;
+    };
+    
+    // Function being compiled; null while compiling top-level code. Its
+    // frame slots by symbol are in localSlots, and cleared when it is done.
+    struct FunctionContext {
+        FunctionStmt* decl;
+        std::vector<Symbol> locals;  // By frame slot
+    };
+    FunctionContext* currentFunction = nullptr;
+    std::vector<size_t> localSlots;
+    
+    // Functions declared at top level, indexed like program.functions, and
+    // their indices by symbol
+    std::vector<FunctionStmt*> functionDecls;
+    std::vector<size_t> functionIndices;
+    void clearFunctions();
+    size_t definedFunctions = 0;  // Functions past this index are imported
+    FunctionResolver resolver;
+    
+    // End of the function bodies, and their parallel and counted loop
+    // counts, in a streamed program
+    size_t functionCodeEnd = 0;
+    size_t functionLoopCount = 0;
+    size_t functionCountedLoopCount = 0;
+    
+    // True while compiling the body of a parallel loop, or of a spawn
+    bool inParallelBody = false;
+    bool inTaskBody = false;
+    
+    // Nesting depth of for-in loops, which keep their iterator in a hidden
+    // variable per depth
+    size_t forInDepth = 0;
+    
+    // Hidden variables ("$iter0", "$inline0", ...) by number, interned on
+    // first use. Their names cannot clash with identifiers from the source.
+    std::vector<Symbol> iteratorSymbols;
+    std::vector<Symbol> inlineSymbols;
+    Symbol hiddenSymbol(std::vector<Symbol>& cache, const char* prefix, size_t n);
+    
+    // Parameter bindings of the function being inlined, if any
+    const std::vector<std::pair<Symbol, Slot>>* inlineParams = nullptr;
+    
+    // Profile-guided compilation: generate() numbers the nodes of its AST
+    // (ASTNode::nodeId), and sites are found while compiling them
+    const Profile* profile = nullptr;
+    std::vector<ProfileSite> sites;
+    void addSite(ASTNode* node, SiteKind kind, size_t pc);
+    bool integerSite(ASTNode* node);
+    
+    // An else arm the profile found cold, compiled after the end of the
+    // current function or top-level code: `jumps` lead to it and it jumps
+    // back to `resume`
+    struct ColdBlock {
+        Statement* body;
+        std::vector<size_t> jumps;
+        size_t resume;
+    };
+    std::vector<ColdBlock> coldBlocks;
+    bool isColdElse(IfStmt* stmt);
+    void generateColdBlocks();
+    
     // Helper methods for code generation
     void generateExpr(ASTNode* expr);
     void generateStmt(Statement* stmt);
@@ -31,20 +132,78 @@ private:
     // Specific generation methods
     void generateLiteral(LiteralExpr* expr);
     void generateBinary(BinaryExpr* expr);
+    void generateLogical(LogicalExpr* expr);
+    // Emits code that jumps when `condition` is `jumpIf` and falls through
+    // otherwise, without materializing comparisons or `&&`/`||` results.
+    // The jumps are appended to `jumps` for the caller to patch.
+    void generateBranch(ASTNode* condition, bool jumpIf, std::vector<size_t>& jumps);
+    void patchJumps(const std::vector<size_t>& jumps, size_t target);
     void generateVariable(VariableExpr* expr);
     void generateAssignment(AssignmentExpr* expr);
     void generateVarDecl(VarDeclStmt* stmt);
     void generateIf(IfStmt* stmt);
-    void generateWhile(WhileStmt* stmt);
+    // `initName`/`initValue`: a variable the statement before the loop set
+    // to an integer constant, if any
+    void generateWhile(WhileStmt* stmt, Symbol initName = NO_SYMBOL, int64_t initValue = 0);
+    
+    // A while loop that LOOP_INC_JMP can close (see CountedLoopInfo): its
+    // body ends in `i = i + c` or `i = i - c` for an integer constant c, and
+    // its condition compares `i` with a number literal or a variable
+    struct CountedLoop {
+        Symbol counter;
+        OpCode compare;
+        OpCode stepOp;
+        int64_t step;
+    };
+    bool matchCountedLoop(WhileStmt* stmt, CountedLoop& loop);
+    void generateCountedLoop(WhileStmt* stmt, const CountedLoop& loop);
+    bool generateUnrolled(WhileStmt* stmt, const CountedLoop& loop, int64_t start);
+    void generateForIn(ForInStmt* stmt);
     void generateBlock(BlockStmt* stmt);
     void generatePrint(PrintStmt* stmt);
+    void generateCall(CallExpr* expr);
+    void generateMap(MapExpr* expr);
+    void generateReturn(ReturnStmt* stmt);
+    void generateFunction(size_t index);
+    void generateInlineCall(CallExpr* expr, FunctionStmt* callee);
+    void declareFunctions(BlockStmt* block);
+    bool isInlinable(FunctionStmt* fn);
+    void generateParallelFor(ParallelForStmt* stmt);
+    void checkParallelBody(ParallelForStmt* stmt);
+    Symbol findGlobalWrite(FunctionStmt* fn, std::vector<FunctionStmt*>& visiting);
+    // The variable holding the map that `node` changes, for `m[k] = v` and
+    // `delete(m, k)` (also through nested maps, as in `m[a][b] = v`);
+    // NO_SYMBOL for anything else
+    Symbol mapWriteTarget(ASTNode* node);
+    void generateSpawn(SpawnStmt* stmt);
+    void checkTaskBody(SpawnStmt* stmt);
+    
+    // Builtins compile to opcodes unless the program declares a function of
+    // the same name: `channel(capacity)`, `send(c, value)`, `recv(c)`,
+    // `readLine()`, `readAll(path)`, `lines(path)`, `has(map, key)`,
+    // `delete(map, key)` and `size(map)`. A send used as a statement leaves
+    // nothing to discard.
+    bool isBuiltinCall(CallExpr* call);
+    void generateBuiltin(CallExpr* call, bool statement);
     
     // Utility methods
     void emit(OpCode op);
     void emit(OpCode op, Value operand);
-    size_t getVariableIndex(const std::string& name);
+    size_t getVariableIndex(Symbol name);
+    Slot resolveVariable(Symbol name);
+    Slot declareVariable(Symbol name);
+    Slot allocateTemp(size_t n);
+    void emitLoad(Slot slot);
+    void emitStore(Slot slot);
+    size_t lookupFunction(const Token& name, size_t argCount);
     void enterScope();
     void exitScope();
 };
 
+// Lex, parse and generate a whole program
+BytecodeProgram compileSource(const std::string& source);
+
+// Number of nodes in the tree rooted at `node`
+size_t countNodes(ASTNode* node);
+
 #endif 
\ No newline at end of file
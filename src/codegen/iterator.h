@@ -0,0 +1,52 @@
+#ifndef ITERATOR_H
+#define ITERATOR_H
+
+#include "bytecode.h"
+#include "../runtime/input.h"
+#include <mutex>
+#include <string_view>
+
+// What a `for (var x in ...)` loop steps through (see OpCode::ITER)
+class Iterator : public Object {
+public:
+    const char* typeName() const override { return "iterator"; }
+    // Sets `value` to the next value; false once there are no more
+    virtual bool next(Value& value) = 0;
+};
+
+// The lines of a mapped file, as slices of it
+class FileLines : public Iterator {
+public:
+    explicit FileLines(ObjectRef file) : file(std::move(file)) {}
+
+    bool next(Value& value) override {
+        const InputBuffer* buffer = static_cast<const InputBuffer*>(file.get());
+        std::string_view line;
+        if (!nextLine(std::string_view(buffer->bytes(), buffer->size()), pos, line)) {
+            return false;
+        }
+        value = StringRef::slice(line, file);
+        return true;
+    }
+
+private:
+    ObjectRef file;
+    size_t pos = 0;
+};
+
+// The lines of standard input, shared with readLine()
+class InputLines : public Iterator {
+public:
+    bool next(Value& value) override {
+        StandardInput& input = standardInput();
+        std::lock_guard<std::mutex> lock(input.mutex);
+        StringRef line;
+        if (!input.reader.next(line)) {
+            return false;
+        }
+        value = std::move(line);
+        return true;
+    }
+};
+
+#endif
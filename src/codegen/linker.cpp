@@ -0,0 +1,165 @@
+#include "linker.h"
+#include <stdexcept>
+#include <unordered_map>
+
+BytecodeProgram link(const std::vector<const BytecodeUnit*>& units) {
+    BytecodeProgram program;
+    std::unordered_map<std::string, size_t> globalSlots;
+    std::unordered_map<std::string, size_t> functionSlots;
+    
+    // Assign program-wide function indices
+    for (const BytecodeUnit* unit : units) {
+        for (size_t i = 0; i < unit->definedFunctions; i++) {
+            const FunctionInfo& fn = unit->functions[i];
+            if (functionSlots.count(fn.name)) {
+                throw std::runtime_error("Function '" + fn.name + "' is already defined");
+            }
+            functionSlots[fn.name] = program.functions.size();
+            program.functions.push_back(fn);
+        }
+    }
+    
+    // Code offsets: top-level code first, function bodies after HALT
+    std::vector<size_t> mainBase, functionBase;
+    size_t offset = 0;
+    for (const BytecodeUnit* unit : units) {
+        mainBase.push_back(offset);
+        offset += unit->mainLength;
+    }
+    offset++;  // HALT
+    for (const BytecodeUnit* unit : units) {
+        functionBase.push_back(offset);
+        offset += unit->instructions.size() - unit->mainLength;
+    }
+    program.instructions.reserve(offset);
+    
+    // Globals are merged by name, numbered in order of first use. Each unit
+    // slot's name is looked up once; after that it maps by index.
+    std::vector<std::vector<int>> unitGlobals(units.size());
+    for (size_t u = 0; u < units.size(); u++) {
+        unitGlobals[u].assign(units[u]->globals.size(), -1);
+    }
+    auto globalSlot = [&](size_t u, int unitSlot) {
+        int& slot = unitGlobals[u][unitSlot];
+        if (slot < 0) {
+            const std::string& name = units[u]->globals[unitSlot];
+            auto it = globalSlots.find(name);
+            if (it == globalSlots.end()) {
+                it = globalSlots.emplace(name, globalSlots.size()).first;
+            }
+            slot = static_cast<int>(it->second);
+        }
+        return slot;
+    };
+    
+    // Program function index of every function a unit defines or imports
+    std::vector<std::vector<int>> unitFunctions(units.size());
+    auto functionSlot = [&](size_t u, size_t unitIndex) {
+        std::vector<int>& slots = unitFunctions[u];
+        if (slots.empty()) {
+            slots.assign(units[u]->functions.size(), -1);
+        }
+        int& slot = slots[unitIndex];
+        if (slot < 0) {
+            const std::string& name = units[u]->functions[unitIndex].name;
+            auto it = functionSlots.find(name);
+            if (it == functionSlots.end()) {
+                throw std::runtime_error("Undefined function '" + name + "'");
+            }
+            slot = static_cast<int>(it->second);
+        }
+        return slot;
+    };
+    
+    // Jumps never cross between top-level code and function bodies, so the
+    // part an instruction lives in decides how its target is rebased
+    auto codeOffset = [&](size_t u, size_t target, bool inMain) {
+        return inMain ? mainBase[u] + target : functionBase[u] + (target - units[u]->mainLength);
+    };
+    
+    auto relocate = [&](size_t u, const Instruction& instr, bool inMain) {
+        const BytecodeUnit* unit = units[u];
+        Instruction out = instr;
+        switch (instr.op) {
+            case OpCode::JMP:
+            case OpCode::JMP_IF_FALSE:
+            case OpCode::JMP_IF_TRUE:
+            case OpCode::JEQ:
+            case OpCode::JNE:
+            case OpCode::JLT:
+            case OpCode::JLE:
+            case OpCode::JGT:
+            case OpCode::JGE:
+            case OpCode::JEQ_INT:
+            case OpCode::JNE_INT:
+            case OpCode::JLT_INT:
+            case OpCode::JLE_INT:
+            case OpCode::JGT_INT:
+            case OpCode::JGE_INT:
+            case OpCode::ITER_NEXT:
+            case OpCode::SPAWN:
+                out.operand = static_cast<int>(codeOffset(u, std::get<int64_t>(instr.operand), inMain));
+                break;
+            case OpCode::LOAD:
+            case OpCode::STORE:
+                out.operand = globalSlot(u, std::get<int64_t>(instr.operand));
+                break;
+            case OpCode::PAR_FOR: {
+                ParallelLoopInfo loop = unit->parallelLoops[std::get<int64_t>(instr.operand)];
+                loop.bodyStart = codeOffset(u, loop.bodyStart, inMain);
+                loop.bodyEnd = codeOffset(u, loop.bodyEnd, inMain);
+                if (!loop.inductionLocal) {
+                    loop.inductionSlot = globalSlot(u, loop.inductionSlot);
+                }
+                for (auto& reduction : loop.reductions) {
+                    if (!reduction.local) {
+                        reduction.slot = globalSlot(u, reduction.slot);
+                    }
+                }
+                out.operand = static_cast<int>(program.parallelLoops.size());
+                program.parallelLoops.push_back(std::move(loop));
+                break;
+            }
+            case OpCode::LOOP_INC_JMP: {
+                CountedLoopInfo loop = unit->countedLoops[std::get<int64_t>(instr.operand)];
+                loop.bodyStart = codeOffset(u, loop.bodyStart, inMain);
+                if (!loop.counterLocal) {
+                    loop.counterSlot = globalSlot(u, loop.counterSlot);
+                }
+                if (loop.limitIsSlot && !loop.limitLocal) {
+                    loop.limitSlot = globalSlot(u, loop.limitSlot);
+                }
+                out.operand = static_cast<int>(program.countedLoops.size());
+                program.countedLoops.push_back(std::move(loop));
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL:
+                out.operand = functionSlot(u, std::get<int64_t>(instr.operand));
+                break;
+            default:
+                break;
+        }
+        program.instructions.push_back(std::move(out));
+    };
+    
+    for (size_t u = 0; u < units.size(); u++) {
+        for (size_t i = 0; i < units[u]->mainLength; i++) {
+            relocate(u, units[u]->instructions[i], true);
+        }
+    }
+    program.instructions.emplace_back(OpCode::HALT);
+    for (size_t u = 0; u < units.size(); u++) {
+        const BytecodeUnit* unit = units[u];
+        for (size_t i = unit->mainLength; i < unit->instructions.size(); i++) {
+            relocate(u, unit->instructions[i], false);
+        }
+        for (size_t i = 0; i < unit->definedFunctions; i++) {
+            FunctionInfo& fn = program.functions[functionSlots[unit->functions[i].name]];
+            fn.entry = functionBase[u] + (unit->functions[i].entry - unit->mainLength);
+        }
+    }
+    
+    program.globalCount = globalSlots.size();
+    return program;
+}
@@ -0,0 +1,33 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "bytecode.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A separately compiled piece of bytecode. Jump targets are relative to
+// the start of the unit, global slots index `globals` and function operands
+// index `functions`, so the unit can be placed anywhere in a program.
+//
+// Layout: top-level code in [0, mainLength), function bodies after it.
+struct BytecodeUnit {
+    std::vector<Instruction> instructions;
+    size_t mainLength = 0;
+    std::vector<std::string> globals;       // Unit slot -> global name
+    std::vector<FunctionInfo> functions;    // Defined functions first, then imports
+    size_t definedFunctions = 0;
+    std::vector<ParallelLoopInfo> parallelLoops;
+    std::vector<CountedLoopInfo> countedLoops;
+    // Imported functions whose definition influenced the generated code,
+    // with a hash of that definition (filled in by the caller)
+    std::vector<std::pair<std::string, uint64_t>> dependencies;
+};
+
+// Concatenates units into one program: all top-level code in unit order,
+// then HALT, then every function body. Globals are merged by name and
+// function calls are bound by name.
+BytecodeProgram link(const std::vector<const BytecodeUnit*>& units);
+
+#endif
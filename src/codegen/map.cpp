@@ -0,0 +1,348 @@
+#include "map.h"
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MAP_SSE2 1
+#endif
+
+namespace {
+
+const size_t GROUP = 16;
+
+// Control bytes: a full slot holds the low 7 bits of its key's hash, so
+// only empty and deleted slots have the high bit set
+const int8_t EMPTY = -128;
+const int8_t DELETED = -2;
+
+// Bit i of a mask stands for slot i of the group
+class Group {
+public:
+#ifdef MAP_SSE2
+    explicit Group(const int8_t* ctrl) : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+
+    uint32_t match(int8_t h2) const { return movemask(_mm_cmpeq_epi8(_mm_set1_epi8(h2), bytes)); }
+    uint32_t matchEmpty() const { return movemask(_mm_cmpeq_epi8(_mm_set1_epi8(EMPTY), bytes)); }
+    uint32_t matchFree() const { return movemask(bytes); }  // Empty or deleted
+
+private:
+    __m128i bytes;
+
+    static uint32_t movemask(__m128i v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+#else
+    explicit Group(const int8_t* ctrl) : ctrl(ctrl) {}
+
+    uint32_t match(int8_t h2) const { return matchWhere([h2](int8_t c) { return c == h2; }); }
+    uint32_t matchEmpty() const { return matchWhere([](int8_t c) { return c == EMPTY; }); }
+    uint32_t matchFree() const { return matchWhere([](int8_t c) { return c < 0; }); }
+
+private:
+    const int8_t* ctrl;
+
+    template <typename Test>
+    uint32_t matchWhere(Test test) const {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < GROUP; i++) {
+            bits |= static_cast<uint32_t>(test(ctrl[i])) << i;
+        }
+        return bits;
+    }
+#endif
+};
+
+// Spreads every input bit over the whole result (the murmur3 finalizer),
+// since the table uses both the low and the high bits
+uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t hashKey(const Value& key) {
+    if (const int64_t* number = std::get_if<int64_t>(&key)) {
+        return mix(static_cast<uint64_t>(*number));
+    }
+    if (const StringRef* text = std::get_if<StringRef>(&key)) {
+        return mix(text->hash());
+    }
+    if (const double* number = std::get_if<double>(&key)) {
+        uint64_t bits;
+        std::memcpy(&bits, number, sizeof(bits));
+        return mix(bits ^ 0x5bd1e9955bd1e995ULL);
+    }
+    return mix(std::get<bool>(key) ? 0x9e3779b97f4a7c15ULL : 0x7f4a7c159e3779b9ULL);
+}
+
+bool sameKey(const Value& a, const Value& b) {
+    const int64_t* x = std::get_if<int64_t>(&a);
+    const int64_t* y = std::get_if<int64_t>(&b);
+    if (x && y) {
+        return *x == *y;
+    }
+    return a == b;
+}
+
+bool isMap(const Value& value) {
+    const ObjectRef* object = std::get_if<ObjectRef>(&value);
+    return object && object->as<Map>();
+}
+
+// Smallest table that holds `count` keys within the maximum load of 7/8
+size_t capacityFor(size_t count) {
+    size_t capacity = GROUP;
+    while (capacity - capacity / 8 < count) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+}  // namespace
+
+struct Map::Table {
+    struct Slot {
+        Value key;
+        Value value;
+    };
+
+    std::atomic<uint32_t> refs{1};  // Maps sharing the table; see detach()
+    size_t capacity;                // A power of two, at least GROUP
+    size_t size = 0;
+    size_t growthLeft;              // Empty slots that may be filled before it grows
+    size_t nestedMaps = 0;          // Values that are maps
+    // capacity + GROUP - 1 bytes: the last GROUP - 1 repeat the first ones,
+    // so a group can be loaded starting at any slot
+    std::unique_ptr<int8_t[]> ctrl;
+    std::unique_ptr<Slot[]> slots;
+
+    explicit Table(size_t capacity)
+        : capacity(capacity), growthLeft(capacity - capacity / 8),
+          ctrl(new int8_t[capacity + GROUP - 1]), slots(new Slot[capacity]) {
+        std::memset(ctrl.get(), EMPTY, capacity + GROUP - 1);
+    }
+
+    // Same slots in the same places, so positions stay valid
+    Table(const Table& other)
+        : capacity(other.capacity), size(other.size), growthLeft(other.growthLeft),
+          nestedMaps(other.nestedMaps), ctrl(new int8_t[capacity + GROUP - 1]), slots(new Slot[capacity]) {
+        std::memcpy(ctrl.get(), other.ctrl.get(), capacity + GROUP - 1);
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] >= 0) {
+                slots[i] = other.slots[i];
+            }
+        }
+    }
+
+    void setCtrl(size_t i, int8_t value) {
+        ctrl[i] = value;
+        if (i < GROUP - 1) {
+            ctrl[capacity + i] = value;
+        }
+    }
+
+    // Groups are probed at triangular offsets from the hash's home slot,
+    // which visits every group of a power-of-two table. At most 7/8 of the
+    // slots are ever filled, so every probe ends at an empty slot.
+    size_t find(const Value& key, uint64_t hash) const {
+        size_t mask = capacity - 1;
+        size_t pos = static_cast<size_t>(hash >> 7) & mask;
+        int8_t h2 = static_cast<int8_t>(hash & 0x7f);
+        for (size_t step = GROUP;; step += GROUP) {
+            Group group(ctrl.get() + pos);
+            for (uint32_t bits = group.match(h2); bits; bits &= bits - 1) {
+                size_t i = (pos + static_cast<size_t>(__builtin_ctz(bits))) & mask;
+                if (sameKey(slots[i].key, key)) {
+                    return i;
+                }
+            }
+            if (group.matchEmpty()) {
+                return SIZE_MAX;
+            }
+            pos = (pos + step) & mask;
+        }
+    }
+
+    // First empty or deleted slot on the probe sequence of `hash`
+    size_t findFree(uint64_t hash) const {
+        size_t mask = capacity - 1;
+        size_t pos = static_cast<size_t>(hash >> 7) & mask;
+        for (size_t step = GROUP;; step += GROUP) {
+            if (uint32_t bits = Group(ctrl.get() + pos).matchFree()) {
+                return (pos + static_cast<size_t>(__builtin_ctz(bits))) & mask;
+            }
+            pos = (pos + step) & mask;
+        }
+    }
+
+    // Fills a free slot, which must be on the probe sequence of `hash`
+    void insert(size_t i, uint64_t hash, Value key, Value value) {
+        if (ctrl[i] == EMPTY) {
+            growthLeft--;
+        }
+        setCtrl(i, static_cast<int8_t>(hash & 0x7f));
+        nestedMaps += isMap(value);
+        slots[i].key = std::move(key);
+        slots[i].value = std::move(value);
+        size++;
+    }
+};
+
+void Map::release(Table* table) {
+    if (table->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete table;
+    }
+}
+
+Map::Map(size_t expected) : table(new Table(capacityFor(expected))) {}
+
+Map::~Map() {
+    release(table);
+}
+
+bool Map::normalizeKey(Value& key) {
+    if (const double* number = std::get_if<double>(&key)) {
+        if (std::isnan(*number)) {
+            return false;
+        }
+        // The range of int64_t, whose bounds are exact doubles
+        if (*number == std::trunc(*number) && *number >= -9223372036854775808.0 && *number < 9223372036854775808.0) {
+            key = static_cast<int64_t>(*number);
+        }
+        return true;
+    }
+    return !std::holds_alternative<ObjectRef>(key);
+}
+
+const Value* Map::find(const Value& key) const {
+    size_t i = table->find(key, hashKey(key));
+    return i == SIZE_MAX ? nullptr : &table->slots[i].value;
+}
+
+void Map::set(const Value& key, Value value) {
+    uint64_t hash = hashKey(key);
+    size_t i = table->find(key, hash);
+    detach();
+    if (i != SIZE_MAX) {
+        Value& slot = table->slots[i].value;
+        table->nestedMaps += isMap(value);
+        table->nestedMaps -= isMap(slot);
+        slot = std::move(value);
+        return;
+    }
+    i = table->findFree(hash);
+    if (table->ctrl[i] == EMPTY && table->growthLeft == 0) {
+        rehash();
+        i = table->findFree(hash);
+    }
+    // A slice would keep the whole buffer it points into alive
+    const StringRef* text = std::get_if<StringRef>(&key);
+    table->insert(i, hash, text && text->isSlice() ? Value(StringRef::make(text->view())) : key, std::move(value));
+    changes++;
+}
+
+bool Map::erase(const Value& key) {
+    size_t i = table->find(key, hashKey(key));
+    if (i == SIZE_MAX) {
+        return false;
+    }
+    detach();
+    Table::Slot& slot = table->slots[i];
+    table->nestedMaps -= isMap(slot.value);
+    table->setCtrl(i, DELETED);
+    slot.key = Value();
+    slot.value = Value();
+    table->size--;
+    changes++;
+    return true;
+}
+
+size_t Map::size() const {
+    return table->size;
+}
+
+bool Map::keyAt(size_t& position, Value& key) const {
+    for (; position < table->capacity; position++) {
+        if (table->ctrl[position] >= 0) {
+            key = table->slots[position].key;
+            return true;
+        }
+    }
+    return false;
+}
+
+// A table shared with a copy on another thread is only ever read; the first
+// change on either side copies it. Positions stay the same, so a for-in loop
+// over the map is not disturbed.
+void Map::detach() {
+    if (table->refs.load(std::memory_order_acquire) > 1) {
+        Table* own = new Table(*table);
+        release(table);
+        table = own;
+    }
+}
+
+// Doubles the table when it is more than 7/16 full; otherwise it is full of
+// deleted slots, and rebuilding it at the same size frees them
+void Map::rehash() {
+    size_t capacity = table->capacity;
+    if (table->size + 1 > capacity * 7 / 16) {
+        capacity *= 2;
+    }
+    Table* larger = new Table(capacity);
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->ctrl[i] >= 0) {
+            Table::Slot& slot = table->slots[i];
+            uint64_t hash = hashKey(slot.key);
+            larger->insert(larger->findFree(hash), hash, std::move(slot.key), std::move(slot.value));
+        }
+    }
+    release(table);
+    table = larger;
+}
+
+Value MapCopier::operator()(const Value& value) {
+    const ObjectRef* object = std::get_if<ObjectRef>(&value);
+    Map* map = object ? object->as<Map>() : nullptr;
+    if (!map) {
+        return value;
+    }
+    auto it = copies.find(map);
+    if (it != copies.end()) {
+        return it->second;
+    }
+    if (map->table->nestedMaps == 0) {
+        map->table->refs.fetch_add(1, std::memory_order_relaxed);
+        ObjectRef copy(new Map(map->table));
+        copies.emplace(map, copy);
+        return copy;
+    }
+    // The maps inside have to be copied too, so the table cannot be shared.
+    // The copy is registered first in case a map contains itself.
+    Map* copy = new Map(new Map::Table(*map->table));
+    ObjectRef ref(copy);
+    copies.emplace(map, ref);
+    Map::Table& table = *copy->table;
+    for (size_t i = 0; i < table.capacity; i++) {
+        if (table.ctrl[i] >= 0 && isMap(table.slots[i].value)) {
+            table.slots[i].value = (*this)(table.slots[i].value);
+        }
+    }
+    return ref;
+}
+
+bool MapKeys::next(Value& value) {
+    const Map* keys = static_cast<const Map*>(map.get());
+    if (keys->version() != version) {
+        throw std::runtime_error("Keys were added to or removed from a map during a for-in loop over it");
+    }
+    if (!keys->keyAt(position, value)) {
+        return false;
+    }
+    position++;
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "bytecode.h"
+#include "iterator.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// A hash map from numbers, strings and booleans to values (see
+// OpCode::MAP_NEW). The table is SwissTable-style open addressing: every
+// slot has a control byte holding 7 bits of its key's hash, or marking it
+// empty or deleted, and a lookup compares a group of 16 control bytes at
+// once so that only keys whose hash bits match are compared. Strings are
+// hashed from the hash they already carry, numbers from their bits. Keys
+// and values are stored in the slot array itself.
+//
+// Within a thread a map is shared by reference. Another thread gets a copy
+// (see MapCopier), which shares the table until either side changes it.
+class Map : public Object {
+public:
+    // Room for `expected` keys before the table grows
+    explicit Map(size_t expected = 0);
+    ~Map() override;
+    Map(const Map&) = delete;
+    Map& operator=(const Map&) = delete;
+
+    const char* typeName() const override { return "map"; }
+
+    // Turns `key` into the form keys are stored in: a double with an integer
+    // value becomes that integer, so `m[1]` and `m[1.0]` are the same entry.
+    // False if the value cannot be a key (an object, or NaN).
+    static bool normalizeKey(Value& key);
+
+    // These take normalized keys
+    const Value* find(const Value& key) const;
+    void set(const Value& key, Value value);
+    bool erase(const Value& key);
+    size_t size() const;
+
+    // Iteration in table order: the first key at or after `position`, whose
+    // position is left in `position`. False past the last key.
+    bool keyAt(size_t& position, Value& key) const;
+    // Changes whenever a key is added or removed
+    uint64_t version() const { return changes; }
+
+private:
+    friend class MapCopier;
+    struct Table;
+
+    Table* table;
+    uint64_t changes = 0;
+
+    explicit Map(Table* table) : table(table) {}
+    // Gives this map a table of its own before it changes
+    void detach();
+    // Makes room for one more key
+    void rehash();
+    static void release(Table* table);
+};
+
+// Copies values for another thread: every map in them, and every map in
+// those maps, is replaced by a copy. A map reached twice is copied once, so
+// the copies alias each other like the originals.
+class MapCopier {
+public:
+    Value operator()(const Value& value);
+
+private:
+    std::unordered_map<const Map*, ObjectRef> copies;
+};
+
+// The keys of a map, for `for (var k in m)`. Adding or removing keys while
+// the loop runs is an error; changing the values of existing keys is not.
+class MapKeys : public Iterator {
+public:
+    explicit MapKeys(ObjectRef map) : map(std::move(map)), version(static_cast<Map*>(this->map.get())->version()) {}
+
+    // Throws std::runtime_error if the map's keys changed
+    bool next(Value& value) override;
+
+private:
+    ObjectRef map;
+    uint64_t version;
+    size_t position = 0;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "partial_eval.h"
+#include "verifier.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+
+static bool isJump(OpCode op) {
+    return op == OpCode::JMP || op == OpCode::ITER_NEXT || isConditionalJump(op);
+}
+
+// Runs `prologue`, then `program` from `resumePc`. Keeps the main code
+// reachable from there and the functions it can call, and renumbers code
+// addresses, functions and loop tables to match.
+static BytecodeProgram buildResidual(const BytecodeProgram& program, size_t resumePc,
+                                     std::vector<Instruction> prologue) {
+    const auto& code = program.instructions;
+
+    // Each function body, and the main code, runs up to the next entry
+    std::vector<size_t> entries = {program.mainEntry};
+    for (const FunctionInfo& fn : program.functions) {
+        entries.push_back(fn.entry);
+    }
+    std::sort(entries.begin(), entries.end());
+    auto regionEnd = [&](size_t start) {
+        auto next = std::upper_bound(entries.begin(), entries.end(), start);
+        return next == entries.end() ? code.size() : *next;
+    };
+
+    std::vector<bool> keep(code.size(), false);
+    std::vector<bool> called(program.functions.size(), false);
+    std::vector<size_t> calls;
+    auto keepInstruction = [&](size_t pc) {
+        keep[pc] = true;
+        const Instruction& instr = code[pc];
+        if (instr.op == OpCode::CALL || instr.op == OpCode::TAIL_CALL) {
+            size_t f = indexOperand(instr);
+            if (!called[f]) {
+                called[f] = true;
+                calls.push_back(f);
+            }
+        }
+    };
+
+    // Main code reachable from the resume point. Parallel loop and task
+    // bodies are kept whole: their jumps stay inside them.
+    std::vector<size_t> worklist = {resumePc};
+    while (!worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+        if (keep[pc]) {
+            continue;
+        }
+        keepInstruction(pc);
+        const Instruction& instr = code[pc];
+        switch (instr.op) {
+            case OpCode::HALT:
+                break;
+            case OpCode::JMP:
+                worklist.push_back(indexOperand(instr));
+                break;
+            case OpCode::LOOP_INC_JMP:
+                worklist.push_back(program.countedLoops[indexOperand(instr)].bodyStart);
+                worklist.push_back(pc + 1);
+                break;
+            case OpCode::PAR_FOR: {
+                const ParallelLoopInfo& loop = program.parallelLoops[indexOperand(instr)];
+                for (size_t i = loop.bodyStart; i <= loop.bodyEnd; i++) {
+                    keepInstruction(i);
+                }
+                worklist.push_back(loop.bodyEnd + 1);
+                break;
+            }
+            case OpCode::SPAWN:
+                for (size_t i = pc + 1; i <= indexOperand(instr); i++) {
+                    keepInstruction(i);
+                }
+                worklist.push_back(indexOperand(instr) + 1);
+                break;
+            default:
+                if (isJump(instr.op)) {
+                    worklist.push_back(indexOperand(instr));
+                }
+                worklist.push_back(pc + 1);
+                break;
+        }
+    }
+
+    // Functions are kept whole; `calls` grows as their calls are found
+    for (size_t i = 0; i < calls.size(); i++) {
+        size_t entry = program.functions[calls[i]].entry;
+        for (size_t pc = entry; pc < regionEnd(entry); pc++) {
+            keepInstruction(pc);
+        }
+    }
+
+    // The prologue replaces the main code before the resume point, unless
+    // some of that code is still reachable
+    bool needsJump = false;
+    for (size_t pc = program.mainEntry; pc < resumePc; pc++) {
+        needsJump = needsJump || keep[pc];
+    }
+    if (needsJump) {
+        prologue.emplace_back(OpCode::JMP);
+    }
+
+    BytecodeProgram residual;
+    residual.globalCount = program.globalCount;
+    std::vector<size_t> newPc(code.size(), 0);
+    size_t next = 0;
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        if (pc == program.mainEntry) {
+            residual.mainEntry = next;
+            next += prologue.size();
+        }
+        if (keep[pc]) {
+            newPc[pc] = next++;
+        }
+    }
+    if (needsJump) {
+        prologue.back().operand = static_cast<int64_t>(newPc[resumePc]);
+    }
+
+    std::vector<size_t> newFunction(program.functions.size(), 0);
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        if (called[f]) {
+            newFunction[f] = residual.functions.size();
+            residual.functions.push_back(program.functions[f]);
+            residual.functions.back().entry = newPc[program.functions[f].entry];
+        }
+    }
+
+    residual.instructions.reserve(next);
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        if (pc == program.mainEntry) {
+            residual.instructions.insert(residual.instructions.end(), prologue.begin(), prologue.end());
+        }
+        if (!keep[pc]) {
+            continue;
+        }
+        Instruction out = code[pc];
+        switch (out.op) {
+            case OpCode::LOOP_INC_JMP: {
+                CountedLoopInfo loop = program.countedLoops[indexOperand(out)];
+                loop.bodyStart = newPc[loop.bodyStart];
+                out.operand = static_cast<int64_t>(residual.countedLoops.size());
+                residual.countedLoops.push_back(std::move(loop));
+                break;
+            }
+            case OpCode::PAR_FOR: {
+                ParallelLoopInfo loop = program.parallelLoops[indexOperand(out)];
+                loop.bodyStart = newPc[loop.bodyStart];
+                loop.bodyEnd = newPc[loop.bodyEnd];
+                out.operand = static_cast<int64_t>(residual.parallelLoops.size());
+                residual.parallelLoops.push_back(std::move(loop));
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL:
+                out.operand = static_cast<int64_t>(newFunction[indexOperand(out)]);
+                break;
+            default:
+                if (isJump(out.op) || out.op == OpCode::SPAWN) {
+                    out.operand = static_cast<int64_t>(newPc[indexOperand(out)]);
+                }
+                break;
+        }
+        residual.instructions.push_back(std::move(out));
+    }
+    return residual;
+}
+
+BytecodeProgram partialEvaluate(const BytecodeProgram& program, uint64_t fuel, uint64_t* evaluated) {
+    if (evaluated) {
+        *evaluated = 0;
+    }
+    std::ostringstream output;
+    std::ostringstream errors;
+    VirtualMachine vm(output, errors);
+    VirtualMachine::SafePoint stop;
+    try {
+        stop = vm.evaluate(program, fuel);
+        if (!stop.current && stop.executed > 0) {
+            // It ran past the last safe point: run again up to there. Programs
+            // take no input, so the second run takes the same path.
+            output.str("");
+            stop = vm.evaluate(program, stop.executed);
+        }
+    } catch (const std::exception&) {
+        return program;  // Verification failed; running it reports why
+    }
+    if (!stop.current || stop.executed == 0) {
+        return program;
+    }
+
+    std::vector<Instruction> prologue;
+    std::string text = output.str();
+    if (!text.empty()) {
+        text.pop_back();  // Every PRINT ends in a newline, which this one adds back
+        prologue.emplace_back(OpCode::PUSH, StringRef::make(text));
+        prologue.emplace_back(OpCode::PRINT);
+    }
+    // Nothing reads the globals once the program has finished
+    const std::vector<Value>& globals = vm.globals();
+    bool finished = program.instructions[stop.pc].op == OpCode::HALT;
+    for (size_t i = 0; i < globals.size() && !finished; i++) {
+        const int64_t* number = std::get_if<int64_t>(&globals[i]);
+        if (number && *number == 0) {
+            continue;  // The value every global starts with
+        }
+        prologue.emplace_back(OpCode::PUSH, globals[i]);
+        prologue.emplace_back(OpCode::STORE, static_cast<int64_t>(i));
+    }
+    if (evaluated) {
+        *evaluated = stop.executed;
+    }
+    return buildResidual(program, stop.pc, std::move(prologue));
+}
@@ -0,0 +1,22 @@
+#ifndef PARTIAL_EVAL_H
+#define PARTIAL_EVAL_H
+
+#include "bytecode.h"
+#include <cstdint>
+
+// Programs take no input, so whatever they compute can be computed while
+// compiling them. Runs `program` for at most `fuel` instructions and returns
+// a residual program with the same output: it prints everything printed so
+// far with one PRINT, stores the globals' values, and continues from the
+// last point where the globals were the whole state (top-level code with an
+// empty operand stack). Code that can no longer run is dropped, so a program
+// that finishes within the budget becomes a single PRINT.
+//
+// Evaluation stops before parallel loops and checkpoints, which only the
+// real run may perform, and before a runtime error, which the residual
+// program then reports with its own pc. A program that fails verification,
+// or that reaches no point worth resuming from, is returned unchanged.
+// `evaluated`, if given, receives the number of instructions folded away.
+BytecodeProgram partialEvaluate(const BytecodeProgram& program, uint64_t fuel, uint64_t* evaluated = nullptr);
+
+#endif
@@ -0,0 +1,315 @@
+#include "serializer.h"
+#include <cstring>
+#include <stdexcept>
+
+// Sanity limit for element counts read from a file
+static const uint32_t MAX_COUNT = 1u << 28;
+
+void BytecodeWriter::writeU8(uint8_t value) {
+    out.put(static_cast<char>(value));
+}
+
+void BytecodeWriter::writeU32(uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void BytecodeWriter::writeU64(uint64_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void BytecodeWriter::writeString(const std::string& value) {
+    writeU32(static_cast<uint32_t>(value.size()));
+    out.write(value.data(), value.size());
+}
+
+void BytecodeWriter::writeValue(const Value& value) {
+    writeU8(static_cast<uint8_t>(value.index()));
+    if (std::holds_alternative<int64_t>(value)) {
+        writeU64(static_cast<uint64_t>(std::get<int64_t>(value)));
+    } else if (std::holds_alternative<double>(value)) {
+        double d = std::get<double>(value);
+        out.write(reinterpret_cast<const char*>(&d), sizeof(d));
+    } else if (std::holds_alternative<bool>(value)) {
+        writeU8(std::get<bool>(value) ? 1 : 0);
+    } else if (std::holds_alternative<StringRef>(value)) {
+        writeString(std::get<StringRef>(value).str());
+    } else {
+        throw std::runtime_error("Objects cannot be written to bytecode");
+    }
+}
+
+void BytecodeWriter::writeInstruction(const Instruction& instr) {
+    writeU8(static_cast<uint8_t>(instr.op));
+    writeValue(instr.operand);
+}
+
+void BytecodeWriter::writeFunction(const FunctionInfo& fn) {
+    writeString(fn.name);
+    writeU64(fn.entry);
+    writeU32(static_cast<uint32_t>(fn.arity));
+    writeU32(static_cast<uint32_t>(fn.localCount));
+}
+
+void BytecodeWriter::writeParallelLoop(const ParallelLoopInfo& loop) {
+    writeU64(loop.bodyStart);
+    writeU64(loop.bodyEnd);
+    writeU8(loop.inductionLocal ? 1 : 0);
+    writeU32(static_cast<uint32_t>(loop.inductionSlot));
+    writeU8(loop.inclusive ? 1 : 0);
+    writeU32(static_cast<uint32_t>(loop.step));
+    writeU32(static_cast<uint32_t>(loop.reductions.size()));
+    for (const auto& reduction : loop.reductions) {
+        writeU8(static_cast<uint8_t>(reduction.kind));
+        writeU8(reduction.local ? 1 : 0);
+        writeU32(static_cast<uint32_t>(reduction.slot));
+    }
+}
+
+void BytecodeWriter::writeCountedLoop(const CountedLoopInfo& loop) {
+    writeU64(loop.bodyStart);
+    writeU8(loop.counterLocal ? 1 : 0);
+    writeU32(static_cast<uint32_t>(loop.counterSlot));
+    writeU8(static_cast<uint8_t>(loop.stepOp));
+    writeU64(static_cast<uint64_t>(loop.step));
+    writeU8(static_cast<uint8_t>(loop.compare));
+    writeU8(loop.limitIsSlot ? 1 : 0);
+    writeU8(loop.limitLocal ? 1 : 0);
+    writeU32(static_cast<uint32_t>(loop.limitSlot));
+    writeValue(loop.limit);
+}
+
+void BytecodeWriter::writeUnit(const BytecodeUnit& unit) {
+    writeU32(static_cast<uint32_t>(unit.instructions.size()));
+    for (const auto& instr : unit.instructions) {
+        writeInstruction(instr);
+    }
+    writeU64(unit.mainLength);
+    writeU32(static_cast<uint32_t>(unit.globals.size()));
+    for (const auto& name : unit.globals) {
+        writeString(name);
+    }
+    writeU32(static_cast<uint32_t>(unit.functions.size()));
+    for (const auto& fn : unit.functions) {
+        writeFunction(fn);
+    }
+    writeU64(unit.definedFunctions);
+    writeU32(static_cast<uint32_t>(unit.parallelLoops.size()));
+    for (const auto& loop : unit.parallelLoops) {
+        writeParallelLoop(loop);
+    }
+    writeU32(static_cast<uint32_t>(unit.countedLoops.size()));
+    for (const auto& loop : unit.countedLoops) {
+        writeCountedLoop(loop);
+    }
+    writeU32(static_cast<uint32_t>(unit.dependencies.size()));
+    for (const auto& dependency : unit.dependencies) {
+        writeString(dependency.first);
+        writeU64(dependency.second);
+    }
+}
+
+void BytecodeWriter::writeProgram(const BytecodeProgram& program) {
+    writeU32(static_cast<uint32_t>(program.instructions.size()));
+    for (const auto& instr : program.instructions) {
+        writeInstruction(instr);
+    }
+    writeU32(static_cast<uint32_t>(program.functions.size()));
+    for (const auto& fn : program.functions) {
+        writeFunction(fn);
+    }
+    writeU32(static_cast<uint32_t>(program.parallelLoops.size()));
+    for (const auto& loop : program.parallelLoops) {
+        writeParallelLoop(loop);
+    }
+    writeU32(static_cast<uint32_t>(program.countedLoops.size()));
+    for (const auto& loop : program.countedLoops) {
+        writeCountedLoop(loop);
+    }
+    writeU64(program.globalCount);
+    writeU64(program.mainEntry);
+}
+
+void BytecodeReader::readBytes(void* data, size_t size) {
+    if (!in) {
+        if (static_cast<size_t>(end - next) < size) {
+            throw std::runtime_error("Unexpected end of bytecode file");
+        }
+        std::memcpy(data, next, size);
+        next += size;
+        return;
+    }
+    if (!in->read(static_cast<char*>(data), size)) {
+        throw std::runtime_error("Unexpected end of bytecode file");
+    }
+}
+
+uint8_t BytecodeReader::readU8() {
+    uint8_t value;
+    readBytes(&value, sizeof(value));
+    return value;
+}
+
+uint32_t BytecodeReader::readU32() {
+    uint32_t value;
+    readBytes(&value, sizeof(value));
+    return value;
+}
+
+uint64_t BytecodeReader::readU64() {
+    uint64_t value;
+    readBytes(&value, sizeof(value));
+    return value;
+}
+
+std::string BytecodeReader::readString() {
+    uint32_t size = readU32();
+    if (size > MAX_COUNT) {
+        throw std::runtime_error("Corrupt bytecode file");
+    }
+    std::string value(size, '\0');
+    readBytes(&value[0], size);
+    return value;
+}
+
+Value BytecodeReader::readValue() {
+    switch (readU8()) {
+        case 0: return static_cast<int64_t>(readU64());
+        case 1: {
+            double d;
+            readBytes(&d, sizeof(d));
+            return d;
+        }
+        case 2: return readU8() != 0;
+        case 3: return StringRef::intern(readString());
+        default: throw std::runtime_error("Corrupt bytecode file");
+    }
+}
+
+Instruction BytecodeReader::readInstruction() {
+    uint8_t op = readU8();
+    if (op > static_cast<uint8_t>(OpCode::HALT)) {
+        throw std::runtime_error("Corrupt bytecode file");
+    }
+    return Instruction(static_cast<OpCode>(op), readValue());
+}
+
+FunctionInfo BytecodeReader::readFunction() {
+    FunctionInfo fn;
+    fn.name = readString();
+    fn.entry = readU64();
+    fn.arity = static_cast<int>(readU32());
+    fn.localCount = static_cast<int>(readU32());
+    return fn;
+}
+
+ParallelLoopInfo BytecodeReader::readParallelLoop() {
+    ParallelLoopInfo loop;
+    loop.bodyStart = readU64();
+    loop.bodyEnd = readU64();
+    loop.inductionLocal = readU8() != 0;
+    loop.inductionSlot = static_cast<int>(readU32());
+    loop.inclusive = readU8() != 0;
+    loop.step = static_cast<int>(readU32());
+    uint32_t count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        Reduction reduction;
+        uint8_t kind = readU8();
+        if (kind > static_cast<uint8_t>(ReductionKind::CONCAT)) throw std::runtime_error("Corrupt bytecode file");
+        reduction.kind = static_cast<ReductionKind>(kind);
+        reduction.local = readU8() != 0;
+        reduction.slot = static_cast<int>(readU32());
+        loop.reductions.push_back(reduction);
+    }
+    return loop;
+}
+
+CountedLoopInfo BytecodeReader::readCountedLoop() {
+    CountedLoopInfo loop;
+    loop.bodyStart = readU64();
+    loop.counterLocal = readU8() != 0;
+    loop.counterSlot = static_cast<int>(readU32());
+    loop.stepOp = static_cast<OpCode>(readU8());
+    loop.step = static_cast<int64_t>(readU64());
+    loop.compare = static_cast<OpCode>(readU8());
+    if ((loop.stepOp != OpCode::ADD && loop.stepOp != OpCode::SUB) ||
+        loop.compare < OpCode::CMP_EQ || loop.compare > OpCode::CMP_GE) {
+        throw std::runtime_error("Corrupt bytecode file");
+    }
+    loop.limitIsSlot = readU8() != 0;
+    loop.limitLocal = readU8() != 0;
+    loop.limitSlot = static_cast<int>(readU32());
+    loop.limit = readValue();
+    return loop;
+}
+
+BytecodeUnit BytecodeReader::readUnit() {
+    BytecodeUnit unit;
+    uint32_t count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    unit.instructions.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        unit.instructions.push_back(readInstruction());
+    }
+    unit.mainLength = readU64();
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        unit.globals.push_back(readString());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        unit.functions.push_back(readFunction());
+    }
+    unit.definedFunctions = readU64();
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        unit.parallelLoops.push_back(readParallelLoop());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        unit.countedLoops.push_back(readCountedLoop());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        std::string name = readString();
+        unit.dependencies.emplace_back(name, readU64());
+    }
+    if (unit.mainLength > unit.instructions.size() || unit.definedFunctions > unit.functions.size()) {
+        throw std::runtime_error("Corrupt bytecode file");
+    }
+    return unit;
+}
+
+BytecodeProgram BytecodeReader::readProgram() {
+    BytecodeProgram program;
+    uint32_t count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    program.instructions.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        program.instructions.push_back(readInstruction());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        program.functions.push_back(readFunction());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        program.parallelLoops.push_back(readParallelLoop());
+    }
+    count = readU32();
+    if (count > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    for (uint32_t i = 0; i < count; i++) {
+        program.countedLoops.push_back(readCountedLoop());
+    }
+    program.globalCount = readU64();
+    if (program.globalCount > MAX_COUNT) throw std::runtime_error("Corrupt bytecode file");
+    program.mainEntry = readU64();
+    return program;
+}
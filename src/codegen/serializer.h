@@ -0,0 +1,61 @@
+#ifndef SERIALIZER_H
+#define SERIALIZER_H
+
+#include "bytecode.h"
+#include "linker.h"
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Binary encoding of bytecode for on-disk caches. Integers are written in
+// host byte order; files are not meant to move between machines.
+class BytecodeWriter {
+public:
+    explicit BytecodeWriter(std::ostream& out) : out(out) {}
+    
+    void writeU8(uint8_t value);
+    void writeU32(uint32_t value);
+    void writeU64(uint64_t value);
+    void writeString(const std::string& value);
+    void writeValue(const Value& value);
+    void writeInstruction(const Instruction& instr);
+    void writeFunction(const FunctionInfo& fn);
+    void writeParallelLoop(const ParallelLoopInfo& loop);
+    void writeCountedLoop(const CountedLoopInfo& loop);
+    void writeUnit(const BytecodeUnit& unit);
+    void writeProgram(const BytecodeProgram& program);  // Without labels
+    
+private:
+    std::ostream& out;
+};
+
+// Reads what BytecodeWriter wrote; throws std::runtime_error on truncated
+// or malformed input.
+class BytecodeReader {
+public:
+    explicit BytecodeReader(std::istream& in) : in(&in) {}
+    // Reads `size` bytes at `data`, which must stay valid while reading. Much
+    // faster than a stream, since every field is a separate read.
+    BytecodeReader(const char* data, size_t size) : next(data), end(data + size) {}
+    
+    uint8_t readU8();
+    uint32_t readU32();
+    uint64_t readU64();
+    std::string readString();
+    Value readValue();
+    Instruction readInstruction();
+    FunctionInfo readFunction();
+    ParallelLoopInfo readParallelLoop();
+    CountedLoopInfo readCountedLoop();
+    BytecodeUnit readUnit();
+    BytecodeProgram readProgram();
+    
+private:
+    std::istream* in = nullptr;  // Null when reading from memory
+    const char* next = nullptr;
+    const char* end = nullptr;
+    void readBytes(void* data, size_t size);
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "tasks.h"
+#include "map.h"
+#include "../runtime/thread_pool.h"
+#include <algorithm>
+#include <functional>
+
+// Room a task has on top of its copy of the parent's frame and the deepest
+// expression of its body. Calls grow the stack as needed.
+static const size_t TASK_STACK_SLOTS = 64;
+
+bool Channel::send(Waiter* self, Value value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!receivers.empty()) {
+        Waiter* receiver = receivers.front();
+        receivers.pop_front();
+        receiver->value = std::move(value);
+        lock.unlock();
+        receiver->scheduler->wake(receiver);
+        return true;
+    }
+    if (buffer.size() < capacity) {
+        buffer.push_back(std::move(value));
+        return true;
+    }
+    senders.emplace_back(self, std::move(value));
+    return false;
+}
+
+bool Channel::receive(Waiter* self, Value& value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Waiter* sender = nullptr;
+    if (!buffer.empty()) {
+        value = std::move(buffer.front());
+        buffer.pop_front();
+        // The first waiting sender takes the room that was freed
+        if (!senders.empty()) {
+            sender = senders.front().first;
+            buffer.push_back(std::move(senders.front().second));
+            senders.pop_front();
+        }
+    } else if (!senders.empty()) {
+        sender = senders.front().first;
+        value = std::move(senders.front().second);
+        senders.pop_front();
+    } else {
+        receivers.push_back(self);
+        return false;
+    }
+    lock.unlock();
+    if (sender) {
+        sender->scheduler->wake(sender);
+    }
+    return true;
+}
+
+bool Channel::cancel(Waiter* waiter) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto receiver = std::find(receivers.begin(), receivers.end(), waiter);
+    if (receiver != receivers.end()) {
+        receivers.erase(receiver);
+        return true;
+    }
+    auto sender = std::find_if(senders.begin(), senders.end(), [&](const auto& s) { return s.first == waiter; });
+    if (sender != senders.end()) {
+        senders.erase(sender);
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::spawn(VirtualMachine& parent) {
+    if (stopping) {
+        return;
+    }
+    auto* task = new Task(parent.out, parent.err);
+    task->scheduler = this;
+    task->task = task;
+
+    VirtualMachine& vm = task->vm;
+    vm.currentProgram = parent.currentProgram;
+    vm.checked = parent.checked;
+    vm.fileInput = parent.fileInput;
+    vm.trace = parent.trace;
+    vm.profile = parent.profile;
+    vm.bounds = parent.bounds;
+    vm.scheduler = this;
+    vm.task = task;
+
+    // Private copies of the globals and of the enclosing frame, if any, as
+    // for a parallel loop chunk
+    MapCopier copy;
+    vm.variables.resize(parent.variables.size());
+    std::transform(parent.variables.begin(), parent.variables.end(), vm.variables.begin(), std::ref(copy));
+    size_t frameBase = parent.frames.empty() ? parent.sp : parent.frames.back().base;
+    auto depth = parent.bounds->taskDepth.find(parent.pc);
+    size_t bodyDepth = depth == parent.bounds->taskDepth.end() ? 0 : depth->second;
+    vm.stack.assign(parent.sp - frameBase + bodyDepth + TASK_STACK_SLOTS, Value());
+    std::transform(parent.stack.begin() + frameBase, parent.stack.begin() + parent.sp, vm.stack.begin(), std::ref(copy));
+    vm.sp = parent.sp - frameBase;
+    if (!parent.frames.empty()) {
+        vm.frames.push_back({0, 0});
+    }
+    vm.pc = parent.pc + 1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.insert(task);
+    }
+    active.fetch_add(1);
+    submit(task);
+}
+
+void Scheduler::submit(Task* task) {
+    task->state.store(Task::RUNNING, std::memory_order_relaxed);
+    // The pool job keeps the scheduler alive until it has returned
+    ThreadPool::shared().submit([self = shared_from_this(), task] { self->run(task); });
+}
+
+// Runs `task` on this pool thread until it finishes or parks
+void Scheduler::run(Task* task) {
+    for (;;) {
+        bool finished = true;
+        if (!stopping) {
+            try {
+                task->waitingOn = Value();
+                if (task->receiving) {
+                    task->receiving = false;
+                    task->vm.push(std::move(task->value));
+                }
+                task->vm.runMode();
+                finished = !task->parking;
+            } catch (const std::exception& e) {
+                fail(task->vm.pc, e.what());
+            }
+        }
+        if (finished) {
+            retire(task);
+            return;
+        }
+        task->parking = false;
+        if (task->state.exchange(Task::PARKED) != Task::WOKEN) {
+            release();  // Parked; its waker submits it again
+            return;
+        }
+        // Woken before it was done parking
+        task->state.store(Task::RUNNING, std::memory_order_relaxed);
+    }
+}
+
+void Scheduler::wake(Waiter* waiter) {
+    if (!waiter->task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        mainWoken = true;
+        changed.notify_all();
+        return;
+    }
+    if (waiter->task->state.exchange(Task::WOKEN) == Task::PARKED) {
+        active.fetch_add(1);
+        submit(waiter->task);
+    }
+}
+
+void Scheduler::retire(Task* task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.erase(task);
+    }
+    delete task;
+    release();
+}
+
+void Scheduler::release() {
+    if (active.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    }
+}
+
+void Scheduler::fail(size_t pc, const std::string& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failure.empty() && !stopping) {
+        failure = "Runtime error at PC " + std::to_string(pc) + ": " + message;
+    }
+    stopping = true;
+    changed.notify_all();
+}
+
+bool Scheduler::waitForMain(Channel& channel) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return mainWoken || active == 0 || !failure.empty(); });
+    if (!mainWoken) {
+        lock.unlock();
+        if (channel.cancel(&mainWaiter)) {
+            return false;
+        }
+        // Taken off the queue by a task that is waking it right now
+        lock.lock();
+        changed.wait(lock, [&] { return mainWoken; });
+    }
+    mainWoken = false;
+    return true;
+}
+
+void Scheduler::checkFailure() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!failure.empty()) {
+        throw TaskError(failure);
+    }
+}
+
+void Scheduler::waitIdle() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return active == 0; });
+    }
+    checkFailure();
+}
+
+void Scheduler::stop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+    changed.wait(lock, [&] { return active == 0; });
+
+    // Every task left is parked: take them off their channels, which may
+    // outlive this run, before freeing them
+    std::unordered_set<Task*> parked;
+    parked.swap(live);
+    lock.unlock();
+    for (Task* task : parked) {
+        if (const ObjectRef* channel = std::get_if<ObjectRef>(&task->waitingOn)) {
+            channel->as<Channel>()->cancel(task);
+        }
+    }
+    for (Task* task : parked) {
+        delete task;
+    }
+}
+
+bool Scheduler::hasTasks() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !live.empty();
+}
@@ -0,0 +1,125 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include "vm.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+// Tasks started by `spawn` and the channels they communicate over.
+//
+// Each task is a VirtualMachine of its own with a small stack, and tasks run
+// on the shared thread pool, many to a thread. A task whose channel operation
+// cannot complete is parked: its VM keeps its state and the pool thread moves
+// on to other work. Whoever later completes the operation hands over the
+// value and puts the task back on the pool. The main program runs on its own
+// thread and waits there instead.
+//
+// One Scheduler lives for one run of the main program. The run ends once no
+// task is left running; tasks still waiting on a channel are dropped.
+
+class Scheduler;
+struct Task;
+
+// Reported by the main program when a task stopped on a runtime error; the
+// message is the complete report
+struct TaskError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// A task, or the main program, queued on a channel
+struct Waiter {
+    Scheduler* scheduler = nullptr;
+    Task* task = nullptr;   // Null for the main program
+    Value value;            // What a waiting receiver was handed
+};
+
+// FIFO channel holding up to `capacity` values; with capacity 0 every send
+// waits for a receiver. Values are handed directly to a waiting receiver.
+class Channel : public Object {
+public:
+    explicit Channel(size_t capacity) : capacity(capacity) {}
+    const char* typeName() const override { return "channel"; }
+
+    // Both complete the operation and return true if they can. Otherwise
+    // `self` is queued and they return false; the scheduler wakes it once
+    // another side completes the operation, a receiver finding the value in
+    // self->value.
+    bool send(Waiter* self, Value value);
+    bool receive(Waiter* self, Value& value);
+    // Takes `waiter` off the queues; false if it was not queued
+    bool cancel(Waiter* waiter);
+
+private:
+    std::mutex mutex;
+    size_t capacity;
+    std::deque<Value> buffer;
+    std::deque<std::pair<Waiter*, Value>> senders;  // Waiting for room
+    std::deque<Waiter*> receivers;                  // Waiting for a value
+};
+
+struct Task : Waiter {
+    // Parking and waking race: whichever of the task's thread (setting
+    // PARKED) and the waker (setting WOKEN) comes second continues the task
+    enum State { RUNNING, PARKED, WOKEN };
+    std::atomic<int> state{RUNNING};
+    bool parking = false;    // The VM returned to wait on `waitingOn`
+    bool receiving = false;  // ... in RECV: `value` goes on its stack
+    Value waitingOn;         // Keeps the channel alive while parked
+    VirtualMachine vm;
+
+    Task(std::ostream& out, std::ostream& err) : vm(out, err) {}
+};
+
+class Scheduler : public std::enable_shared_from_this<Scheduler> {
+public:
+    Scheduler() { mainWaiter.scheduler = this; }
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Held while printing, so lines from different tasks do not mix
+    std::mutex output;
+    Waiter mainWaiter;
+
+    // Starts a task running the body of the SPAWN at `parent.pc`, with
+    // copies of the parent's globals and current frame
+    void spawn(VirtualMachine& parent);
+    // Continues a waiter whose channel operation another side completed
+    void wake(Waiter* waiter);
+
+    // For the main program, queued in `channel`: waits to be woken. Returns
+    // false, with the main program taken off the queue, if it never will be
+    // because a task failed or every task is waiting too.
+    bool waitForMain(Channel& channel);
+    // Throws TaskError if a task stopped on a runtime error
+    void checkFailure();
+    // Waits until no task is running, then checks for failures
+    void waitIdle();
+    // Lets no task start or continue, waits until none runs and drops the
+    // parked ones. The scheduler is done after this.
+    void stop();
+    // Whether any task has not finished, running or not
+    bool hasTasks();
+
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<size_t> active{0};    // Tasks running or queued on the pool
+    std::atomic<bool> stopping{false};
+    bool mainWoken = false;
+    std::string failure;              // Report of the first task that failed
+    std::unordered_set<Task*> live;   // Tasks not finished
+
+    void submit(Task* task);
+    void run(Task* task);
+    void retire(Task* task);
+    void release();
+    void fail(size_t pc, const std::string& message);
+};
+
+#endif
@@ -0,0 +1,429 @@
+#include "verifier.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// A contiguous piece of code that is entered at one point and keeps its own
+// stack depth: the main program, a function body, a parallel loop body or a
+// task body
+struct Region {
+    size_t begin;
+    size_t end;              // One past the last instruction
+    size_t entry;
+    bool inFunction;         // Local slots are available
+    size_t localCount;
+    bool parallelBody;       // Ends in PAR_END instead of HALT/RET
+    bool taskBody;           // Ends in TASK_END
+};
+
+class Verifier {
+public:
+    explicit Verifier(const BytecodeProgram& program) : program(program) {}
+
+    StackBounds run(const StackBounds* known) {
+        const auto& code = program.instructions;
+        bounds.functionDepth.assign(program.functions.size(), 0);
+        bounds.loopDepth.assign(program.parallelLoops.size(), 0);
+        size_t knownFunctions = 0;
+        if (known) {
+            knownFunctions = std::min(known->functionDepth.size(), program.functions.size());
+            std::copy_n(known->loopDepth.begin(), std::min(known->loopDepth.size(), bounds.loopDepth.size()),
+                        bounds.loopDepth.begin());
+            bounds.taskDepth = known->taskDepth;
+        }
+
+        // Each function body, and the main code, runs up to the next entry
+        if (program.mainEntry >= code.size()) {
+            fail(program.mainEntry, "main code is out of range");
+        }
+        std::vector<size_t> entries = {program.mainEntry};
+        for (size_t f = 0; f < program.functions.size(); f++) {
+            const FunctionInfo& fn = program.functions[f];
+            if (fn.entry >= code.size()) {
+                fail(fn.entry, "entry of function '" + fn.name + "' is out of range");
+            }
+            if (fn.arity < 0 || fn.localCount < fn.arity) {
+                fail(fn.entry, "function '" + fn.name + "' has fewer slots than parameters");
+            }
+            entries.push_back(fn.entry);
+        }
+        std::sort(entries.begin(), entries.end());
+        auto regionEnd = [&](size_t start) {
+            auto next = std::upper_bound(entries.begin(), entries.end(), start);
+            return next == entries.end() ? code.size() : *next;
+        };
+
+        if (std::adjacent_find(entries.begin(), entries.end()) != entries.end()) {
+            fail(program.mainEntry, "two code regions share an entry");
+        }
+        bounds.mainDepth = verifyRegion({program.mainEntry, regionEnd(program.mainEntry), program.mainEntry,
+                                         false, 0, false, false});
+
+        for (size_t f = 0; f < program.functions.size(); f++) {
+            const FunctionInfo& fn = program.functions[f];
+            if (f < knownFunctions) {
+                bounds.functionDepth[f] = known->functionDepth[f];
+                continue;
+            }
+            bounds.functionDepth[f] = verifyRegion({fn.entry, regionEnd(fn.entry), fn.entry, true,
+                                                    static_cast<size_t>(fn.localCount), false, false});
+        }
+        return bounds;
+    }
+
+private:
+    const BytecodeProgram& program;
+    StackBounds bounds;
+
+    [[noreturn]] static void fail(size_t pc, const std::string& message) {
+        throw std::runtime_error("Bytecode verification failed at PC " + std::to_string(pc) + ": " + message);
+    }
+
+    // Walks every path through the region; returns its maximum stack depth
+    size_t verifyRegion(const Region& region) {
+        const auto& code = program.instructions;
+        std::vector<long> depthAt(region.end - region.begin, -1);
+        std::vector<std::pair<size_t, size_t>> worklist = {{region.entry, 0}};
+        size_t maxDepth = 0;
+
+        auto reach = [&](size_t from, size_t target, size_t depth) {
+            if (target < region.begin || target >= region.end) {
+                fail(from, "control leaves its function or loop body (target " + std::to_string(target) + ")");
+            }
+            long& seen = depthAt[target - region.begin];
+            if (seen < 0) {
+                seen = static_cast<long>(depth);
+                worklist.emplace_back(target, depth);
+            } else if (seen != static_cast<long>(depth)) {
+                fail(target, "stack depth " + std::to_string(depth) + " differs from " +
+                             std::to_string(seen) + " on another path");
+            }
+        };
+        depthAt[region.entry - region.begin] = 0;
+
+        while (!worklist.empty()) {
+            auto [pc, depth] = worklist.back();
+            worklist.pop_back();
+            const Instruction& instr = code[pc];
+
+            if (instr.op > OpCode::HALT) {
+                fail(pc, "unknown opcode");
+            }
+            if (hasIndexOperand(instr.op)) {
+                const int64_t* operand = std::get_if<int64_t>(&instr.operand);
+                if (!operand || *operand < 0) {
+                    fail(pc, "operand must be a non-negative integer");
+                }
+            }
+            checkOperand(region, pc, instr);
+
+            StackEffect effect = stackEffect(instr, program);
+            if (depth < effect.pops) {
+                fail(pc, "stack underflow");
+            }
+            size_t after = depth - effect.pops + effect.pushes;
+            maxDepth = std::max(maxDepth, after);
+
+            if (isConditionalJump(instr.op)) {
+                reach(pc, indexOperand(instr), after);
+                reach(pc, pc + 1, after);
+                continue;
+            }
+            switch (instr.op) {
+                case OpCode::JMP:
+                    reach(pc, indexOperand(instr), after);
+                    break;
+                case OpCode::LOOP_INC_JMP:
+                    reach(pc, program.countedLoops[indexOperand(instr)].bodyStart, after);
+                    reach(pc, pc + 1, after);
+                    break;
+                case OpCode::ITER_NEXT:
+                    reach(pc, indexOperand(instr), after);
+                    reach(pc, pc + 1, after);
+                    break;
+                case OpCode::TAIL_CALL:
+                    if (depth != effect.pops) {
+                        fail(pc, "tail call with " + std::to_string(depth - effect.pops) + " extra values on the stack");
+                    }
+                    break;
+                case OpCode::RET:
+                    if (depth != 1) {
+                        fail(pc, "return with " + std::to_string(depth) + " values on the stack");
+                    }
+                    break;
+                case OpCode::PAR_END:
+                    if (depth != 0) {
+                        fail(pc, "loop body leaves " + std::to_string(depth) + " values on the stack");
+                    }
+                    break;
+                case OpCode::TASK_END:
+                    if (depth != 0) {
+                        fail(pc, "task body leaves " + std::to_string(depth) + " values on the stack");
+                    }
+                    break;
+                case OpCode::SNAPSHOT:
+                    if (depth != 0) {
+                        fail(pc, "checkpoint with " + std::to_string(depth) + " values on the stack");
+                    }
+                    reach(pc, pc + 1, after);
+                    break;
+                case OpCode::HALT:
+                    if (depth != 0) {
+                        fail(pc, "program ends with " + std::to_string(depth) + " values on the stack");
+                    }
+                    break;
+                case OpCode::PAR_FOR: {
+                    size_t index = indexOperand(instr);
+                    const ParallelLoopInfo& loop = program.parallelLoops[index];
+                    bounds.loopDepth[index] = verifyRegion({loop.bodyStart, loop.bodyEnd + 1, loop.bodyStart,
+                                                            region.inFunction, region.localCount, true, false});
+                    reach(pc, loop.bodyEnd + 1, after);
+                    break;
+                }
+                case OpCode::SPAWN: {
+                    size_t end = indexOperand(instr);
+                    bounds.taskDepth[pc] = verifyRegion({pc + 1, end + 1, pc + 1, region.inFunction,
+                                                         region.localCount, false, true});
+                    reach(pc, end + 1, after);
+                    break;
+                }
+                default:
+                    reach(pc, pc + 1, after);
+                    break;
+            }
+        }
+        return maxDepth;
+    }
+
+    // Range checks for index operands and opcodes that only fit some regions
+    void checkOperand(const Region& region, size_t pc, const Instruction& instr) {
+        if (isConditionalJump(instr.op)) {
+            if (indexOperand(instr) >= program.instructions.size()) {
+                fail(pc, "jump target out of range");
+            }
+            return;
+        }
+        switch (instr.op) {
+            case OpCode::LOAD:
+            case OpCode::STORE:
+                checkSlot(region, pc, false, indexOperand(instr));
+                break;
+            case OpCode::LOAD_LOCAL:
+            case OpCode::STORE_LOCAL:
+                checkSlot(region, pc, true, indexOperand(instr));
+                break;
+            case OpCode::JMP:
+            case OpCode::ITER_NEXT:
+                if (indexOperand(instr) >= program.instructions.size()) {
+                    fail(pc, "jump target out of range");
+                }
+                break;
+            case OpCode::LOOP_INC_JMP: {
+                if (indexOperand(instr) >= program.countedLoops.size()) {
+                    fail(pc, "unknown counted loop");
+                }
+                const CountedLoopInfo& loop = program.countedLoops[indexOperand(instr)];
+                if ((loop.stepOp != OpCode::ADD && loop.stepOp != OpCode::SUB) ||
+                    loop.compare < OpCode::CMP_EQ || loop.compare > OpCode::CMP_GE) {
+                    fail(pc, "malformed counted loop");
+                }
+                checkSlot(region, pc, loop.counterLocal, loop.counterSlot);
+                if (loop.limitIsSlot) {
+                    checkSlot(region, pc, loop.limitLocal, loop.limitSlot);
+                } else if (std::holds_alternative<StringRef>(loop.limit)) {
+                    fail(pc, "counted loop limit must be a number");
+                }
+                break;
+            }
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL:
+                if (indexOperand(instr) >= program.functions.size()) {
+                    fail(pc, "call to an unknown function");
+                }
+                if (instr.op == OpCode::TAIL_CALL && (!region.inFunction || region.parallelBody || region.taskBody)) {
+                    fail(pc, "tail call outside of a function");
+                }
+                break;
+            case OpCode::RET:
+                if (!region.inFunction || region.parallelBody || region.taskBody) {
+                    fail(pc, "return outside of a function");
+                }
+                break;
+            case OpCode::PAR_FOR: {
+                if (indexOperand(instr) >= program.parallelLoops.size()) {
+                    fail(pc, "unknown parallel loop");
+                }
+                const ParallelLoopInfo& loop = program.parallelLoops[indexOperand(instr)];
+                if (loop.bodyStart != pc + 1 || loop.bodyEnd < loop.bodyStart || loop.bodyEnd >= region.end ||
+                    program.instructions[loop.bodyEnd].op != OpCode::PAR_END) {
+                    fail(pc, "malformed parallel loop body");
+                }
+                if (loop.step <= 0) {
+                    fail(pc, "parallel loop step must be positive");
+                }
+                checkSlot(region, pc, loop.inductionLocal, loop.inductionSlot);
+                for (const auto& reduction : loop.reductions) {
+                    checkSlot(region, pc, reduction.local, reduction.slot);
+                }
+                break;
+            }
+            case OpCode::PAR_END:
+                if (!region.parallelBody) {
+                    fail(pc, "PAR_END outside of a parallel loop");
+                }
+                break;
+            case OpCode::SPAWN: {
+                size_t end = indexOperand(instr);
+                if (end <= pc || end >= region.end || program.instructions[end].op != OpCode::TASK_END) {
+                    fail(pc, "malformed task body");
+                }
+                break;
+            }
+            case OpCode::TASK_END:
+                if (!region.taskBody) {
+                    fail(pc, "TASK_END outside of a task");
+                }
+                break;
+            case OpCode::SNAPSHOT:
+            case OpCode::HALT:
+                if (region.inFunction || region.parallelBody || region.taskBody) {
+                    fail(pc, std::string(instr.op == OpCode::HALT ? "HALT" : "SNAPSHOT") +
+                             " inside a function, loop or task body");
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void checkSlot(const Region& region, size_t pc, bool local, long long index) {
+        if (local && !region.inFunction) {
+            fail(pc, "local variable used outside of a function");
+        }
+        size_t limit = local ? region.localCount : program.globalCount;
+        if (index < 0 || static_cast<size_t>(index) >= limit) {
+            fail(pc, std::string(local ? "local" : "global") + " slot " + std::to_string(index) + " out of range");
+        }
+    }
+};
+
+} // namespace
+
+bool hasIndexOperand(OpCode op) {
+    switch (op) {
+        case OpCode::LOAD:
+        case OpCode::STORE:
+        case OpCode::LOAD_LOCAL:
+        case OpCode::STORE_LOCAL:
+        case OpCode::JMP:
+        case OpCode::JMP_IF_FALSE:
+        case OpCode::JMP_IF_TRUE:
+        case OpCode::JEQ:
+        case OpCode::JNE:
+        case OpCode::JLT:
+        case OpCode::JLE:
+        case OpCode::JGT:
+        case OpCode::JGE:
+        case OpCode::JEQ_INT:
+        case OpCode::JNE_INT:
+        case OpCode::JLT_INT:
+        case OpCode::JLE_INT:
+        case OpCode::JGT_INT:
+        case OpCode::JGE_INT:
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL:
+        case OpCode::PAR_FOR:
+        case OpCode::LOOP_INC_JMP:
+        case OpCode::ITER_NEXT:
+        case OpCode::SPAWN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+StackEffect stackEffect(const Instruction& instr, const BytecodeProgram& program) {
+    switch (instr.op) {
+        case OpCode::PUSH:
+        case OpCode::LOAD:
+        case OpCode::LOAD_LOCAL:
+            return {0, 1};
+        case OpCode::POP:
+        case OpCode::STORE:
+        case OpCode::STORE_LOCAL:
+        case OpCode::JMP_IF_FALSE:
+        case OpCode::JMP_IF_TRUE:
+        case OpCode::PRINT:
+        case OpCode::RET:
+            return {1, 0};
+        case OpCode::CHAN_NEW:
+        case OpCode::RECV:
+        case OpCode::ITER:
+        case OpCode::ITER_NEXT:
+        case OpCode::READ_ALL:
+        case OpCode::LINES:
+            return {1, 1};
+        case OpCode::READ_LINE:
+        case OpCode::MAP_NEW:
+            return {0, 1};
+        case OpCode::MAP_SIZE:
+            return {1, 1};
+        case OpCode::INDEX:
+        case OpCode::MAP_HAS:
+        case OpCode::MAP_DELETE:
+            return {2, 1};
+        case OpCode::MAP_INSERT:  // The map stays
+        case OpCode::INDEX_SET:
+            return {3, 1};
+        case OpCode::SEND:
+            return {2, 0};
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::DIV:
+        case OpCode::ADD_INT:
+        case OpCode::SUB_INT:
+        case OpCode::MUL_INT:
+        case OpCode::CMP_EQ:
+        case OpCode::CMP_NE:
+        case OpCode::CMP_LT:
+        case OpCode::CMP_LE:
+        case OpCode::CMP_GT:
+        case OpCode::CMP_GE:
+            return {2, 1};
+        case OpCode::JEQ:
+        case OpCode::JNE:
+        case OpCode::JLT:
+        case OpCode::JLE:
+        case OpCode::JGT:
+        case OpCode::JGE:
+        case OpCode::JEQ_INT:
+        case OpCode::JNE_INT:
+        case OpCode::JLT_INT:
+        case OpCode::JLE_INT:
+        case OpCode::JGT_INT:
+        case OpCode::JGE_INT:
+            return {2, 0};
+        case OpCode::CALL:
+            return {static_cast<size_t>(program.functions[indexOperand(instr)].arity), 1};
+        case OpCode::TAIL_CALL:
+            return {static_cast<size_t>(program.functions[indexOperand(instr)].arity), 0};
+        case OpCode::PAR_FOR:
+            return {2, 0};
+        case OpCode::JMP:
+        case OpCode::LOOP_INC_JMP:
+        case OpCode::PAR_END:
+        case OpCode::SPAWN:
+        case OpCode::TASK_END:
+        case OpCode::SNAPSHOT:
+        case OpCode::HALT:
+            return {0, 0};
+    }
+    return {0, 0};
+}
+
+StackBounds verify(const BytecodeProgram& program, const StackBounds* known) {
+    return Verifier(program).run(known);
+}
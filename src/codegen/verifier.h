@@ -0,0 +1,48 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "bytecode.h"
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// Operand stack requirements proven by the verifier. Depths count operand
+// values only; a function frame's locals sit below them.
+struct StackBounds {
+    size_t mainDepth = 0;
+    std::vector<size_t> functionDepth;  // Indexed like BytecodeProgram::functions
+    std::vector<size_t> loopDepth;      // Indexed like BytecodeProgram::parallelLoops
+    std::unordered_map<size_t, size_t> taskDepth;  // By the pc of the task's SPAWN
+};
+
+// Values one instruction consumes from and leaves on the operand stack
+struct StackEffect {
+    size_t pops;
+    size_t pushes;
+};
+
+// Whether the opcode's operand is an index: a variable slot, jump target,
+// function, parallel loop or task end
+bool hasIndexOperand(OpCode op);
+
+// The operand of an instruction already known to carry an index
+inline size_t indexOperand(const Instruction& instr) {
+    return static_cast<size_t>(*std::get_if<int64_t>(&instr.operand));
+}
+
+// Stack effect of `instr`; CALL/TAIL_CALL operands must be valid indices
+StackEffect stackEffect(const Instruction& instr, const BytecodeProgram& program);
+
+// Checks that every reachable instruction has a well-formed operand, that the
+// stack depth is the same on every path to it and never underflows, that
+// jumps stay inside their function, loop or task body, and that each code
+// region ends in HALT, RET, PAR_END or TASK_END with a balanced stack.
+// SNAPSHOT may only appear in the main code, with an empty operand stack.
+// Throws std::runtime_error describing the first problem.
+//
+// With `known`, the bounds of an earlier version of the program, functions
+// that already existed then are assumed unchanged and not checked again, as
+// are their parallel loops and tasks. The main code is always checked.
+StackBounds verify(const BytecodeProgram& program, const StackBounds* known = nullptr);
+
+#endif
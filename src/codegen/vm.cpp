@@ -1,116 +1,451 @@
 #include "vm.h"
+#include "iterator.h"
+#include "map.h"
+#include "tasks.h"
+#include "../runtime/number_format.h"
+#include "../runtime/thread_pool.h"
+#include "../snapshot/snapshot.h"
+#include "../trace/trace.h"
+#include "../profile/profile.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <variant>
 
-VirtualMachine::VirtualMachine() : pc(0) {}
+// The main program reserves frames up front so that ordinary calls never
+// allocate. Parallel loop workers get a smaller stack on top of the frame
+// they copy, and tasks a smaller one still (see tasks.cpp).
+static const size_t WORKER_STACK_SLOTS = 1 << 14;
+static const size_t INITIAL_FRAME_COUNT = 256;
 
-void VirtualMachine::execute(const BytecodeProgram& program) {
-    stack.clear();
-    variables.clear();
-    variables.resize(10);  // Pre-allocate space for variables
-    pc = 0;
-    currentProgram = program;  // Store the program
-    
-    while (pc < currentProgram.instructions.size()) {
-        const auto& instr = currentProgram.instructions[pc];
-        bool shouldIncrementPc = true;  // By default, increment pc
-        
+// Parallel loops are cut into this many chunks per pool thread so that
+// uneven iterations can be balanced by work stealing
+static const size_t CHUNKS_PER_THREAD = 4;
+
+VirtualMachine::VirtualMachine(std::ostream& out, std::ostream& err) : out(out), err(err), pc(0) {}
+
+bool VirtualMachine::execute(const BytecodeProgram& program) {
+    return start(program, program.mainEntry, nullptr);
+}
+
+bool VirtualMachine::executeNext(const BytecodeProgram& program) {
+    return start(program, program.mainEntry, nullptr, true);
+}
+
+bool VirtualMachine::resume(const Snapshot& snapshot) {
+    const BytecodeProgram& program = snapshot.program();
+    size_t resumePc = snapshot.resumePc();
+    // Snapshots are only taken at checkpoints, which the verifier places in
+    // top-level code with an empty stack
+    if (resumePc == 0 || resumePc >= program.instructions.size() ||
+        program.instructions[resumePc - 1].op != OpCode::SNAPSHOT ||
+        snapshot.globals().size() != program.globalCount) {
+        err << "Snapshot does not resume at a checkpoint" << std::endl;
+        return false;
+    }
+    return start(program, resumePc, &snapshot.globals());
+}
+
+bool VirtualMachine::start(const BytecodeProgram& program, size_t startPc, const std::vector<Value>* globals,
+                           bool extend) {
+    if (checked) {
+        auto unchecked = std::make_shared<StackBounds>();
+        unchecked->functionDepth.assign(program.functions.size(), 0);
+        unchecked->loopDepth.assign(program.parallelLoops.size(), 0);
+        bounds = std::move(unchecked);
+    } else {
         try {
-            // Execute instruction
-            switch (instr.op) {
-                case OpCode::PUSH:
-                    handlePush(instr);
-                    break;
-                case OpCode::POP:
-                    handlePop();
-                    break;
-                case OpCode::STORE:
-                    handleStore(instr);
-                    break;
-                case OpCode::LOAD:
-                    handleLoad(instr);
-                    break;
-                case OpCode::ADD:
-                    handleAdd();
-                    break;
-                case OpCode::SUB:
-                    handleSub();
-                    break;
-                case OpCode::MUL:
-                    handleMul();
-                    break;
-                case OpCode::DIV:
-                    handleDiv();
-                    break;
-                case OpCode::CMP_GT:
-                case OpCode::CMP_LT:
-                case OpCode::CMP_EQ:
-                case OpCode::CMP_NE:
-                case OpCode::CMP_LE:
-                case OpCode::CMP_GE:
-                    handleCmp(instr.op);
-                    break;
-                case OpCode::JMP:
-                    handleJmp(instr);
-                    shouldIncrementPc = false;  // pc is set in handleJmp
-                    break;
-                case OpCode::JMP_IF_FALSE:
-                    shouldIncrementPc = !handleJmpIfFalse();  // Only increment if we didn't jump
-                    break;
-                case OpCode::PRINT:
-                    handlePrint();
-                    break;
-                case OpCode::HALT:
-                    handleHalt();
-                    return;  // Exit the method
-            }
-            
-            if (shouldIncrementPc) {
-                pc++;
-            }
-            
+            bounds = std::make_shared<StackBounds>(verify(program, extend ? bounds.get() : nullptr));
         } catch (const std::exception& e) {
-            std::cerr << "Runtime error at PC " << pc << ": " << e.what() << std::endl;
-            return;
+            err << e.what() << std::endl;
+            return false;
         }
     }
+    
+    size_t stackSize = std::max(STACK_SLOTS, bounds->mainDepth);
+    if (stack.size() < stackSize) {
+        stack.assign(stackSize, Value());
+    }
+    sp = 0;
+    frames.clear();
+    frames.reserve(INITIAL_FRAME_COUNT);
+    if (extend) {
+        variables.resize(program.globalCount);
+    } else if (globals) {
+        variables = *globals;
+    } else {
+        variables.assign(program.globalCount, Value());
+    }
+    pc = startPc;
+    currentProgram = &program;  // Store the program
+    
+    try {
+        runMode();
+        if (scheduler) {
+            scheduler->waitIdle();
+        }
+    } catch (const TaskError& e) {
+        stopTasks();
+        err << e.what() << std::endl;
+        return false;
+    } catch (const std::exception& e) {
+        stopTasks();
+        err << "Runtime error at PC " << pc << ": " << e.what() << std::endl;
+        return false;
+    }
+    stopTasks();
+    return true;
 }
 
-void VirtualMachine::push(Value value) {
-    stack.push_back(value);
+VirtualMachine::SafePoint VirtualMachine::evaluate(const BytecodeProgram& program, uint64_t limit) {
+    bounds = std::make_shared<StackBounds>(verify(program));
+    size_t stackSize = std::max(STACK_SLOTS, bounds->mainDepth);
+    if (stack.size() < stackSize) {
+        stack.assign(stackSize, Value());
+    }
+    sp = 0;
+    frames.clear();
+    frames.reserve(INITIAL_FRAME_COUNT);
+    variables.assign(program.globalCount, Value());
+    pc = program.mainEntry;
+    currentProgram = &program;
+    budget = limit;
+    executed = 0;
+    safePoint = SafePoint();
+    try {
+        run<false, false, true>();
+    } catch (const std::exception&) {
+        return safePoint;
+    }
+    safePoint.current = safePoint.executed == executed;
+    return safePoint;
 }
 
-Value VirtualMachine::pop() {
-    if (stack.empty()) {
-        return 0;
+void VirtualMachine::runMode() {
+    if (trace || profile) {
+        checked ? run<true, true>() : run<false, true>();
+    } else {
+        checked ? run<true, false>() : run<false, false>();
     }
-    Value value = stack.back();
-    stack.pop_back();
-    return value;
 }
 
-Value VirtualMachine::peek() {
-    if (stack.empty()) {
+template <bool Checked, bool Traced, bool Budgeted>
+void VirtualMachine::run() {
+    const auto& instructions = currentProgram->instructions;
+    
+    // A verified program always ends in HALT, PAR_END or TASK_END
+    while (!Checked || pc < instructions.size()) {
+        const auto& instr = instructions[pc];
+        bool shouldIncrementPc = true;  // By default, increment pc
+        if constexpr (Checked) {
+            checkInstruction(instr);
+        }
+        if constexpr (Traced) {
+            traceInstruction(instr);
+        }
+        if constexpr (Budgeted) {
+            if (sp == 0 && frames.empty()) {
+                safePoint.pc = pc;
+                safePoint.executed = executed;
+                if (executed == budget || instr.op == OpCode::HALT || instr.op == OpCode::SNAPSHOT ||
+                    instr.op == OpCode::SPAWN || instr.op == OpCode::MAP_NEW || readsInput(instr.op)) {
+                    return;
+                }
+            } else if (executed == budget || instr.op == OpCode::PAR_FOR || instr.op == OpCode::SPAWN ||
+                       instr.op == OpCode::CHAN_NEW || instr.op == OpCode::MAP_NEW || readsInput(instr.op)) {
+                return;
+            }
+            executed++;
+        }
+        
+        // Execute instruction
+        switch (instr.op) {
+            case OpCode::PUSH:
+                handlePush(instr);
+                break;
+            case OpCode::POP:
+                handlePop();
+                break;
+            case OpCode::STORE:
+                handleStore(instr);
+                break;
+            case OpCode::LOAD:
+                handleLoad(instr);
+                break;
+            case OpCode::STORE_LOCAL:
+                handleStoreLocal(instr);
+                break;
+            case OpCode::LOAD_LOCAL:
+                handleLoadLocal(instr);
+                break;
+            case OpCode::ADD:
+                handleAdd();
+                break;
+            case OpCode::SUB:
+                handleSub();
+                break;
+            case OpCode::MUL:
+                handleMul();
+                break;
+            case OpCode::DIV:
+                handleDiv();
+                break;
+            case OpCode::ADD_INT:
+            case OpCode::SUB_INT:
+            case OpCode::MUL_INT:
+                handleIntArith(instr.op);
+                break;
+            case OpCode::CMP_GT:
+            case OpCode::CMP_LT:
+            case OpCode::CMP_EQ:
+            case OpCode::CMP_NE:
+            case OpCode::CMP_LE:
+            case OpCode::CMP_GE:
+                handleCmp(instr.op);
+                break;
+            case OpCode::JMP:
+                handleJmp(instr);
+                shouldIncrementPc = false;  // pc is set in handleJmp
+                break;
+            case OpCode::JMP_IF_FALSE:
+                shouldIncrementPc = !handleJmpIfFalse();  // Only increment if we didn't jump
+                break;
+            case OpCode::JMP_IF_TRUE:
+                shouldIncrementPc = !handleJmpIfTrue();
+                break;
+            case OpCode::JEQ:
+            case OpCode::JNE:
+            case OpCode::JLT:
+            case OpCode::JLE:
+            case OpCode::JGT:
+            case OpCode::JGE:
+                shouldIncrementPc = !handleCompareJump(instr);
+                break;
+            case OpCode::JEQ_INT:
+            case OpCode::JNE_INT:
+            case OpCode::JLT_INT:
+            case OpCode::JLE_INT:
+            case OpCode::JGT_INT:
+            case OpCode::JGE_INT:
+                shouldIncrementPc = !handleIntCompareJump(instr);
+                break;
+            case OpCode::LOOP_INC_JMP:
+                shouldIncrementPc = !handleLoopIncJmp(instr);
+                break;
+            case OpCode::ITER:
+                handleIter();
+                break;
+            case OpCode::ITER_NEXT:
+                shouldIncrementPc = !handleIterNext(instr);
+                break;
+            case OpCode::CALL:
+                handleCall(instr);
+                shouldIncrementPc = false;
+                break;
+            case OpCode::TAIL_CALL:
+                handleTailCall(instr);
+                shouldIncrementPc = false;
+                break;
+            case OpCode::RET:
+                handleRet();
+                shouldIncrementPc = false;
+                break;
+            case OpCode::READ_LINE:
+                handleReadLine();
+                break;
+            case OpCode::READ_ALL:
+                handleReadAll();
+                break;
+            case OpCode::LINES:
+                handleLines();
+                break;
+            case OpCode::PRINT:
+                handlePrint();
+                break;
+            case OpCode::PAR_FOR:
+                handleParallelFor(instr);
+                shouldIncrementPc = false;
+                break;
+            case OpCode::SNAPSHOT:
+                handleSnapshot();
+                break;
+            case OpCode::PAR_END:
+                return;  // One iteration of a parallel loop body is done
+            case OpCode::SPAWN:
+                handleSpawn(instr);
+                shouldIncrementPc = false;
+                break;
+            case OpCode::TASK_END:
+                return;  // The task is done
+            case OpCode::CHAN_NEW:
+                handleChannelNew();
+                break;
+            case OpCode::MAP_NEW:
+                handleMapNew(instr);
+                break;
+            case OpCode::MAP_INSERT:
+                handleMapInsert();
+                break;
+            case OpCode::INDEX:
+                handleIndex();
+                break;
+            case OpCode::INDEX_SET:
+                handleIndexSet();
+                break;
+            case OpCode::MAP_HAS:
+            case OpCode::MAP_DELETE:
+                handleMapKeyOp(instr.op);
+                break;
+            case OpCode::MAP_SIZE:
+                handleMapSize();
+                break;
+            case OpCode::SEND:
+            case OpCode::RECV:
+                if (!handleChannelOp(instr.op)) {
+                    return;  // Parked, with pc past the instruction
+                }
+                break;
+            case OpCode::HALT:
+                handleHalt();
+                return;  // Exit the method
+        }
+        
+        if (shouldIncrementPc) {
+            pc++;
+        }
+    }
+}
+
+void VirtualMachine::traceInstruction(const Instruction& instr) {
+    uint8_t types = 0;
+    if (sp > 0) {
+        types = traceType(stack[sp - 1]);
+        if (sp > 1) {
+            types |= static_cast<uint8_t>(traceType(stack[sp - 2]) << 4);
+        }
+    }
+    if (trace) {
+        trace->record(pc, instr.op, types);
+    }
+    if (profile) {
+        // A conditional jump's outcome shows in the pc that runs next
+        if (pendingBranch != SIZE_MAX && pc != pendingBranch + 1) {
+            profile->taken(pendingBranch);
+        }
+        pendingBranch = isConditionalJump(instr.op) ? pc : SIZE_MAX;
+        profile->record(pc, types);
+    }
+}
+
+// What the verifier proves for the unchecked loop, tested one instruction
+// at a time instead
+void VirtualMachine::checkInstruction(const Instruction& instr) {
+    if (instr.op > OpCode::HALT) {
+        runtimeError("Unknown opcode");
+    }
+    if (hasIndexOperand(instr.op)) {
+        const int64_t* operand = std::get_if<int64_t>(&instr.operand);
+        if (!operand || *operand < 0) {
+            runtimeError("Invalid operand");
+        }
+        size_t limit = 0;
+        switch (instr.op) {
+            case OpCode::LOAD:
+            case OpCode::STORE:
+                limit = variables.size();
+                break;
+            case OpCode::LOAD_LOCAL:
+            case OpCode::STORE_LOCAL:
+                limit = frames.empty() ? 0 : sp - frames.back().base;
+                break;
+            case OpCode::JMP:
+            case OpCode::JMP_IF_FALSE:
+            case OpCode::JMP_IF_TRUE:
+            case OpCode::JEQ:
+            case OpCode::JNE:
+            case OpCode::JLT:
+            case OpCode::JLE:
+            case OpCode::JGT:
+            case OpCode::JGE:
+            case OpCode::JEQ_INT:
+            case OpCode::JNE_INT:
+            case OpCode::JLT_INT:
+            case OpCode::JLE_INT:
+            case OpCode::JGT_INT:
+            case OpCode::JGE_INT:
+            case OpCode::ITER_NEXT:
+            case OpCode::SPAWN:
+                limit = currentProgram->instructions.size();
+                break;
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL:
+                limit = currentProgram->functions.size();
+                break;
+            case OpCode::PAR_FOR:
+                limit = currentProgram->parallelLoops.size();
+                break;
+            case OpCode::LOOP_INC_JMP:
+                limit = currentProgram->countedLoops.size();
+                break;
+            default:
+                break;
+        }
+        if (indexOperand(instr) >= limit) {
+            runtimeError("Operand out of range");
+        }
+    }
+    if (instr.op == OpCode::LOOP_INC_JMP) {
+        const CountedLoopInfo& loop = currentProgram->countedLoops[indexOperand(instr)];
+        auto slotInRange = [&](bool local, int index) {
+            size_t limit = local ? (frames.empty() ? 0 : sp - frames.back().base) : variables.size();
+            return index >= 0 && static_cast<size_t>(index) < limit;
+        };
+        if (!slotInRange(loop.counterLocal, loop.counterSlot) ||
+            (loop.limitIsSlot && !slotInRange(loop.limitLocal, loop.limitSlot))) {
+            runtimeError("Operand out of range");
+        }
+    }
+    if ((instr.op == OpCode::RET || instr.op == OpCode::TAIL_CALL) && frames.empty()) {
+        runtimeError("Return outside of a function");
+    }
+    if (instr.op == OpCode::SNAPSHOT && (!frames.empty() || parallelWorker || task || sp != 0)) {
+        runtimeError("Checkpoint outside of top-level code");
+    }
+    if (instr.op == OpCode::SPAWN && (indexOperand(instr) <= pc ||
+                                      currentProgram->instructions[indexOperand(instr)].op != OpCode::TASK_END)) {
+        runtimeError("Malformed task body");
+    }
+    if (instr.op == OpCode::TASK_END && !task) {
+        runtimeError("TASK_END outside of a task");
+    }
+    StackEffect effect = stackEffect(instr, *currentProgram);
+    if (sp < effect.pops) {
         runtimeError("Stack underflow");
     }
-    return stack.back();
+    if (!growStack(sp - effect.pops + effect.pushes)) {
+        runtimeError("Stack overflow");
+    }
 }
 
 Value VirtualMachine::convertToNumber(const Value& value) {
-    if (std::holds_alternative<int>(value)) {
+    if (std::holds_alternative<int64_t>(value)) {
         return value;
     }
     if (std::holds_alternative<double>(value)) {
         return value;
     }
-    if (std::holds_alternative<std::string>(value)) {
+    if (std::holds_alternative<StringRef>(value)) {
         try {
-            std::string str = std::get<std::string>(value);
+            std::string str = std::get<StringRef>(value).str();
             if (str.find('.') != std::string::npos) {
                 return std::stod(str);
             } else {
-                return std::stoi(str);
+                return std::stoll(str);
             }
         } catch (...) {
             runtimeError("Invalid number format");
@@ -119,7 +454,7 @@ Value VirtualMachine::convertToNumber(const Value& value) {
     if (std::holds_alternative<bool>(value)) {
         return std::get<bool>(value) ? 1 : 0;
     }
-    runtimeError("Cannot convert value to number");
+    runtimeError(std::string("Cannot convert ") + std::get<ObjectRef>(value).get()->typeName() + " to number");
     return 0;  // Never reached
 }
 
@@ -128,191 +463,805 @@ void VirtualMachine::handlePush(const Instruction& instr) {
 }
 
 void VirtualMachine::handlePop() {
-    if (!stack.empty()) {
-        stack.pop_back();
-    }
+    pop();
 }
 
 void VirtualMachine::handleStore(const Instruction& instr) {
-    int index = std::get<int>(instr.operand);
-    Value value = pop();  // Get the value to store
-    variables[index] = value;
     // Don't push anything back - store is a statement, not an expression
+    variables[indexOperand(instr)] = std::move(stack[--sp]);
 }
 
 void VirtualMachine::handleLoad(const Instruction& instr) {
-    int index = std::get<int>(instr.operand);
-    if (index >= variables.size()) {
-        runtimeError("Variable not initialized");
+    push(variables[indexOperand(instr)]);
+}
+
+void VirtualMachine::handleStoreLocal(const Instruction& instr) {
+    stack[frames.back().base + indexOperand(instr)] = std::move(stack[--sp]);
+}
+
+void VirtualMachine::handleLoadLocal(const Instruction& instr) {
+    push(stack[frames.back().base + indexOperand(instr)]);
+}
+
+// Recursion is the one way a verified program can outgrow the stack, so each
+// new frame checks that its locals and deepest expression fit. Workers and
+// tasks start with small stacks that grow up to the main program's size.
+void VirtualMachine::ensureFrame(size_t base, const FunctionInfo& fn, size_t depth) {
+    if (!growStack(base + fn.localCount + depth)) {
+        runtimeError("Stack overflow in call to '" + fn.name + "'");
     }
-    push(variables[index]);
 }
 
-void VirtualMachine::handleAdd() {
-    Value b = pop();
-    Value a = pop();
+// Makes room for `size` values; false if that is more than STACK_SLOTS
+bool VirtualMachine::growStack(size_t size) {
+    if (size <= stack.size()) {
+        return true;
+    }
+    if (size > STACK_SLOTS) {
+        return false;
+    }
+    stack.resize(std::min(STACK_SLOTS, std::max(size, stack.size() * 2)));
+    return true;
+}
+
+void VirtualMachine::handleCall(const Instruction& instr) {
+    size_t index = indexOperand(instr);
+    const FunctionInfo& fn = currentProgram->functions[index];
+    if (frames.size() >= MAX_CALL_DEPTH) {
+        runtimeError("Stack overflow in call to '" + fn.name + "'");
+    }
     
+    // Arguments are already in place; extend the frame with the locals
+    size_t base = sp - fn.arity;
+    ensureFrame(base, fn, bounds->functionDepth[index]);
+    for (; sp < base + fn.localCount; sp++) {
+        stack[sp] = Value();
+    }
+    frames.push_back({pc + 1, base});
+    pc = fn.entry;
+}
+
+void VirtualMachine::handleTailCall(const Instruction& instr) {
+    size_t index = indexOperand(instr);
+    const FunctionInfo& fn = currentProgram->functions[index];
+    size_t base = frames.back().base;
+    size_t args = sp - fn.arity;
+    ensureFrame(base, fn, bounds->functionDepth[index]);
+    
+    // Slide the new arguments down over the current frame
+    for (int i = 0; i < fn.arity; i++) {
+        stack[base + i] = std::move(stack[args + i]);
+    }
+    for (sp = base + fn.arity; sp < base + fn.localCount; sp++) {
+        stack[sp] = Value();
+    }
+    pc = fn.entry;
+}
+
+void VirtualMachine::handleRet() {
+    CallFrame frame = frames.back();
+    frames.pop_back();
+    
+    // Release the frame's values rather than leaving them above sp
+    Value result = pop();
+    while (sp > frame.base) {
+        stack[--sp] = Value();
+    }
+    push(std::move(result));
+    pc = frame.returnPc;
+}
+
+// Text of a value as used by string concatenation; strings are viewed in
+// place, other values are formatted into `scratch`
+std::string_view VirtualMachine::textOf(const Value& value, char* scratch) {
+    if (std::holds_alternative<StringRef>(value)) {
+        return std::get<StringRef>(value).view();
+    }
+    if (std::holds_alternative<int64_t>(value)) {
+        return std::string_view(scratch, formatNumber(std::get<int64_t>(value), scratch) - scratch);
+    }
+    if (std::holds_alternative<double>(value)) {
+        return std::string_view(scratch, formatNumber(std::get<double>(value), scratch) - scratch);
+    }
+    if (std::holds_alternative<ObjectRef>(value)) {
+        // "<channel>"; type names are short enough for the scratch buffer
+        const char* name = std::get<ObjectRef>(value).get()->typeName();
+        size_t length = std::min(std::strlen(name), NUMBER_TEXT_MAX - 2);
+        scratch[0] = '<';
+        std::memcpy(scratch + 1, name, length);
+        scratch[length + 1] = '>';
+        return std::string_view(scratch, length + 2);
+    }
+    return std::get<bool>(value) ? "true" : "false";
+}
+
+// ADD, SUB, MUL or DIV of two integers. A result that does not fit in 64
+// bits is a runtime error rather than wrapping around (or, for
+// INT64_MIN / -1, trapping).
+inline int64_t VirtualMachine::intArith(OpCode op, int64_t a, int64_t b) {
+    int64_t result;
+    bool failed;
+    switch (op) {
+        case OpCode::ADD: failed = __builtin_add_overflow(a, b, &result); break;
+        case OpCode::SUB: failed = __builtin_sub_overflow(a, b, &result); break;
+        case OpCode::MUL: failed = __builtin_mul_overflow(a, b, &result); break;
+        default:
+            failed = b == 0 || (a == INT64_MIN && b == -1);
+            result = failed ? 0 : a / b;
+            break;
+    }
+    if (failed) intArithError(op, b);
+    return result;
+}
+
+// Kept out of intArith so that the arithmetic itself stays small enough to
+// inline into the handlers
+void VirtualMachine::intArithError(OpCode op, int64_t b) {
+    runtimeError(op == OpCode::DIV && b == 0 ? "Division by zero" : "Integer overflow");
+}
+
+Value VirtualMachine::add(const Value& a, const Value& b) {
     // If either operand is a string, do string concatenation
-    if (std::holds_alternative<std::string>(a) || std::holds_alternative<std::string>(b)) {
-        std::string result;
-        if (std::holds_alternative<std::string>(a)) {
-            result = std::get<std::string>(a);
-        } else if (std::holds_alternative<int>(a)) {
-            result = std::to_string(std::get<int>(a));
-        } else if (std::holds_alternative<double>(a)) {
-            result = std::to_string(std::get<double>(a));
-        } else if (std::holds_alternative<bool>(a)) {
-            result = std::get<bool>(a) ? "true" : "false";
-        }
-        
-        if (std::holds_alternative<std::string>(b)) {
-            result += std::get<std::string>(b);
-        } else if (std::holds_alternative<int>(b)) {
-            result += std::to_string(std::get<int>(b));
-        } else if (std::holds_alternative<double>(b)) {
-            result += std::to_string(std::get<double>(b));
-        } else if (std::holds_alternative<bool>(b)) {
-            result += std::get<bool>(b) ? "true" : "false";
-        }
-        
-        push(result);
-        return;
+    if (std::holds_alternative<StringRef>(a) || std::holds_alternative<StringRef>(b)) {
+        char scratchA[NUMBER_TEXT_MAX], scratchB[NUMBER_TEXT_MAX];
+        return StringRef::concat(textOf(a, scratchA), textOf(b, scratchB));
     }
     
     // Otherwise, do numeric addition
     Value numA = convertToNumber(a);
     Value numB = convertToNumber(b);
     
-    if (std::holds_alternative<int>(numA) && std::holds_alternative<int>(numB)) {
-        push(std::get<int>(numA) + std::get<int>(numB));
-    } else {
-        double da = std::holds_alternative<int>(numA) ? std::get<int>(numA) : std::get<double>(numA);
-        double db = std::holds_alternative<int>(numB) ? std::get<int>(numB) : std::get<double>(numB);
-        push(da + db);
+    if (std::holds_alternative<int64_t>(numA) && std::holds_alternative<int64_t>(numB)) {
+        return intArith(OpCode::ADD, std::get<int64_t>(numA), std::get<int64_t>(numB));
     }
+    double da = std::holds_alternative<int64_t>(numA) ? std::get<int64_t>(numA) : std::get<double>(numA);
+    double db = std::holds_alternative<int64_t>(numB) ? std::get<int64_t>(numB) : std::get<double>(numB);
+    return da + db;
 }
 
-void VirtualMachine::handleSub() {
-    Value b = convertToNumber(pop());
-    Value a = convertToNumber(pop());
+Value VirtualMachine::subtract(const Value& left, const Value& right) {
+    Value a = convertToNumber(left);
+    Value b = convertToNumber(right);
     
-    if (std::holds_alternative<int>(a) && std::holds_alternative<int>(b)) {
-        push(std::get<int>(a) - std::get<int>(b));
-    } else {
-        double da = std::holds_alternative<int>(a) ? std::get<int>(a) : std::get<double>(a);
-        double db = std::holds_alternative<int>(b) ? std::get<int>(b) : std::get<double>(b);
-        push(da - db);
+    if (std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)) {
+        return intArith(OpCode::SUB, std::get<int64_t>(a), std::get<int64_t>(b));
     }
+    double da = std::holds_alternative<int64_t>(a) ? std::get<int64_t>(a) : std::get<double>(a);
+    double db = std::holds_alternative<int64_t>(b) ? std::get<int64_t>(b) : std::get<double>(b);
+    return da - db;
+}
+
+// Two integers or two doubles are combined in the left operand's slot,
+// without moving either value off the stack
+template <OpCode Op>
+bool VirtualMachine::combineInPlace() {
+    Value& a = stack[sp - 2];
+    const Value& b = stack[sp - 1];
+    if (int64_t* ia = std::get_if<int64_t>(&a)) {
+        if (const int64_t* ib = std::get_if<int64_t>(&b)) {
+            *ia = intArith(Op, *ia, *ib);
+            sp--;
+            return true;
+        }
+    } else if (double* da = std::get_if<double>(&a)) {
+        if (const double* db = std::get_if<double>(&b)) {
+            if constexpr (Op == OpCode::ADD) {
+                *da += *db;
+            } else if constexpr (Op == OpCode::SUB) {
+                *da -= *db;
+            } else if constexpr (Op == OpCode::MUL) {
+                *da *= *db;
+            } else {
+                if (*db == 0) runtimeError("Division by zero");
+                *da /= *db;
+            }
+            sp--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void VirtualMachine::handleAdd() {
+    if (combineInPlace<OpCode::ADD>()) return;
+    Value b = pop();
+    Value a = pop();
+    push(add(a, b));
+}
+
+void VirtualMachine::handleSub() {
+    if (combineInPlace<OpCode::SUB>()) return;
+    Value b = pop();
+    Value a = pop();
+    push(subtract(a, b));
 }
 
 void VirtualMachine::handleMul() {
+    if (combineInPlace<OpCode::MUL>()) return;
     Value b = convertToNumber(pop());
     Value a = convertToNumber(pop());
     
-    if (std::holds_alternative<int>(a) && std::holds_alternative<int>(b)) {
-        push(std::get<int>(a) * std::get<int>(b));
+    if (std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)) {
+        push(intArith(OpCode::MUL, std::get<int64_t>(a), std::get<int64_t>(b)));
     } else {
-        double da = std::holds_alternative<int>(a) ? std::get<int>(a) : std::get<double>(a);
-        double db = std::holds_alternative<int>(b) ? std::get<int>(b) : std::get<double>(b);
+        double da = std::holds_alternative<int64_t>(a) ? std::get<int64_t>(a) : std::get<double>(a);
+        double db = std::holds_alternative<int64_t>(b) ? std::get<int64_t>(b) : std::get<double>(b);
         push(da * db);
     }
 }
 
 void VirtualMachine::handleDiv() {
+    if (combineInPlace<OpCode::DIV>()) return;
     Value b = convertToNumber(pop());
     Value a = convertToNumber(pop());
     
-    if (std::holds_alternative<int>(a) && std::holds_alternative<int>(b)) {
-        int ib = std::get<int>(b);
-        if (ib == 0) runtimeError("Division by zero");
-        push(std::get<int>(a) / ib);
+    if (std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)) {
+        push(intArith(OpCode::DIV, std::get<int64_t>(a), std::get<int64_t>(b)));
     } else {
-        double da = std::holds_alternative<int>(a) ? std::get<int>(a) : std::get<double>(a);
-        double db = std::holds_alternative<int>(b) ? std::get<int>(b) : std::get<double>(b);
+        double da = std::holds_alternative<int64_t>(a) ? std::get<int64_t>(a) : std::get<double>(a);
+        double db = std::holds_alternative<int64_t>(b) ? std::get<int64_t>(b) : std::get<double>(b);
         if (db == 0) runtimeError("Division by zero");
         push(da / db);
     }
 }
 
-void VirtualMachine::handleCmp(OpCode op) {
-    Value b = pop();
-    Value a = pop();
-    bool result = false;
-    
-    // If both operands are strings, do string comparison
-    if (std::holds_alternative<std::string>(a) && std::holds_alternative<std::string>(b)) {
-        std::string sa = std::get<std::string>(a);
-        std::string sb = std::get<std::string>(b);
-        switch (op) {
-            case OpCode::CMP_EQ: result = (sa == sb); break;
-            case OpCode::CMP_NE: result = (sa != sb); break;
-            case OpCode::CMP_LT: result = (sa < sb); break;
-            case OpCode::CMP_LE: result = (sa <= sb); break;
-            case OpCode::CMP_GT: result = (sa > sb); break;
-            case OpCode::CMP_GE: result = (sa >= sb); break;
-            default: runtimeError("Invalid comparison operator");
+// Two numbers of the same type, so that integers compare exactly
+template <typename T>
+static bool compareNumbers(OpCode op, T a, T b) {
+    switch (op) {
+        case OpCode::CMP_EQ: return a == b;
+        case OpCode::CMP_NE: return a != b;
+        case OpCode::CMP_LT: return a < b;
+        case OpCode::CMP_LE: return a <= b;
+        case OpCode::CMP_GT: return a > b;
+        default: return a >= b;
+    }
+}
+
+// Two strings compare by content, and equality of two interned strings is a
+// pointer compare. Objects are only equal to themselves and have no order.
+// A string is never equal to a bool, so `line != false` tests for the end
+// of input. Anything else compares as numbers: exactly if both are integers,
+// otherwise in double precision.
+bool VirtualMachine::compareValues(OpCode op, const Value& a, const Value& b) {
+    if (std::holds_alternative<ObjectRef>(a) || std::holds_alternative<ObjectRef>(b)) {
+        if (op != OpCode::CMP_EQ && op != OpCode::CMP_NE) {
+            runtimeError("Objects can only be compared with == and !=");
         }
-    } else {
-        // Otherwise, do numeric comparison
-        Value numA = convertToNumber(a);
-        Value numB = convertToNumber(b);
-        
-        double da = std::holds_alternative<int>(numA) ? std::get<int>(numA) : std::get<double>(numA);
-        double db = std::holds_alternative<int>(numB) ? std::get<int>(numB) : std::get<double>(numB);
-        
+        return (a == b) == (op == OpCode::CMP_EQ);
+    }
+    if ((op == OpCode::CMP_EQ || op == OpCode::CMP_NE) &&
+        ((std::holds_alternative<StringRef>(a) && std::holds_alternative<bool>(b)) ||
+         (std::holds_alternative<bool>(a) && std::holds_alternative<StringRef>(b)))) {
+        return op == OpCode::CMP_NE;
+    }
+    if (std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)) {
+        return compareNumbers(op, std::get<int64_t>(a), std::get<int64_t>(b));
+    }
+    if (std::holds_alternative<StringRef>(a) && std::holds_alternative<StringRef>(b)) {
+        const StringRef& sa = std::get<StringRef>(a);
+        const StringRef& sb = std::get<StringRef>(b);
         switch (op) {
-            case OpCode::CMP_EQ: result = (da == db); break;
-            case OpCode::CMP_NE: result = (da != db); break;
-            case OpCode::CMP_LT: result = (da < db); break;
-            case OpCode::CMP_LE: result = (da <= db); break;
-            case OpCode::CMP_GT: result = (da > db); break;
-            case OpCode::CMP_GE: result = (da >= db); break;
+            case OpCode::CMP_EQ: return sa == sb;
+            case OpCode::CMP_NE: return sa != sb;
+            case OpCode::CMP_LT: return sa < sb;
+            case OpCode::CMP_LE: return sa <= sb;
+            case OpCode::CMP_GT: return sa > sb;
+            case OpCode::CMP_GE: return sa >= sb;
             default: runtimeError("Invalid comparison operator");
         }
     }
     
-    push(result);
+    Value numA = convertToNumber(a);
+    Value numB = convertToNumber(b);
+    if (std::holds_alternative<int64_t>(numA) && std::holds_alternative<int64_t>(numB)) {
+        return compareNumbers(op, std::get<int64_t>(numA), std::get<int64_t>(numB));
+    }
+    double da = std::holds_alternative<int64_t>(numA) ? std::get<int64_t>(numA) : std::get<double>(numA);
+    double db = std::holds_alternative<int64_t>(numB) ? std::get<int64_t>(numB) : std::get<double>(numB);
+    return compareNumbers(op, da, db);
+}
+
+void VirtualMachine::handleCmp(OpCode op) {
+    bool result = compareValues(op, stack[sp - 2], stack[sp - 1]);
+    stack[sp - 2] = result;
+    sp--;
 }
 
 void VirtualMachine::handleJmp(const Instruction& instr) {
-    int target = std::get<int>(instr.operand);
-    pc = target;
+    pc = indexOperand(instr);
 }
 
 bool VirtualMachine::handleJmpIfFalse() {
-    if (stack.empty()) {
-        throw std::runtime_error("Stack underflow in JMP_IF_FALSE");
-    }
-    
-    Value condition = stack.back();
-    stack.pop_back();
-    
-    bool isFalse = !isTruthy(condition);
+    bool isFalse = !isTruthy(stack[--sp]);
     
     if (isFalse) {
         // Jump to the target address
-        pc = std::get<int>(currentProgram.instructions[pc].operand);
+        pc = indexOperand(currentProgram->instructions[pc]);
         return true;
     }
     
-    // If condition is true, just move to next instruction
-    pc++;
+    // If condition is true, fall through to the next instruction
     return false;
 }
 
-void VirtualMachine::handlePrint() {
-    if (stack.empty()) {
-        runtimeError("Stack underflow in print");
+bool VirtualMachine::handleJmpIfTrue() {
+    if (isTruthy(stack[--sp])) {
+        pc = indexOperand(currentProgram->instructions[pc]);
+        return true;
+    }
+    return false;
+}
+
+bool VirtualMachine::handleCompareJump(const Instruction& instr) {
+    bool result = compareValues(fusedComparison(instr.op), stack[sp - 2], stack[sp - 1]);
+    sp -= 2;
+    if (!result) {
+        pc = indexOperand(instr);
+        return true;
+    }
+    return false;
+}
+
+// Guarded integer opcodes: two integers are handled inline, anything else
+// by the handler of the opcode they specialize
+void VirtualMachine::handleIntArith(OpCode op) {
+    int64_t* a = std::get_if<int64_t>(&stack[sp - 2]);
+    const int64_t* b = std::get_if<int64_t>(&stack[sp - 1]);
+    if (a && b) {
+        bool overflow;
+        switch (op) {
+            case OpCode::ADD_INT: overflow = __builtin_add_overflow(*a, *b, a); break;
+            case OpCode::SUB_INT: overflow = __builtin_sub_overflow(*a, *b, a); break;
+            default: overflow = __builtin_mul_overflow(*a, *b, a); break;
+        }
+        if (overflow) intArithError(op, *b);
+        sp--;
+        return;
+    }
+    switch (genericOp(op)) {
+        case OpCode::ADD: handleAdd(); break;
+        case OpCode::SUB: handleSub(); break;
+        default: handleMul(); break;
+    }
+}
+
+bool VirtualMachine::handleIntCompareJump(const Instruction& instr) {
+    const int64_t* a = std::get_if<int64_t>(&stack[sp - 2]);
+    const int64_t* b = std::get_if<int64_t>(&stack[sp - 1]);
+    if (!a || !b) {
+        return handleCompareJump(instr);
+    }
+    bool result = compareNumbers(fusedComparison(instr.op), *a, *b);
+    sp -= 2;
+    if (!result) {
+        pc = indexOperand(instr);
+        return true;
+    }
+    return false;
+}
+
+// Same result as `i = i + step; i < limit` (or whichever operators the loop
+// uses) in separate instructions. Integer counters and limits are updated
+// in place without going through the generic helpers.
+bool VirtualMachine::handleLoopIncJmp(const Instruction& instr) {
+    const CountedLoopInfo& loop = currentProgram->countedLoops[indexOperand(instr)];
+    Value& counter = slot(loop.counterLocal, loop.counterSlot);
+    const Value& limit = loop.limitIsSlot ? slot(loop.limitLocal, loop.limitSlot) : loop.limit;
+    bool again;
+    int64_t* i = std::get_if<int64_t>(&counter);
+    const int64_t* n = std::get_if<int64_t>(&limit);
+    if (i && n) {
+        bool overflow = loop.stepOp == OpCode::ADD ? __builtin_add_overflow(*i, loop.step, i)
+                                                   : __builtin_sub_overflow(*i, loop.step, i);
+        if (overflow) intArithError(loop.stepOp, loop.step);
+        again = compareNumbers(loop.compare, *i, *n);
+    } else {
+        Value step = loop.step;
+        counter = loop.stepOp == OpCode::ADD ? add(counter, step) : subtract(counter, step);
+        again = compareValues(loop.compare, counter, limit);
+    }
+    if (again) {
+        pc = loop.bodyStart;
+    }
+    return again;
+}
+
+void VirtualMachine::handleIter() {
+    const Value& value = stack[sp - 1];
+    const ObjectRef* object = std::get_if<ObjectRef>(&value);
+    if (object && object->as<Map>()) {
+        stack[sp - 1] = ObjectRef(new MapKeys(*object));
+        return;
+    }
+    if (!object || !object->as<Iterator>()) {
+        char text[NUMBER_TEXT_MAX];
+        runtimeError("Cannot iterate over " + std::string(textOf(value, text)));
+    }
+}
+
+// An exhausted iterator is replaced by false, which the loop stores into
+// its iterator slot to let go of the iterator
+bool VirtualMachine::handleIterNext(const Instruction& instr) {
+    Value& top = stack[sp - 1];
+    const ObjectRef* object = std::get_if<ObjectRef>(&top);
+    Iterator* iterator = object ? object->as<Iterator>() : nullptr;
+    if (!iterator) {
+        runtimeError("for-in needs an iterator");
     }
+    Value next;
+    bool more;
+    try {
+        more = iterator->next(next);
+    } catch (const std::runtime_error& e) {
+        runtimeError(e.what());
+    }
+    if (more) {
+        top = std::move(next);
+        return false;
+    }
+    top = false;
+    pc = indexOperand(instr);
+    return true;
+}
+
+// Map opcodes find their map under their other operands
+Map* VirtualMachine::mapOperand(const Value& value) {
+    const ObjectRef* object = std::get_if<ObjectRef>(&value);
+    Map* map = object ? object->as<Map>() : nullptr;
+    if (!map) {
+        char text[NUMBER_TEXT_MAX];
+        runtimeError("Expected a map, got " + std::string(textOf(value, text)));
+    }
+    return map;
+}
+
+Value VirtualMachine::mapKey(Value key) {
+    if (!Map::normalizeKey(key)) {
+        char text[NUMBER_TEXT_MAX];
+        runtimeError("Map keys must be numbers, strings or booleans, not " + std::string(textOf(key, text)));
+    }
+    return key;
+}
+
+void VirtualMachine::handleMapNew(const Instruction& instr) {
+    // A hint only, so a damaged cache file cannot ask for a huge table
+    const int64_t* expected = std::get_if<int64_t>(&instr.operand);
+    size_t room = expected && *expected > 0 ? static_cast<size_t>(std::min<int64_t>(*expected, 1 << 16)) : 0;
+    push(ObjectRef(new Map(room)));
+}
+
+void VirtualMachine::handleMapInsert() {
+    Value value = pop();
+    Value key = mapKey(pop());
+    mapOperand(stack[sp - 1])->set(key, std::move(value));
+}
+
+void VirtualMachine::handleIndex() {
+    Value key = mapKey(pop());
+    const Value* found = mapOperand(stack[sp - 1])->find(key);
+    if (!found) {
+        char text[NUMBER_TEXT_MAX];
+        const char* quote = std::holds_alternative<StringRef>(key) ? "\"" : "";
+        runtimeError("Map has no key " + (quote + std::string(textOf(key, text))) + quote);
+    }
+    // Copied out before the map's last reference may go
+    Value value = *found;
+    stack[sp - 1] = std::move(value);
+}
+
+void VirtualMachine::handleIndexSet() {
     Value value = pop();
-    if (std::holds_alternative<int>(value)) {
-        std::cout << std::get<int>(value) << "\n";
-    } else if (std::holds_alternative<double>(value)) {
-        std::cout << std::get<double>(value) << "\n";
+    Value key = mapKey(pop());
+    mapOperand(stack[sp - 1])->set(key, value);
+    stack[sp - 1] = std::move(value);
+}
+
+void VirtualMachine::handleMapKeyOp(OpCode op) {
+    Value key = mapKey(pop());
+    Map* map = mapOperand(stack[sp - 1]);
+    stack[sp - 1] = op == OpCode::MAP_HAS ? map->find(key) != nullptr : map->erase(key);
+}
+
+void VirtualMachine::handleMapSize() {
+    stack[sp - 1] = static_cast<int64_t>(mapOperand(stack[sp - 1])->size());
+}
+
+Value& VirtualMachine::slot(bool local, int index) {
+    return local ? stack[frames.back().base + index] : variables[index];
+}
+
+void VirtualMachine::handleParallelFor(const Instruction& instr) {
+    size_t loopIndex = indexOperand(instr);
+    const ParallelLoopInfo& loop = currentProgram->parallelLoops[loopIndex];
+    Value endValue = pop();
+    Value startValue = pop();
+    if (!std::holds_alternative<int64_t>(startValue) || !std::holds_alternative<int64_t>(endValue)) {
+        runtimeError("parallel for bounds must be integers");
+    }
+    long long start = std::get<int64_t>(startValue);
+    long long end = std::get<int64_t>(endValue) + (loop.inclusive ? 1 : 0);
+    long long iterations = start < end ? (end - start + loop.step - 1) / loop.step : 0;
+    
+    if (iterations > 0) {
+        std::vector<Value> initial;
+        for (const auto& reduction : loop.reductions) {
+            initial.push_back(slot(reduction.local, reduction.slot));
+        }
+        
+        // Loops reached from inside another parallel loop run inline, and so
+        // do loops in tasks, which must not hold on to a pool thread
+        ThreadPool* pool = parallelWorker || task ? nullptr : &ThreadPool::shared();
+        size_t chunks = pool ? std::min<long long>(iterations, pool->size() * CHUNKS_PER_THREAD) : 1;
+        long long perChunk = (iterations + chunks - 1) / chunks;
+        chunks = (iterations + perChunk - 1) / perChunk;
+        std::vector<ChunkResult> results(chunks);
+        
+        if (chunks == 1) {
+            runParallelChunk(loopIndex, start, iterations, initial, results[0]);
+        } else {
+            std::mutex mutex;
+            std::condition_variable finished;
+            size_t remaining = chunks;
+            for (size_t c = 0; c < chunks; c++) {
+                long long first = start + static_cast<long long>(c) * perChunk * loop.step;
+                long long count = std::min(perChunk, iterations - static_cast<long long>(c) * perChunk);
+                pool->submit([&, c, first, count] {
+                    runParallelChunk(loopIndex, first, count, initial, results[c]);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--remaining == 0) finished.notify_all();
+                });
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return remaining == 0; });
+        }
+        
+        // Merge in iteration order: output first, then reductions
+        std::vector<Value> reduced = initial;
+        for (auto& result : results) {
+            out << result.output;
+            if (!result.error.empty()) {
+                throw std::runtime_error(result.error);
+            }
+            for (size_t r = 0; r < loop.reductions.size(); r++) {
+                reduced[r] = combineReduction(loop.reductions[r].kind, reduced[r], result.reductions[r]);
+            }
+        }
+        for (size_t r = 0; r < loop.reductions.size(); r++) {
+            slot(loop.reductions[r].local, loop.reductions[r].slot) = reduced[r];
+        }
+    }
+    
+    // Leave the induction variable where a sequential loop would have
+    slot(loop.inductionLocal, loop.inductionSlot) = static_cast<int64_t>(start + iterations * loop.step);
+    pc = loop.bodyEnd + 1;
+}
+
+void VirtualMachine::runParallelChunk(size_t loopIndex, long long first, long long count,
+                                      const std::vector<Value>& initial, ChunkResult& result) {
+    const ParallelLoopInfo& loop = currentProgram->parallelLoops[loopIndex];
+    std::ostringstream output;
+    VirtualMachine worker(output, output);
+    worker.currentProgram = currentProgram;
+    worker.parallelWorker = true;
+    worker.checked = checked;
+    worker.fileInput = fileInput;
+    worker.trace = trace;
+    worker.profile = profile;
+    worker.bounds = bounds;
+    
+    // Private copies of the globals and of the enclosing frame, if any
+    MapCopier copy;
+    worker.variables.resize(variables.size());
+    std::transform(variables.begin(), variables.end(), worker.variables.begin(), std::ref(copy));
+    size_t frameBase = frames.empty() ? sp : frames.back().base;
+    worker.stack.assign(sp - frameBase + bounds->loopDepth[loopIndex] + WORKER_STACK_SLOTS, Value());
+    std::transform(stack.begin() + frameBase, stack.begin() + sp, worker.stack.begin(), std::ref(copy));
+    worker.sp = sp - frameBase;
+    if (!frames.empty()) {
+        worker.frames.push_back({0, 0});
+    }
+    
+    // Each chunk reduces from the identity, of the same type as the value
+    // before the loop so that `sum` over strings concatenates; min/max may
+    // start from that value since they are idempotent
+    for (size_t r = 0; r < loop.reductions.size(); r++) {
+        const Reduction& reduction = loop.reductions[r];
+        Value identity = initial[r];
+        if (reduction.kind == ReductionKind::SUM) {
+            if (std::holds_alternative<StringRef>(initial[r])) {
+                identity = StringRef();
+            } else if (std::holds_alternative<double>(initial[r])) {
+                identity = 0.0;
+            } else {
+                identity = static_cast<int64_t>(0);
+            }
+        }
+        if (reduction.kind == ReductionKind::CONCAT) identity = StringRef();
+        worker.slot(reduction.local, reduction.slot) = identity;
+    }
+    
+    try {
+        for (long long k = 0; k < count; k++) {
+            worker.slot(loop.inductionLocal, loop.inductionSlot) = static_cast<int64_t>(first + k * loop.step);
+            worker.pc = loop.bodyStart;
+            worker.runMode();
+        }
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    
+    for (const auto& reduction : loop.reductions) {
+        result.reductions.push_back(worker.slot(reduction.local, reduction.slot));
+    }
+    result.output = output.str();
+}
+
+Value VirtualMachine::combineReduction(ReductionKind kind, const Value& acc, const Value& part) {
+    switch (kind) {
+        case ReductionKind::SUM:
+        case ReductionKind::CONCAT:
+            push(acc);
+            push(part);
+            handleAdd();
+            return pop();
+        case ReductionKind::MIN:
+        case ReductionKind::MAX:
+            push(part);
+            push(acc);
+            handleCmp(kind == ReductionKind::MIN ? OpCode::CMP_LT : OpCode::CMP_GT);
+            return std::get<bool>(pop()) ? part : acc;
+    }
+    return acc;
+}
+
+Scheduler& VirtualMachine::ensureScheduler() {
+    if (!scheduler) {
+        ownScheduler = std::make_shared<Scheduler>();
+        scheduler = ownScheduler.get();
+    }
+    return *scheduler;
+}
+
+// Ends the tasks of the run that is ending, if it had any
+void VirtualMachine::stopTasks() {
+    if (ownScheduler) {
+        ownScheduler->stop();
+        ownScheduler.reset();
+        scheduler = nullptr;
+    }
+}
+
+void VirtualMachine::handleSpawn(const Instruction& instr) {
+    if (parallelWorker) {
+        runtimeError("spawn cannot be used inside a parallel for");
+    }
+    ensureScheduler();
+    if (!task) {
+        scheduler->checkFailure();
+    }
+    scheduler->spawn(*this);
+    pc = indexOperand(instr) + 1;
+}
+
+void VirtualMachine::handleChannelNew() {
+    const int64_t* capacity = std::get_if<int64_t>(&stack[sp - 1]);
+    if (!capacity || *capacity < 0) {
+        runtimeError("Channel capacity must be a non-negative integer");
+    }
+    stack[sp - 1] = ObjectRef(new Channel(static_cast<size_t>(*capacity)));
+}
+
+// A task that has to wait is parked and its VM returns; the main program
+// waits on its own thread. When a receiving task is continued, the value
+// it was handed is pushed first (see Scheduler::run).
+bool VirtualMachine::handleChannelOp(OpCode op) {
+    if (parallelWorker) {
+        runtimeError("Channels cannot be used inside a parallel for");
+    }
+    Value value;
+    if (op == OpCode::SEND) {
+        value = MapCopier()(pop());  // The receiver may be on another thread
+    }
+    Value target = pop();
+    const ObjectRef* object = std::get_if<ObjectRef>(&target);
+    Channel* channel = object ? object->as<Channel>() : nullptr;
+    if (!channel) {
+        runtimeError(std::string(op == OpCode::SEND ? "send" : "recv") + " needs a channel");
+    }
+    
+    ensureScheduler();
+    Waiter* self = task ? static_cast<Waiter*>(task) : &scheduler->mainWaiter;
+    bool done = op == OpCode::SEND ? channel->send(self, std::move(value)) : channel->receive(self, value);
+    if (!done) {
+        if (task) {
+            task->parking = true;
+            task->receiving = op == OpCode::RECV;
+            task->waitingOn = std::move(target);
+            pc++;
+            return false;
+        }
+        if (!scheduler->waitForMain(*channel)) {
+            scheduler->checkFailure();
+            runtimeError("Deadlock: every task is waiting on a channel");
+        }
+        value = std::move(scheduler->mainWaiter.value);
+    }
+    if (op == OpCode::RECV) {
+        push(std::move(value));
+    }
+    return true;
+}
+
+void VirtualMachine::handleReadLine() {
+    StandardInput& input = standardInput();
+    std::lock_guard<std::mutex> lock(input.mutex);
+    StringRef line;
+    if (input.reader.next(line)) {
+        push(std::move(line));
+    } else {
+        push(false);
+    }
+}
+
+// The file named by `path`, mapped
+ObjectRef VirtualMachine::openInput(const Value& path, const char* builtin) {
+    const StringRef* name = std::get_if<StringRef>(&path);
+    if (!name) {
+        runtimeError(std::string(builtin) + " needs a file path");
+    }
+    if (!fileInput) {
+        runtimeError("Reading files is disabled");
+    }
+    try {
+        return InputBuffer::mapFile(name->str());
+    } catch (const std::runtime_error& e) {
+        runtimeError(e.what());
+    }
+}
+
+void VirtualMachine::handleReadAll() {
+    Value& top = stack[sp - 1];
+    if (const StringRef* name = std::get_if<StringRef>(&top); name && name->view() == "-") {
+        StandardInput& input = standardInput();
+        std::lock_guard<std::mutex> lock(input.mutex);
+        top = input.reader.rest();
+        return;
+    }
+    ObjectRef file = openInput(top, "readAll");
+    const InputBuffer* buffer = static_cast<const InputBuffer*>(file.get());
+    top = StringRef::slice(std::string_view(buffer->bytes(), buffer->size()), file);
+}
+
+void VirtualMachine::handleLines() {
+    Value& top = stack[sp - 1];
+    if (const StringRef* name = std::get_if<StringRef>(&top); name && name->view() == "-") {
+        top = ObjectRef(new InputLines());
+        return;
+    }
+    top = ObjectRef(new FileLines(openInput(top, "lines")));
+}
+
+void VirtualMachine::handlePrint() {
+    const Value& value = stack[--sp];
+    std::unique_lock<std::mutex> lock;
+    if (scheduler) {
+        lock = std::unique_lock<std::mutex>(scheduler->output);
+    }
+    if (std::holds_alternative<int64_t>(value) || std::holds_alternative<double>(value)) {
+        // Numbers are formatted with their newline and written at once
+        char text[NUMBER_TEXT_MAX + 1];
+        char* end = std::holds_alternative<int64_t>(value) ? formatNumber(std::get<int64_t>(value), text)
+                                                           : formatNumber(std::get<double>(value), text);
+        *end++ = '\n';
+        out.write(text, end - text);
     } else if (std::holds_alternative<bool>(value)) {
-        std::cout << (std::get<bool>(value) ? "true" : "false") << "\n";
-    } else if (std::holds_alternative<std::string>(value)) {
-        std::cout << std::get<std::string>(value) << "\n";
+        out << (std::get<bool>(value) ? "true" : "false") << "\n";
+    } else if (std::holds_alternative<StringRef>(value)) {
+        out << std::get<StringRef>(value) << "\n";
+    } else {
+        char text[NUMBER_TEXT_MAX];
+        out << textOf(value, text) << "\n";
     }
 }
 
@@ -320,22 +1269,33 @@ bool VirtualMachine::isTruthy(const Value& value) {
     if (std::holds_alternative<bool>(value)) {
         return std::get<bool>(value);
     }
-    if (std::holds_alternative<int>(value)) {
-        return std::get<int>(value) != 0;
+    if (std::holds_alternative<int64_t>(value)) {
+        return std::get<int64_t>(value) != 0;
     }
     if (std::holds_alternative<double>(value)) {
         return std::get<double>(value) != 0.0;
     }
-    if (std::holds_alternative<std::string>(value)) {
-        return !std::get<std::string>(value).empty();
+    if (std::holds_alternative<StringRef>(value)) {
+        return !std::get<StringRef>(value).empty();
     }
-    return false;
+    return true;  // Objects
 }
 
 void VirtualMachine::runtimeError(const std::string& message) {
     throw std::runtime_error("Runtime error: " + message);
 }
 
+void VirtualMachine::handleSnapshot() {
+    if (snapshotPath.empty()) {
+        return;
+    }
+    if (scheduler && scheduler->hasTasks()) {
+        runtimeError("Cannot save a checkpoint while tasks are running or waiting");
+    }
+    writeSnapshot(snapshotPath, *currentProgram, pc + 1, variables);
+    snapshotPath.clear();
+}
+
 void VirtualMachine::handleHalt() {
     // Do nothing, execution will stop after this instruction
 } 
\ No newline at end of file
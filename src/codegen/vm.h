@@ -1,47 +1,209 @@
 #pragma once
 
 #include "bytecode.h"
+#include "verifier.h"
+#include <cstdint>
+#include <iostream>
+#include <memory>
 #include <vector>
 #include <stack>
 #include <unordered_map>
 #include <variant>
 
+class Snapshot;
+class TraceSink;
+class ProfileRecorder;
+class Scheduler;
+struct Task;
+class Map;
+
 class VirtualMachine {
 public:
-    VirtualMachine();
+    // Limits on recursion depth and on the value stack, in values. Code
+    // compiled by emitC() enforces the same limits.
+    static constexpr size_t MAX_CALL_DEPTH = 10000;
+    static constexpr size_t STACK_SLOTS = 1 << 18;
+    
+    explicit VirtualMachine(std::ostream& out = std::cout, std::ostream& err = std::cerr);
+    
+    // Execute a bytecode program; returns false if it failed verification or
+    // stopped on a runtime error, its own or a task's. Returns once the main
+    // code has finished and no task is running (see tasks.h).
+    bool execute(const BytecodeProgram& program);
+    
+    // Run the top-level code of a program that extends the last one run by
+    // adding functions, globals and new top-level code (see
+    // CodeGenerator::generateNext). Globals keep their values, and functions
+    // that were verified before are not verified again.
+    bool executeNext(const BytecodeProgram& program);
+    
+    // Continue a program from a snapshot, which must outlive the VM's use of
+    // it; returns false like execute()
+    bool resume(const Snapshot& snapshot);
+    
+    // Save the state to `path` the first time a checkpoint is reached
+    void setSnapshotPath(const std::string& path) { snapshotPath = path; }
+    
+    // Record every executed instruction into `sink` (see trace/trace.h);
+    // null turns tracing off
+    void setTrace(TraceSink* sink) { trace = sink; }
+    
+    // Count branches and operand types into `recorder` (see
+    // profile/profile.h); null turns profiling off
+    void setProfile(ProfileRecorder* recorder) { profile = recorder; }
     
-    // Execute a bytecode program
-    void execute(const BytecodeProgram& program);
+    // Skip the verifier and check every instruction while it runs instead;
+    // for debugging the code generator
+    void setChecked(bool value) { checked = value; }
+    
+    // Whether readAll() and lines() may open files; standard input ("-")
+    // can always be read
+    void setFileInput(bool value) { fileInput = value; }
+    
+    // A point where the whole state of the program is in its globals: top-
+    // level code with an empty operand stack
+    struct SafePoint {
+        size_t pc = 0;
+        uint64_t executed = 0;  // Instructions run before reaching it
+        bool current = false;   // The VM stopped here rather than past it
+    };
+    
+    // Compile-time evaluation (see partial_eval.h): runs `program` for at
+    // most `budget` instructions and returns the last safe point reached.
+    // Stops at the first safe point once the budget is spent, and at HALT
+    // and checkpoints. Stops past the last safe point before a parallel loop,
+    // a spawn, a new channel or reading input, on a runtime error, or when
+    // the budget runs out elsewhere. Throws std::runtime_error if the program
+    // fails verification.
+    SafePoint evaluate(const BytecodeProgram& program, uint64_t budget);
+    const std::vector<Value>& globals() const { return variables; }
     
 private:
-    // Execution state
+    friend class Scheduler;
+    
+    // Activation record of a function call. The frame's slots live in the
+    // value stack itself, starting at `base` with the arguments in place.
+    struct CallFrame {
+        size_t returnPc;
+        size_t base;
+    };
+    
+    // Where PRINT writes and runtime errors are reported
+    std::ostream& out;
+    std::ostream& err;
+    
+    // Execution state. The value stack is allocated once; `sp` is the number
+    // of live values. Verified programs are proven not to overrun it except
+    // through calls, which check the callee's frame size.
     std::vector<Value> stack;
+    size_t sp = 0;
     std::vector<Value> variables;
+    std::vector<CallFrame> frames;
     size_t pc;  // Program counter
-    BytecodeProgram currentProgram;  // Current program being executed
+    const BytecodeProgram* currentProgram = nullptr;  // Current program being executed
+    bool parallelWorker = false;  // Runs chunks of a parallel loop
+    bool checked = false;         // Runtime checks instead of the verifier
+    bool fileInput = true;        // See setFileInput()
+    // Stack depths proven by the verifier, shared with workers and tasks
+    std::shared_ptr<const StackBounds> bounds;
+    // Tasks of the current run, once there are any; the main VM owns them
+    Scheduler* scheduler = nullptr;
+    std::shared_ptr<Scheduler> ownScheduler;
+    Task* task = nullptr;         // The task this VM runs, if any
+    std::string snapshotPath;     // Empty: checkpoints do nothing
+    TraceSink* trace = nullptr;
+    ProfileRecorder* profile = nullptr;
+    size_t pendingBranch = SIZE_MAX;  // Conditional jump just run, if profiling
+    uint64_t budget = 0;          // Instructions evaluate() may run
+    uint64_t executed = 0;
+    SafePoint safePoint;
+    
+    // What one chunk of a parallel loop hands back to the launching VM
+    struct ChunkResult {
+        std::string output;
+        std::vector<Value> reductions;
+        std::string error;
+    };
+    
+    // Runs from pc until HALT, the end of a parallel loop body or task, or
+    // until a task parks on a channel. The unchecked instantiation trusts the
+    // verifier; the untraced one has no tracing or profiling code at all.
+    // The budgeted one counts instructions for evaluate().
+    template <bool Checked, bool Traced, bool Budgeted = false>
+    void run();
+    void runMode();
+    void traceInstruction(const Instruction& instr);
+    bool start(const BytecodeProgram& program, size_t startPc, const std::vector<Value>* globals,
+               bool extend = false);
+    void checkInstruction(const Instruction& instr);
     
     // Helper methods
-    void push(Value value);
-    Value pop();
-    Value peek();
+    void push(const Value& value) { stack[sp++] = value; }
+    void push(Value&& value) { stack[sp++] = std::move(value); }
+    Value pop() { return std::move(stack[--sp]); }
+    void ensureFrame(size_t base, const FunctionInfo& fn, size_t depth);
+    bool growStack(size_t size);
     Value convertToNumber(const Value& value);
+    // `scratch` has room for NUMBER_TEXT_MAX characters
+    static std::string_view textOf(const Value& value, char* scratch);
     
     // Instruction handlers
     void handlePush(const Instruction& instr);
     void handlePop();
     void handleStore(const Instruction& instr);
     void handleLoad(const Instruction& instr);
+    void handleStoreLocal(const Instruction& instr);
+    void handleLoadLocal(const Instruction& instr);
+    int64_t intArith(OpCode op, int64_t a, int64_t b);
+    [[noreturn]] void intArithError(OpCode op, int64_t b);
+    template <OpCode Op> bool combineInPlace();
+    Value add(const Value& a, const Value& b);
+    Value subtract(const Value& a, const Value& b);
     void handleAdd();
     void handleSub();
     void handleMul();
     void handleDiv();
     void handleCmp(OpCode op);
+    bool compareValues(OpCode op, const Value& a, const Value& b);
     void handleJmp(const Instruction& instr);
     bool handleJmpIfFalse();  // Returns true if we jumped
+    bool handleJmpIfTrue();
+    bool handleCompareJump(const Instruction& instr);
+    void handleIntArith(OpCode op);
+    bool handleIntCompareJump(const Instruction& instr);
+    bool handleLoopIncJmp(const Instruction& instr);  // Returns true if we jumped
+    void handleIter();
+    bool handleIterNext(const Instruction& instr);    // Returns true if we jumped
+    void handleCall(const Instruction& instr);
+    void handleTailCall(const Instruction& instr);
+    void handleRet();
+    void handleParallelFor(const Instruction& instr);
+    void runParallelChunk(size_t loopIndex, long long first, long long count,
+                          const std::vector<Value>& initial, ChunkResult& result);
+    Value combineReduction(ReductionKind kind, const Value& acc, const Value& part);
+    void handleSpawn(const Instruction& instr);
+    void handleChannelNew();
+    Map* mapOperand(const Value& value);
+    Value mapKey(Value key);  // The key normalized, see Map::normalizeKey()
+    void handleMapNew(const Instruction& instr);
+    void handleMapInsert();
+    void handleIndex();
+    void handleIndexSet();
+    void handleMapKeyOp(OpCode op);  // MAP_HAS and MAP_DELETE
+    void handleMapSize();
+    bool handleChannelOp(OpCode op);  // Returns false if the task parked
+    Scheduler& ensureScheduler();
+    void stopTasks();
+    void handleReadLine();
+    void handleReadAll();
+    void handleLines();
+    ObjectRef openInput(const Value& path, const char* builtin);
     void handlePrint();
+    void handleSnapshot();
     void handleHalt();
     
     // Utility methods
+    Value& slot(bool local, int index);
     bool isTruthy(const Value& value);
-    void runtimeError(const std::string& message);
+    [[noreturn]] void runtimeError(const std::string& message);
 }; 
\ No newline at end of file
@@ -0,0 +1,301 @@
+#include "incremental.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../codegen/codegen.h"
+#include "../codegen/serializer.h"
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+static const uint32_t CACHE_MAGIC = 0x49504d43;  // "CMPI"
+static const uint32_t CACHE_VERSION = 10;
+
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Skips a string literal or comment starting at `i`; returns false if there
+// is none there.
+static bool skipLiteralOrComment(const std::string& source, size_t& i) {
+    size_t n = source.size();
+    if (source[i] == '"') {
+        i++;
+        while (i < n && source[i] != '"') i++;
+        if (i < n) i++;
+        return true;
+    }
+    if (source[i] == '/' && i + 1 < n && source[i + 1] == '/') {
+        while (i < n && source[i] != '\n') i++;
+        return true;
+    }
+    if (source[i] == '/' && i + 1 < n && source[i + 1] == '*') {
+        i += 2;
+        while (i + 1 < n && !(source[i] == '*' && source[i + 1] == '/')) i++;
+        i = (i + 1 < n) ? i + 2 : n;
+        return true;
+    }
+    return false;
+}
+
+static void skipTrivia(const std::string& source, size_t& i) {
+    while (i < source.size()) {
+        char c = source[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            i++;
+        } else if (c == '/' && i + 1 < source.size() && (source[i + 1] == '/' || source[i + 1] == '*')) {
+            skipLiteralOrComment(source, i);
+        } else {
+            break;
+        }
+    }
+}
+
+static std::string wordAt(const std::string& source, size_t i) {
+    size_t start = i;
+    while (i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_')) i++;
+    return source.substr(start, i - start);
+}
+
+// Bytes that must follow a closing brace to tell whether an `else` comes next
+static const size_t ELSE_LOOKAHEAD = 5;
+
+bool nextTopLevel(const std::string& source, size_t pos, bool atEnd, SourceChunk& chunk) {
+    size_t i = pos;
+    size_t n = source.size();
+    skipTrivia(source, i);
+    if (i >= n) return false;
+    
+    // Compound statements end at their closing brace, others at ';'
+    size_t start = i;
+    std::string first = wordAt(source, i);
+    bool braced = source[i] == '{' || first == "fun" || first == "if" ||
+                  first == "while" || first == "for" || first == "parallel" || first == "spawn";
+    int depth = 0;
+    bool closed = false;
+    
+    while (i < n && !closed) {
+        if (skipLiteralOrComment(source, i)) continue;
+        char c = source[i++];
+        if (c == '(' || c == '{' || c == '[') {
+            depth++;
+        } else if (c == ')' || c == ']') {
+            if (depth > 0) depth--;
+        } else if (c == '}') {
+            if (depth > 0) depth--;
+            if (depth == 0 && braced) {
+                size_t next = i;
+                skipTrivia(source, next);
+                if (!atEnd && n - next < ELSE_LOOKAHEAD) return false;
+                closed = wordAt(source, next) != "else";
+            }
+        } else if (c == ';' && depth == 0) {
+            closed = true;
+        }
+    }
+    if (!closed && !atEnd) return false;
+    chunk = {start, i};
+    return true;
+}
+
+std::vector<SourceChunk> splitTopLevel(const std::string& source) {
+    std::vector<SourceChunk> chunks;
+    SourceChunk chunk;
+    size_t i = 0;
+    while (nextTopLevel(source, i, true, chunk)) {
+        chunks.push_back(chunk);
+        i = chunk.end;
+    }
+    return chunks;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+IncrementalCompiler::IncrementalCompiler(const std::string& cachePath) : cachePath(cachePath) {
+    loadCache();
+}
+
+BytecodeProgram IncrementalCompiler::compile(const std::string& source) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SourceChunk> chunks = splitTopLevel(source);
+    
+    // Per statement: the cache entry it ends up with, and whether it was reused
+    std::vector<CacheEntry> entries(chunks.size());
+    std::vector<bool> reusable(chunks.size(), false);
+    std::unordered_map<Symbol, size_t> functionChunks;
+    
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const SourceChunk& chunk = chunks[i];
+        uint64_t hash = hashBytes(source.data() + chunk.begin, chunk.end - chunk.begin);
+        auto it = cache.find(hash);
+        if (it != cache.end()) {
+            entries[i] = it->second;
+            reusable[i] = true;
+        } else {
+            entries[i].hash = hash;
+            Lexer lexer(source.substr(chunk.begin, chunk.end - chunk.begin), symbols);
+            entries[i].tokens = lexer.tokenize();
+            if (entries[i].tokens.size() > 1 && entries[i].tokens[0].type == TokenType::FUN &&
+                entries[i].tokens[1].type == TokenType::IDENTIFIER) {
+                entries[i].functionName = entries[i].tokens[1].value;
+            }
+        }
+        if (!entries[i].functionName.empty()) {
+            functionChunks[symbols.intern(entries[i].functionName)] = i;
+        }
+    }
+    
+    // A cached unit is stale if a function it depends on has changed
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (!reusable[i]) continue;
+        for (const auto& dependency : entries[i].unit.dependencies) {
+            auto it = functionChunks.find(symbols.intern(dependency.first));
+            if (it == functionChunks.end() || entries[it->second].hash != dependency.second) {
+                reusable[i] = false;
+                break;
+            }
+        }
+    }
+    
+    // ASTs are built lazily: for changed statements, and for functions a
+    // changed statement calls
+    std::vector<std::unique_ptr<BlockStmt>> asts(chunks.size());
+    auto parseChunk = [&](size_t i) -> BlockStmt* {
+        if (!asts[i]) {
+            if (entries[i].tokens.empty()) {
+                Lexer lexer(source.substr(chunks[i].begin, chunks[i].end - chunks[i].begin), symbols);
+                entries[i].tokens = lexer.tokenize();
+            }
+            Parser parser(entries[i].tokens);
+            asts[i] = std::make_unique<BlockStmt>(parser.parse());
+        }
+        return asts[i].get();
+    };
+    CodeGenerator::FunctionResolver resolver = [&](Symbol name) -> FunctionStmt* {
+        auto it = functionChunks.find(name);
+        if (it == functionChunks.end()) return nullptr;
+        BlockStmt* block = parseChunk(it->second);
+        if (block->statements.size() != 1) return nullptr;
+        return dynamic_cast<FunctionStmt*>(block->statements[0].get());
+    };
+    
+    size_t reused = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (reusable[i]) {
+            reused++;
+            continue;
+        }
+        CodeGenerator generator(symbols);
+        entries[i].unit = generator.generateUnit(parseChunk(i), resolver);
+        for (auto& dependency : entries[i].unit.dependencies) {
+            dependency.second = entries[functionChunks[symbols.intern(dependency.first)]].hash;
+        }
+    }
+    
+    std::vector<const BytecodeUnit*> units;
+    for (const auto& entry : entries) {
+        units.push_back(&entry.unit);
+    }
+    BytecodeProgram program = link(units);
+    
+    lastStats = IncrementalStats();
+    lastStats.statements = chunks.size();
+    lastStats.reused = reused;
+    lastStats.compileMs = elapsedMs(start);
+    lastStats.full = reused == 0;
+    if (lastStats.full) {
+        lastFullCompileMs = lastStats.compileMs;
+    }
+    lastStats.lastFullCompileMs = lastFullCompileMs;
+    
+    // Only tokens of functions are needed later
+    for (auto& entry : entries) {
+        if (entry.functionName.empty()) entry.tokens.clear();
+    }
+    saveCache(entries);
+    cache.clear();
+    for (auto& entry : entries) {
+        cache[entry.hash] = std::move(entry);
+    }
+    return program;
+}
+
+void IncrementalCompiler::loadCache() {
+    std::ifstream file(cachePath, std::ios::binary);
+    if (!file.is_open()) return;
+    
+    // A corrupt or outdated cache is simply ignored
+    try {
+        BytecodeReader reader(file);
+        if (reader.readU32() != CACHE_MAGIC || reader.readU32() != CACHE_VERSION) return;
+        lastFullCompileMs = reader.readU64() / 1000.0;
+        uint32_t count = reader.readU32();
+        for (uint32_t i = 0; i < count; i++) {
+            CacheEntry entry;
+            entry.hash = reader.readU64();
+            entry.functionName = reader.readString();
+            uint32_t tokenCount = reader.readU32();
+            for (uint32_t t = 0; t < tokenCount; t++) {
+                Token token;
+                token.type = static_cast<TokenType>(reader.readU8());
+                token.value = reader.readString();
+                if (token.type == TokenType::IDENTIFIER) {
+                    token.symbol = symbols.intern(token.value);
+                }
+                if (reader.readU8()) {
+                    Value literal = reader.readValue();
+                    if (auto* i = std::get_if<int64_t>(&literal)) token.literal = *i;
+                    else if (auto* d = std::get_if<double>(&literal)) token.literal = *d;
+                    else if (auto* b = std::get_if<bool>(&literal)) token.literal = *b;
+                }
+                entry.tokens.push_back(token);
+            }
+            entry.unit = reader.readUnit();
+            cache[entry.hash] = std::move(entry);
+        }
+    } catch (const std::exception&) {
+        cache.clear();
+    }
+}
+
+void IncrementalCompiler::saveCache(const std::vector<CacheEntry>& entries) {
+    // Write to a temporary file first so readers never see a partial cache;
+    // it is named after the process, since another may save the same cache
+    std::string tempPath = cachePath + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        BytecodeWriter writer(file);
+        writer.writeU32(CACHE_MAGIC);
+        writer.writeU32(CACHE_VERSION);
+        writer.writeU64(static_cast<uint64_t>(lastFullCompileMs * 1000.0));
+        writer.writeU32(static_cast<uint32_t>(entries.size()));
+        for (const auto& entry : entries) {
+            writer.writeU64(entry.hash);
+            writer.writeString(entry.functionName);
+            writer.writeU32(static_cast<uint32_t>(entry.tokens.size()));
+            for (const auto& token : entry.tokens) {
+                writer.writeU8(static_cast<uint8_t>(token.type));
+                writer.writeString(token.value);
+                writer.writeU8(token.literal.index() != 0);
+                if (auto* i = std::get_if<int64_t>(&token.literal)) writer.writeValue(*i);
+                else if (auto* d = std::get_if<double>(&token.literal)) writer.writeValue(*d);
+                else if (auto* b = std::get_if<bool>(&token.literal)) writer.writeValue(*b);
+            }
+            writer.writeUnit(entry.unit);
+        }
+        if (!file) return;
+    }
+    std::rename(tempPath.c_str(), cachePath.c_str());
+}
@@ -0,0 +1,70 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "../lexer/token.h"
+#include "../codegen/bytecode.h"
+#include "../codegen/linker.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Source range [begin, end) of one top-level statement
+struct SourceChunk {
+    size_t begin;
+    size_t end;
+};
+
+// Splits source into top-level statements without lexing it: tracks
+// strings, comments and bracket depth only. Leading whitespace and
+// comments between statements are not part of any chunk.
+std::vector<SourceChunk> splitTopLevel(const std::string& source);
+
+// The first statement at or after `pos`, for reading a source in pieces.
+// Unless `atEnd`, returns false when `source` might end before the statement
+// does; otherwise false means only whitespace and comments are left.
+bool nextTopLevel(const std::string& source, size_t pos, bool atEnd, SourceChunk& chunk);
+
+// 64-bit FNV-1a
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+struct IncrementalStats {
+    size_t statements = 0;
+    size_t reused = 0;         // Statements whose bytecode came from the cache
+    double compileMs = 0;
+    double lastFullCompileMs = 0;
+    bool full = false;         // True if nothing could be reused
+};
+
+// Compiles a program statement by statement, keeping the tokens and bytecode
+// of each top-level statement in a cache file keyed by a hash of its text.
+// On the next compile only statements whose text changed, or whose inlined
+// or called functions changed, are lexed, parsed and generated again; the
+// rest are relinked from the cache.
+class IncrementalCompiler {
+public:
+    explicit IncrementalCompiler(const std::string& cachePath);
+    
+    BytecodeProgram compile(const std::string& source);
+    const IncrementalStats& stats() const { return lastStats; }
+    
+private:
+    struct CacheEntry {
+        uint64_t hash = 0;
+        std::string functionName;   // Empty unless the statement is a `fun`
+        std::vector<Token> tokens;  // Kept for functions only, for lazy reparse
+        BytecodeUnit unit;
+    };
+    
+    std::string cachePath;
+    std::unordered_map<uint64_t, CacheEntry> cache;
+    // Numbers the identifiers of cached tokens as well as newly lexed ones
+    SymbolTable symbols;
+    double lastFullCompileMs = 0;
+    IncrementalStats lastStats;
+    
+    void loadCache();
+    void saveCache(const std::vector<CacheEntry>& entries);
+};
+
+#endif
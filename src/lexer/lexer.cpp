@@ -1,8 +1,18 @@
 #include "lexer.h"
+#include "scan.h"
 #include <cctype>
-#include <map>
+#include <charconv>
+#include <array>
+#include <string_view>
 
-static std::map<std::string, TokenType> keywords = {
+namespace {
+
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword KEYWORDS[] = {
     {"var", TokenType::VAR},
     {"if", TokenType::IF},
     {"else", TokenType::ELSE},
@@ -11,10 +21,63 @@ static std::map<std::string, TokenType> keywords = {
     {"true", TokenType::BOOLEAN},
     {"false", TokenType::BOOLEAN},
     {"null", TokenType::NULL_TYPE},
-    {"print", TokenType::PRINT}
+    {"print", TokenType::PRINT},
+    {"fun", TokenType::FUN},
+    {"return", TokenType::RETURN}
 };
 
-Lexer::Lexer(const std::string &source) : source(source), index(0) {}
+// Keywords are found through a perfect hash of (first char, last char,
+// length). The multiplier is searched for at compile time so adding a keyword
+// only needs a new table entry.
+constexpr uint32_t KEYWORD_BITS = 5;
+constexpr size_t KEYWORD_SLOTS = size_t(1) << KEYWORD_BITS;
+
+constexpr uint32_t keywordHash(std::string_view word, uint32_t seed) {
+    uint32_t key = (static_cast<uint32_t>(static_cast<unsigned char>(word.front())) << 16) |
+                   (static_cast<uint32_t>(static_cast<unsigned char>(word.back())) << 8) |
+                   static_cast<uint32_t>(word.size());
+    return (key * seed) >> (32 - KEYWORD_BITS);
+}
+
+constexpr bool isPerfect(uint32_t seed) {
+    bool used[KEYWORD_SLOTS] = {};
+    for (const Keyword& keyword : KEYWORDS) {
+        uint32_t h = keywordHash(keyword.text, seed);
+        if (used[h]) return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findSeed() {
+    for (uint32_t seed = 0x9E3779B1u; seed != 0; seed += 2) {
+        if (isPerfect(seed)) return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t KEYWORD_SEED = findSeed();
+static_assert(KEYWORD_SEED != 0, "No perfect hash for the keyword table");
+
+constexpr std::array<Keyword, KEYWORD_SLOTS> buildKeywordTable() {
+    std::array<Keyword, KEYWORD_SLOTS> table{};
+    for (auto& slot : table) slot = {"", TokenType::IDENTIFIER};
+    for (const Keyword& keyword : KEYWORDS) {
+        table[keywordHash(keyword.text, KEYWORD_SEED)] = keyword;
+    }
+    return table;
+}
+
+constexpr std::array<Keyword, KEYWORD_SLOTS> KEYWORD_TABLE = buildKeywordTable();
+
+TokenType lookupKeyword(std::string_view word) {
+    const Keyword& slot = KEYWORD_TABLE[keywordHash(word, KEYWORD_SEED)];
+    return slot.text == word ? slot.type : TokenType::IDENTIFIER;
+}
+
+} // namespace
+
+Lexer::Lexer(const std::string &source, SymbolTable &symbols) : source(source), index(0), symbols(symbols) {}
 
 char Lexer::peek()
 {
@@ -33,74 +96,119 @@ char Lexer::advance()
 
 void Lexer::skipWhiteSpace()
 {
-    while (index < source.length()) {
-        char c = peek();
-        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-            advance();
-        } else {
-            break;
-        }
-    }
+    const char* data = source.data();
+    index = scan::skipSpaces(data + index, data + source.length()) - data;
 }
 
 Token Lexer::identifierOrKeyword()
 {
-    std::string value;
-    while (isalnum(peek()) || peek() == '_')
+    const char* data = source.data();
+    size_t start = index;
+    index = scan::skipIdent(data + index, data + source.length()) - data;
+    std::string_view word(data + start, index - start);
+
+    TokenType type = lookupKeyword(word);
+    if (type == TokenType::BOOLEAN)
     {
-        value += advance();
+        return {TokenType::BOOLEAN, std::string(word), word == "true"};
     }
-
-    auto it = keywords.find(value);
-    if (it != keywords.end())
+    if (type == TokenType::IDENTIFIER)
     {
-        return {it->second, value};
+        return {type, std::string(word), {}, symbols.intern(word)};
     }
-
-    return {TokenType::IDENTIFIER, value};
+    return {type, std::string(word)};
 }
 
 Token Lexer::number()
 {
-    std::string value;
-    bool hasDecimal = false;
-    
-    while (isdigit(peek()) || (!hasDecimal && peek() == '.'))
+    size_t start = index;
+
+    // Hexadecimal integer: 0x1F
+    if (peek() == '0' && (peekNext() == 'x' || peekNext() == 'X'))
     {
-        if (peek() == '.') {
-            hasDecimal = true;
+        advance();
+        advance();
+        size_t digits = index;
+        while (isxdigit(peek()))
+        {
+            advance();
+        }
+        std::string text = source.substr(start, index - start);
+        int64_t i = 0;
+        auto result = std::from_chars(source.data() + digits, source.data() + index, i, 16);
+        if (index == digits)
+        {
+            return {TokenType::ERROR, "Invalid hex literal: " + text};
+        }
+        if (result.ec == std::errc::result_out_of_range)
+        {
+            return {TokenType::ERROR, "Integer literal out of range: " + text};
+        }
+        return {TokenType::NUMBER, text, i};
+    }
+
+    const char* data = source.data();
+    const char* limit = data + source.length();
+    bool isDouble = false;
+    index = scan::skipDigits(data + index, limit) - data;
+    if (peek() == '.')
+    {
+        isDouble = true;
+        advance();
+        index = scan::skipDigits(data + index, limit) - data;
+    }
+    // Exponent: 1e9, 2.5E-3
+    if (peek() == 'e' || peek() == 'E')
+    {
+        char sign = peekNext();
+        size_t digitAt = (sign == '+' || sign == '-') ? index + 2 : index + 1;
+        if (digitAt < source.length() && scan::isDigit(source[digitAt]))
+        {
+            isDouble = true;
+            index = scan::skipDigits(data + digitAt, limit) - data;
         }
-        value += advance();
     }
-    
-    // Convert string to number
-    try {
-        if (hasDecimal) {
-            double d = std::stod(value);
-            return {TokenType::NUMBER, std::to_string(d)};
-        } else {
-            int i = std::stoi(value);
-            return {TokenType::NUMBER, std::to_string(i)};
+
+    const char* first = source.data() + start;
+    const char* last = source.data() + index;
+    std::string text(first, last);
+
+    if (isDouble)
+    {
+        double d = 0;
+        auto result = std::from_chars(first, last, d);
+        if (result.ec == std::errc::result_out_of_range)
+        {
+            return {TokenType::ERROR, "Number literal out of range: " + text};
+        }
+        if (result.ec != std::errc() || result.ptr != last)
+        {
+            return {TokenType::ERROR, "Invalid number: " + text};
         }
-    } catch (...) {
-        return {TokenType::ERROR, "Invalid number"};
+        return {TokenType::NUMBER, text, d};
+    }
+
+    int64_t i = 0;
+    auto result = std::from_chars(first, last, i);
+    if (result.ec == std::errc::result_out_of_range)
+    {
+        return {TokenType::ERROR, "Integer literal out of range: " + text};
     }
+    return {TokenType::NUMBER, text, i};
 }
 
 Token Lexer::string()
 {
     advance(); // Skip the opening quote
-    std::string value;
-
-    while (peek() != '"' && peek() != '\0')
-    {
-        value += advance();
-    }
+    const char* data = source.data();
+    size_t start = index;
+    index = scan::findChar(data + index, data + source.length(), '"') - data;
 
-    if (peek() == '"')
+    if (index < source.length())
     {
+        std::string value(data + start, index - start);
         advance();
-        return {TokenType::STRING, value};
+        return {TokenType::STRING, std::move(value)};
     }
 
     return {TokenType::ERROR, "Unterminated string"};
@@ -109,6 +217,9 @@ Token Lexer::string()
 std::vector<Token> Lexer::tokenize()
 {
     std::vector<Token> tokens;
+    // Typical sources average more than 6 bytes per token; reserving up front
+    // avoids repeatedly moving the token array as it grows
+    tokens.reserve(source.length() / 6 + 16);
     while (index < source.length())
     {
         skipWhiteSpace();
@@ -119,34 +230,24 @@ std::vector<Token> Lexer::tokenize()
         if (peek() == '/' && peekNext() == '/')
         {
             // Single-line comment
-            while (peek() != '\n' && peek() != '\0')
-            {
-                advance();
-            }
+            const char* data = source.data();
+            index = scan::findChar(data + index, data + source.length(), '\n') - data;
             continue;
         }
         if (peek() == '/' && peekNext() == '*')
         {
-            advance();
-            advance(); // Skip `/*`
-            while (!(peek() == '*' && peekNext() == '/') && peek() != '\0')
-            {
-                advance();
-            }
-            if (peek() == '*' && peekNext() == '/')
-            {
-                advance();
-                advance(); // Skip `*/`
-            }
+            // Block comment, up to and including `*/`
+            const char* data = source.data();
+            index = scan::skipBlockComment(data + index + 2, data + source.length()) - data;
             continue;
         }
 
         // Handle other tokens
-        if (isalpha(peek()) || peek() == '_')
+        if (scan::isIdentStart(peek()))
         {
             tokens.push_back(identifierOrKeyword());
         }
-        else if (isdigit(peek()))
+        else if (scan::isDigit(peek()))
         {
             tokens.push_back(number());
         }
@@ -186,7 +287,7 @@ std::vector<Token> Lexer::tokenize()
                 case '=':
                     if (peekNext() == '=')
                     {
-                        tokens.push_back({TokenType::EQUAL, "=="});
+                        tokens.push_back({TokenType::EQUAL_EQUAL, "=="});
                         advance();
                         advance();
                     }
@@ -196,6 +297,14 @@ std::vector<Token> Lexer::tokenize()
                         advance();
                     }
                     break;
+                case ',':
+                    tokens.push_back({TokenType::COMMA, ","});
+                    advance();
+                    break;
+                case ':':
+                    tokens.push_back({TokenType::COLON, ":"});
+                    advance();
+                    break;
                 case ';':
                     tokens.push_back({TokenType::SEMICOLON, ";"});
                     advance();
@@ -8,13 +8,15 @@
 
 class Lexer {
     public:
-        explicit Lexer(const std::string &source);
+        // Identifiers are interned into `symbols`, which must outlive the tokens' use
+        Lexer(const std::string &source, SymbolTable &symbols);
         //to convert source code into tokens
         std::vector<Token> tokenize();
     private:
 
         std::string source;
         size_t index = 0;
+        SymbolTable &symbols;
 
         //look at current character
         char peek();
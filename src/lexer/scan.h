@@ -0,0 +1,165 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+// Character-class scanners used by the lexer. Each returns a pointer to the
+// first byte in [p, end) that does NOT belong to the class (or, for the find*
+// functions, to the first byte that matches). With SSE2/AVX2 available the
+// input is examined 16/32 bytes at a time; the remaining tail and non-x86
+// builds use the scalar loops.
+
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace scan {
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline bool isIdentStart(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+inline bool isIdent(char c) {
+    return isIdentStart(c) || isDigit(c);
+}
+
+#if defined(__AVX2__)
+
+using Vec = __m256i;
+constexpr int WIDTH = 32;
+
+inline Vec load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const Vec*>(p)); }
+inline Vec splat(char c) { return _mm256_set1_epi8(c); }
+inline Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vec gt(Vec a, Vec b) { return _mm256_cmpgt_epi8(a, b); }
+inline Vec orv(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec andv(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+inline uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+constexpr uint32_t FULL = 0xFFFFFFFFu;
+
+#elif defined(__SSE2__)
+
+using Vec = __m128i;
+constexpr int WIDTH = 16;
+
+inline Vec load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const Vec*>(p)); }
+inline Vec splat(char c) { return _mm_set1_epi8(c); }
+inline Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+inline Vec gt(Vec a, Vec b) { return _mm_cmpgt_epi8(a, b); }
+inline Vec orv(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec andv(Vec a, Vec b) { return _mm_and_si128(a, b); }
+inline uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+constexpr uint32_t FULL = 0xFFFFu;
+
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#define COMPII_SIMD_SCAN 1
+
+// Bytes in [lo, hi]. The compares are signed, so bytes >= 0x80 never match.
+inline Vec inRange(Vec v, char lo, char hi) {
+    return andv(gt(v, splat(static_cast<char>(lo - 1))), gt(splat(static_cast<char>(hi + 1)), v));
+}
+
+inline Vec spaceMask(Vec v) {
+    return orv(orv(eq(v, splat(' ')), eq(v, splat('\n'))),
+               orv(eq(v, splat('\t')), eq(v, splat('\r'))));
+}
+
+inline Vec digitMask(Vec v) {
+    return inRange(v, '0', '9');
+}
+
+inline Vec identMask(Vec v) {
+    // Setting bit 5 folds 'A'-'Z' onto 'a'-'z'
+    Vec lower = orv(v, splat(0x20));
+    return orv(orv(inRange(lower, 'a', 'z'), digitMask(v)), eq(v, splat('_')));
+}
+#endif
+
+// Most identifiers, numbers and whitespace runs are only a few bytes long, so
+// the first bytes are checked one at a time and the vector loop only takes
+// over for longer runs (indentation, comments, string literals).
+constexpr int SHORT_RUN = 8;
+
+// Advances past bytes that satisfy `test`; `vecTest` marks the same bytes
+// in a vector.
+template <typename Test, typename VecTest>
+inline const char* skipWhile(const char* p, const char* end, Test test, VecTest vecTest) {
+    const char* shortEnd = end - p > SHORT_RUN ? p + SHORT_RUN : end;
+    while (p < shortEnd) {
+        if (!test(*p)) return p;
+        p++;
+    }
+#ifdef COMPII_SIMD_SCAN
+    while (end - p >= WIDTH) {
+        uint32_t bits = mask(vecTest(load(p))) ^ FULL;
+        if (bits) return p + __builtin_ctz(bits);
+        p += WIDTH;
+    }
+#else
+    (void)vecTest;
+#endif
+    while (p < end && test(*p)) p++;
+    return p;
+}
+
+#ifdef COMPII_SIMD_SCAN
+#define COMPII_VEC_TEST(fn) [](Vec v) { return fn(v); }
+#else
+#define COMPII_VEC_TEST(fn) nullptr
+#endif
+
+inline const char* skipSpaces(const char* p, const char* end) {
+    return skipWhile(p, end, isSpace, COMPII_VEC_TEST(spaceMask));
+}
+
+inline const char* skipDigits(const char* p, const char* end) {
+    return skipWhile(p, end, isDigit, COMPII_VEC_TEST(digitMask));
+}
+
+inline const char* skipIdent(const char* p, const char* end) {
+    return skipWhile(p, end, isIdent, COMPII_VEC_TEST(identMask));
+}
+
+#undef COMPII_VEC_TEST
+
+// Advances to the first byte equal to `c`.
+inline const char* findChar(const char* p, const char* end, char c) {
+    const char* shortEnd = end - p > SHORT_RUN ? p + SHORT_RUN : end;
+    while (p < shortEnd) {
+        if (*p == c) return p;
+        p++;
+    }
+#ifdef COMPII_SIMD_SCAN
+    Vec needle = splat(c);
+    while (end - p >= WIDTH) {
+        uint32_t bits = mask(eq(load(p), needle));
+        if (bits) return p + __builtin_ctz(bits);
+        p += WIDTH;
+    }
+#endif
+    while (p < end && *p != c) p++;
+    return p;
+}
+
+// Position just past the "*/" closing a block comment, or `end`.
+inline const char* skipBlockComment(const char* p, const char* end) {
+    while ((p = findChar(p, end, '*')) < end) {
+        if (p + 1 < end && p[1] == '/') return p + 2;
+        p++;
+    }
+    return end;
+}
+
+} // namespace scan
+
+#endif
@@ -0,0 +1,25 @@
+#include "symbol_table.h"
+
+// In the order of SymbolTable::Word
+static const char* const WORDS[] = {
+    "parallel", "spawn", "checkpoint", "import", "in", "reduce", "sum", "min", "max", "concat",
+    "channel", "send", "recv", "readLine", "readAll", "lines", "has", "delete", "size",
+};
+static_assert(sizeof(WORDS) / sizeof(WORDS[0]) == SymbolTable::WORD_COUNT, "every word needs its text");
+
+SymbolTable::SymbolTable() {
+    for (const char* word : WORDS) {
+        intern(word);
+    }
+}
+
+Symbol SymbolTable::intern(std::string_view name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    Symbol symbol = static_cast<Symbol>(names.size());
+    names.emplace_back(name);
+    ids.emplace(names.back(), symbol);
+    return symbol;
+}
@@ -0,0 +1,43 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Dense number of an identifier within one compilation (see Token::symbol)
+using Symbol = uint32_t;
+const Symbol NO_SYMBOL = UINT32_MAX;
+
+// Gives every distinct identifier a number, counting from 0 in the order they
+// are first seen, so that the parser and code generator compare and index by
+// number instead of hashing names. The lexer interns each identifier once;
+// everything compiled together must share one table.
+class SymbolTable {
+public:
+    // Words the parser and code generator give a meaning to, which have the
+    // same numbers in every table
+    enum Word : Symbol {
+        // Contextual keywords
+        PARALLEL, SPAWN, CHECKPOINT, IMPORT, IN, REDUCE, SUM, MIN, MAX, CONCAT,
+        // Builtin functions
+        CHANNEL, SEND, RECV, READ_LINE, READ_ALL, LINES, HAS, DELETE, SIZE,
+        WORD_COUNT
+    };
+
+    SymbolTable();
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    Symbol intern(std::string_view name);
+    const std::string& name(Symbol symbol) const { return names[symbol]; }
+    size_t size() const { return names.size(); }
+
+private:
+    std::deque<std::string> names;  // A deque never moves its strings, which `ids` views
+    std::unordered_map<std::string_view, Symbol> ids;
+};
+
+#endif
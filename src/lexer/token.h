@@ -2,6 +2,9 @@
 #define TOKEN_H
 
 #include<string>
+#include<cstdint>
+#include<variant>
+#include "symbol_table.h"
 
 enum class TokenType {
     // Single-character tokens
@@ -26,9 +29,14 @@ enum class TokenType {
     ERROR, EOF_TYPE
 };
 
+// Parsed value of a NUMBER or BOOLEAN token, filled in once by the lexer
+using Literal = std::variant<std::monostate, int64_t, double, bool>;
+
 struct Token {
     TokenType type;
     std::string value;
+    Literal literal{};
+    Symbol symbol = NO_SYMBOL;  // Of an IDENTIFIER, in the lexer's SymbolTable
 };
 
 
@@ -1,22 +1,191 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include "lexer/lexer.h"
 #include "parser/parser.h"
 #include "codegen/codegen.h"
 #include "codegen/vm.h"
+#include "codegen/c_emitter.h"
+#include "codegen/partial_eval.h"
+#include "codegen/serializer.h"
+#include "snapshot/snapshot.h"
+#include "trace/trace.h"
+#include "profile/profile.h"
+#include "runtime/sha256.h"
+#include "runtime/stats.h"
+#include <memory>
+#include "incremental/incremental.h"
+#include "modules/modules.h"
+#include "batch/batch.h"
+#include "stream/stream.h"
+
+// Identifies what a program does, whatever its formatting and comments:
+// the SHA-256 of its serialized bytecode. The playground shares results
+// between users by this hash, so it must not be possible to make two
+// programs collide.
+static std::string bytecodeHash(const BytecodeProgram& program) {
+    std::ostringstream bytes;
+    BytecodeWriter writer(bytes);
+    writer.writeProgram(program);
+    std::string data = bytes.str();
+    return sha256Hex(data.data(), data.size());
+}
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--incremental <cache_file> | --module-cache <dir>] [--partial-eval <fuel>] [--checked]"
+              << " [--snapshot <file>] [--trace <file>] [--trace-sample <n>] [--stats] [--no-file-input] <input_file>"
+              << std::endl;
+    std::cerr << "       " << program << " [--profile-use <file>] [--profile-out <file>] [--checked] [--stats] <input_file>"
+              << std::endl;
+    std::cerr << "       " << program << " [--checked] [--trace <file>] [--stats] [--no-file-input] --resume <snapshot_file>"
+              << std::endl;
+    std::cerr << "       " << program << " [--partial-eval <fuel>] --emit-c <out.c> <input_file>" << std::endl;
+    std::cerr << "       " << program << " [--incremental <cache_file> | --module-cache <dir>] [--partial-eval <fuel>]"
+              << " --bytecode-hash <input_file>"
+              << std::endl;
+    std::cerr << "       " << program << " --stream [--checked] [--no-file-input] <input_file>" << std::endl;
+    std::cerr << "       " << program << " --batch <dir|list_file> [--jobs <n>]" << std::endl;
+}
 
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <input_file>" << std::endl;
+        std::string inputPath;
+        std::string cachePath;
+        std::string moduleCachePath;
+        std::string batchSource;
+        size_t jobs = 0;
+        bool checked = false;
+        bool fileInput = true;  // Cleared by --no-file-input
+        bool streaming = false;
+        bool hashOnly = false;
+        std::string emitPath;
+        std::string snapshotPath;
+        std::string resumePath;
+        std::string tracePath;
+        uint32_t traceSample = 1024;
+        uint64_t fuel = 0;  // Instructions --partial-eval may run; 0 runs none
+        std::string profileOutPath;
+        std::string profileUsePath;
+        StatsReport statsReport;
+        StatsReport* report = nullptr;  // Set by --stats
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--incremental" && i + 1 < argc) {
+                cachePath = argv[++i];
+            } else if (arg == "--module-cache" && i + 1 < argc) {
+                moduleCachePath = argv[++i];
+            } else if (arg == "--batch" && i + 1 < argc) {
+                batchSource = argv[++i];
+            } else if (arg == "--jobs" && i + 1 < argc) {
+                jobs = std::stoul(argv[++i]);
+            } else if (arg == "--emit-c" && i + 1 < argc) {
+                emitPath = argv[++i];
+            } else if (arg == "--snapshot" && i + 1 < argc) {
+                snapshotPath = argv[++i];
+            } else if (arg == "--resume" && i + 1 < argc) {
+                resumePath = argv[++i];
+            } else if (arg == "--trace" && i + 1 < argc) {
+                tracePath = argv[++i];
+            } else if (arg == "--trace-sample" && i + 1 < argc) {
+                traceSample = static_cast<uint32_t>(std::stoul(argv[++i]));
+            } else if (arg == "--profile-out" && i + 1 < argc) {
+                profileOutPath = argv[++i];
+            } else if (arg == "--profile-use" && i + 1 < argc) {
+                profileUsePath = argv[++i];
+            } else if (arg == "--partial-eval" && i + 1 < argc) {
+                fuel = std::stoull(argv[++i]);
+            } else if (arg == "--stats") {
+                enableAllocationCounting();
+                report = &statsReport;
+            } else if (arg == "--bytecode-hash") {
+                hashOnly = true;
+            } else if (arg == "--stream") {
+                streaming = true;
+            } else if (arg == "--checked") {
+                checked = true;
+            } else if (arg == "--no-file-input") {
+                fileInput = false;
+            } else if (arg.rfind("--", 0) == 0 || !inputPath.empty()) {
+                printUsage(argv[0]);
+                return 1;
+            } else {
+                inputPath = arg;
+            }
+        }
+        // Machine-readable costs of this run go to stderr as one JSON line
+        auto finish = [&](int status) {
+            if (report) report->write(std::cerr);
+            return status;
+        };
+        
+        if (!batchSource.empty()) {
+            // Scripts in a batch run with the defaults; none of the per-run
+            // options apply to them
+            if (!inputPath.empty() || !cachePath.empty() || !moduleCachePath.empty() || !emitPath.empty() ||
+                !snapshotPath.empty() || !resumePath.empty() || !tracePath.empty() || !profileOutPath.empty() ||
+                !profileUsePath.empty() || fuel > 0 || report || hashOnly || streaming || checked || !fileInput) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            return runBatch(batchSource, jobs, std::cout, std::cerr);
+        }
+        if (jobs > 0) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        // Profiles describe one program compiled in full from its AST
+        bool profiling = !profileOutPath.empty() || !profileUsePath.empty();
+        if (!resumePath.empty() && inputPath.empty() && !profiling) {
+            // Warm start: program and globals come from the snapshot
+            std::unique_ptr<Snapshot> snapshot;
+            {
+                StatsReport::Scope phase(report, "load_snapshot");
+                snapshot = std::make_unique<Snapshot>(resumePath);
+            }
+            std::unique_ptr<TraceSink> trace;
+            if (!tracePath.empty()) {
+                trace = std::make_unique<TraceSink>(tracePath, snapshot->program(), traceSample);
+            }
+            VirtualMachine vm;
+            vm.setChecked(checked);
+            vm.setFileInput(fileInput);
+            vm.setTrace(trace.get());
+            bool ok;
+            {
+                StatsReport::Scope phase(report, "execute");
+                ok = vm.resume(*snapshot);
+            }
+            if (report) report->setCount("instructions", snapshot->program().instructions.size());
+            return finish(ok ? 0 : 1);
+        }
+        bool profileRun = !profileOutPath.empty() && emitPath.empty() && !hashOnly && fuel == 0;
+        bool cached = !cachePath.empty() || !moduleCachePath.empty();
+        if (inputPath.empty() || (profiling && (cached || !resumePath.empty())) || (!profileOutPath.empty() && !profileRun) ||
+            (!cachePath.empty() && !moduleCachePath.empty())) {
+            printUsage(argv[0]);
             return 1;
         }
+        if (streaming) {
+            // Statement at a time; needs the whole program for none of these
+            if (cached || !emitPath.empty() || !snapshotPath.empty() ||
+                !resumePath.empty() || !tracePath.empty() || hashOnly || fuel > 0 || profiling) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            int status;
+            {
+                StatsReport::Scope phase(report, "stream");
+                status = runStream(inputPath, checked, fileInput, std::cout, std::cerr);
+            }
+            return finish(status);
+        }
 
         // Read input from the file specified in command line argument
-        std::ifstream file(argv[1]);
+        std::ifstream file(inputPath);
         if (!file.is_open()) {
-            std::cerr << "Error: Could not open " << argv[1] << std::endl;
+            std::cerr << "Error: Could not open " << inputPath << std::endl;
             return 1;
         }
         
@@ -25,22 +194,160 @@ int main(int argc, char* argv[]) {
         std::string input = buffer.str();
         file.close();
 
-        // Lexing
-        Lexer lexer(input);
-        auto tokens = lexer.tokenize();
+        uint64_t sourceHash = hashBytes(input.data(), input.size());
+        std::unique_ptr<Profile> profile;
+        if (!profileUsePath.empty()) {
+            profile = std::make_unique<Profile>(profileUsePath);
+            if (profile->sourceHash() != sourceHash) {
+                std::cerr << "[profile] " << profileUsePath << " was recorded for a different source; ignoring it"
+                          << std::endl;
+                profile.reset();
+            }
+        }
+        
+        BytecodeProgram program;
+        std::vector<ProfileSite> sites;
+        if (!cachePath.empty()) {
+            // Incremental: reuse bytecode of unchanged statements
+            IncrementalCompiler compiler(cachePath);
+            {
+                StatsReport::Scope phase(report, "compile");
+                program = compiler.compile(input);
+            }
+            
+            const IncrementalStats& stats = compiler.stats();
+            if (report) {
+                report->setCount("statements", stats.statements);
+                report->setCount("reused_statements", stats.reused);
+            }
+            std::cerr << std::fixed << std::setprecision(3) << "[incremental] ";
+            if (stats.full) {
+                std::cerr << "full compile " << stats.compileMs << " ms, "
+                          << stats.statements << " statements" << std::endl;
+            } else {
+                std::cerr << "compiled in " << stats.compileMs << " ms, reused "
+                          << stats.reused << "/" << stats.statements << " statements"
+                          << " (last full compile " << stats.lastFullCompileMs << " ms)" << std::endl;
+            }
+        } else if (!moduleCachePath.empty()) {
+            // Modules: reuse the units of unchanged modules
+            SymbolTable symbols;
+            ModuleCompiler compiler(moduleCachePath, symbols);
+            {
+                StatsReport::Scope phase(report, "compile");
+                program = compiler.compile(inputPath, input);
+            }
+            
+            const ModuleStats& stats = compiler.stats();
+            if (report) {
+                report->setCount("modules", stats.modules);
+                report->setCount("compiled_modules", stats.compiled);
+            }
+            std::cerr << std::fixed << std::setprecision(3) << "[modules] compiled " << stats.compiled << "/"
+                      << stats.modules << " modules in " << stats.compileMs << " ms" << std::endl;
+        } else {
+            // Identifiers are numbered once by the lexer, for parser and codegen
+            SymbolTable symbols;
+            
+            // Lexing
+            std::vector<Token> tokens;
+            {
+                StatsReport::Scope phase(report, "lex");
+                Lexer lexer(input, symbols);
+                tokens = lexer.tokenize();
+            }
+            if (report) report->setCount("tokens", tokens.size());
 
-        // Parsing
-        Parser parser(tokens);
-        auto statements = parser.parse();
+            // Parsing
+            std::unique_ptr<BlockStmt> block;
+            {
+                StatsReport::Scope phase(report, "parse");
+                Parser parser(std::move(tokens));
+                block = std::make_unique<BlockStmt>(parser.parse());
+            }
 
-        // Code Generation
-        CodeGenerator generator;
-        auto block = std::make_unique<BlockStmt>(std::move(statements));
-        auto program = generator.generate(block.get());
+            if (report) report->setCount("ast_nodes", countNodes(block.get()));
+            if (importsModules(*block)) {
+                // The imported files are compiled as modules, without a cache
+                if (profiling) {
+                    throw std::runtime_error("--profile-out and --profile-use do not support import");
+                }
+                StatsReport::Scope phase(report, "compile");
+                ModuleCompiler compiler("", symbols);
+                program = compiler.compile(inputPath, input, std::move(block));
+                if (report) report->setCount("modules", compiler.stats().modules);
+            } else {
+                // Code Generation
+                StatsReport::Scope phase(report, "codegen");
+                CodeGenerator generator(symbols);
+                generator.setProfile(profile.get());
+                program = generator.generate(block.get());
+                sites = generator.profileSites();
+            }
+            if (report) report->setCount("symbols", symbols.size());
+        }
+        // Fold whatever the first `fuel` instructions compute into the program
+        if (fuel > 0) {
+            uint64_t evaluated;
+            {
+                StatsReport::Scope phase(report, "partial_eval");
+                program = partialEvaluate(program, fuel, &evaluated);
+            }
+            if (report) report->setCount("evaluated_instructions", evaluated);
+        }
+        if (report) report->setCount("instructions", program.instructions.size());
+        
+        // Compile only: equal hashes mean equal output, unless the program
+        // reads input, which is reported after the hash
+        if (hashOnly) {
+            bool input = std::any_of(program.instructions.begin(), program.instructions.end(),
+                                     [](const Instruction& instr) { return readsInput(instr.op); });
+            std::cout << bytecodeHash(program) << (input ? " input" : "") << std::endl;
+            return finish(0);
+        }
 
-        // Execution
+        // Ahead-of-time: write C instead of running
+        if (!emitPath.empty()) {
+            // The file is only written once the whole program was emitted, so
+            // an unsupported feature never leaves a partial one behind
+            std::ostringstream code;
+            {
+                StatsReport::Scope phase(report, "emit_c");
+                emitC(program, code);
+            }
+            std::ofstream output(emitPath);
+            if (!(output << code.str())) {
+                std::cerr << "Error: Could not write " << emitPath << std::endl;
+                return 1;
+            }
+            return finish(0);
+        }
+
+        // Execution, optionally traced for compii-trace
+        std::unique_ptr<TraceSink> trace;
+        if (!tracePath.empty()) {
+            trace = std::make_unique<TraceSink>(tracePath, program, traceSample);
+        }
         VirtualMachine vm;
-        vm.execute(program);
+        vm.setChecked(checked);
+        vm.setFileInput(fileInput);
+        vm.setSnapshotPath(snapshotPath);
+        vm.setTrace(trace.get());
+        std::unique_ptr<ProfileRecorder> recorder;
+        if (profileRun) {
+            recorder = std::make_unique<ProfileRecorder>(program, std::move(sites), sourceHash);
+            vm.setProfile(recorder.get());
+        }
+        bool ok;
+        {
+            StatsReport::Scope phase(report, "execute");
+            ok = vm.execute(program);
+        }
+        // Also after a runtime error: the counts so far still tell what is hot
+        if (recorder) {
+            recorder->write(profileOutPath);
+        }
+        return finish(ok ? 0 : 1);
 
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -0,0 +1,362 @@
+#include "modules.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../codegen/codegen.h"
+#include "../codegen/serializer.h"
+#include "../incremental/incremental.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const uint32_t MODULE_MAGIC = 0x4d504d43;  // "CMPM"
+static const uint32_t MODULE_VERSION = 1;
+
+bool importsModules(const BlockStmt& block) {
+    return std::any_of(block.statements.begin(), block.statements.end(),
+                       [](const std::unique_ptr<Statement>& stmt) { return dynamic_cast<ImportStmt*>(stmt.get()); });
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string canonicalPath(const std::string& path) {
+    std::error_code error;
+    fs::path canonical = fs::weakly_canonical(path, error);
+    return error ? path : canonical.string();
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    std::string source;
+    file.seekg(0, std::ios::end);
+    source.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(&source[0], static_cast<std::streamsize>(source.size()));
+    return source;
+}
+
+// The name of the function a top-level statement declares, if it is `fun`
+static bool declaredFunction(const std::string& source, const SourceChunk& chunk, std::string& name) {
+    size_t i = chunk.begin;
+    if (chunk.end - i < 4 || source.compare(i, 3, "fun") != 0 || !std::isspace(static_cast<unsigned char>(source[i + 3]))) {
+        return false;
+    }
+    i += 3;
+    while (i < chunk.end && std::isspace(static_cast<unsigned char>(source[i]))) i++;
+    size_t start = i;
+    while (i < chunk.end && (std::isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_')) i++;
+    name = source.substr(start, i - start);
+    return !name.empty();
+}
+
+ModuleCompiler::ModuleCompiler(const std::string& cacheDir, SymbolTable& symbols)
+    : cacheDir(cacheDir), symbols(symbols) {
+    if (!cacheDir.empty()) {
+        std::error_code error;
+        fs::create_directories(cacheDir, error);
+    }
+}
+
+BytecodeProgram ModuleCompiler::compile(const std::string& path, const std::string& source,
+                                        std::unique_ptr<BlockStmt> root) {
+    auto start = std::chrono::steady_clock::now();
+    modules.clear();
+    moduleIndex.clear();
+    std::vector<std::string> importing;
+    load(path, canonicalPath(path), source, std::move(root), importing);
+
+    // All functions end up in one program. Code generation reports a
+    // function defined twice in the same module.
+    std::unordered_map<std::string, size_t> definedIn;
+    for (size_t m = 0; m < modules.size(); m++) {
+        for (const Export& exported : modules[m]->exports) {
+            auto defined = definedIn.emplace(exported.name, m);
+            if (!defined.second && defined.first->second != m) {
+                throw std::runtime_error("Function '" + exported.name + "' is defined in both " +
+                                         modules[defined.first->second]->path + " and " + modules[m]->path);
+            }
+        }
+    }
+
+    size_t compiled = 0;
+    for (auto& module : modules) {
+        if (upToDate(*module)) continue;
+        generate(*module);
+        writeEntry(*module);
+        compiled++;
+    }
+
+    std::vector<const BytecodeUnit*> units;
+    for (const auto& module : modules) {
+        units.push_back(&module->unit);
+    }
+    BytecodeProgram program = link(units);
+
+    lastStats = ModuleStats();
+    lastStats.modules = modules.size();
+    lastStats.compiled = compiled;
+    lastStats.compileMs = elapsedMs(start);
+    return program;
+}
+
+// Loads a module and, first, the modules it imports; returns its index
+size_t ModuleCompiler::load(const std::string& path, const std::string& canonical, std::string source,
+                            std::unique_ptr<BlockStmt> ast, std::vector<std::string>& importing) {
+    auto loaded = moduleIndex.find(canonical);
+    if (loaded != moduleIndex.end()) {
+        return loaded->second;
+    }
+    auto cycle = std::find(importing.begin(), importing.end(), canonical);
+    if (cycle != importing.end()) {
+        std::string chain;
+        for (auto it = cycle; it != importing.end(); ++it) {
+            chain += fs::path(*it).filename().string() + " -> ";
+        }
+        throw std::runtime_error("Circular import: " + chain + fs::path(canonical).filename().string());
+    }
+
+    auto module = std::make_unique<Module>();
+    module->path = path;
+    module->source = std::move(source);
+    module->hash = hashBytes(module->source.data(), module->source.size());
+    module->ast = std::move(ast);
+    if (!readEntry(*module)) {
+        parse(*module);
+        for (const SourceChunk& chunk : splitTopLevel(module->source)) {
+            std::string name;
+            if (declaredFunction(module->source, chunk, name)) {
+                module->exportIndex[name] = module->exports.size();
+                module->exports.push_back({name, hashBytes(module->source.data() + chunk.begin, chunk.end - chunk.begin),
+                                           chunk.begin, chunk.end});
+            }
+        }
+    } else if (module->ast) {
+        parse(*module);
+    }
+
+    importing.push_back(canonical);
+    for (const std::string& imported : module->imports) {
+        std::string importPath = (fs::path(path).parent_path() / imported).lexically_normal().string();
+        std::string importSource;
+        try {
+            importSource = readFile(importPath);
+        } catch (const std::exception&) {
+            throw std::runtime_error(path + ": could not open imported module " + importPath);
+        }
+        size_t index = load(importPath, canonicalPath(importPath), std::move(importSource), nullptr, importing);
+        module->visible.push_back(index);
+        const std::vector<size_t>& indirect = modules[index]->visible;
+        module->visible.insert(module->visible.end(), indirect.begin(), indirect.end());
+    }
+    importing.pop_back();
+    std::sort(module->visible.begin(), module->visible.end());
+    module->visible.erase(std::unique(module->visible.begin(), module->visible.end()), module->visible.end());
+
+    moduleIndex[canonical] = modules.size();
+    modules.push_back(std::move(module));
+    return modules.size() - 1;
+}
+
+// Builds the module's AST, unless the caller gave one, and takes the
+// imports out of it
+void ModuleCompiler::parse(Module& module) {
+    try {
+        if (!module.ast) {
+            Lexer lexer(module.source, symbols);
+            Parser parser(lexer.tokenize());
+            module.ast = std::make_unique<BlockStmt>(parser.parse());
+        }
+    } catch (const std::exception& e) {
+        throw std::runtime_error(module.path + ": " + e.what());
+    }
+    auto& statements = module.ast->statements;
+    std::vector<std::string> imports;
+    for (const auto& stmt : statements) {
+        if (auto* import = dynamic_cast<ImportStmt*>(stmt.get())) {
+            imports.push_back(import->path.value);
+        } else if (auto* fn = dynamic_cast<FunctionStmt*>(stmt.get())) {
+            module.functions[fn->name.value] = fn;
+        }
+    }
+    statements.erase(std::remove_if(statements.begin(), statements.end(),
+                                    [](const std::unique_ptr<Statement>& stmt) {
+                                        return dynamic_cast<ImportStmt*>(stmt.get()) != nullptr;
+                                    }),
+                     statements.end());
+    if (!module.cached) {
+        module.imports = std::move(imports);
+    }
+}
+
+const ModuleCompiler::Export* ModuleCompiler::findExport(const Module& module, const std::string& name,
+                                                         size_t& owner) const {
+    for (size_t imported : module.visible) {
+        const Module& candidate = *modules[imported];
+        auto it = candidate.exportIndex.find(name);
+        if (it != candidate.exportIndex.end()) {
+            owner = imported;
+            return &candidate.exports[it->second];
+        }
+    }
+    return nullptr;
+}
+
+// A module that was not parsed only has the exported function's own text
+// lexed and parsed
+FunctionStmt* ModuleCompiler::exportedFunction(size_t owner, const Export& exported) {
+    Module& module = *modules[owner];
+    auto it = module.functions.find(exported.name);
+    if (it != module.functions.end()) {
+        return it->second;
+    }
+    Lexer lexer(module.source.substr(exported.begin, exported.end - exported.begin), symbols);
+    Parser parser(lexer.tokenize());
+    auto block = std::make_unique<BlockStmt>(parser.parse());
+    auto* fn = block->statements.size() == 1 ? dynamic_cast<FunctionStmt*>(block->statements[0].get()) : nullptr;
+    module.functionAsts.push_back(std::move(block));
+    module.functions[exported.name] = fn;
+    return fn;
+}
+
+bool ModuleCompiler::upToDate(const Module& module) const {
+    if (!module.cached) {
+        return false;
+    }
+    for (const auto& lookup : module.lookups) {
+        size_t owner;
+        const Export* exported = findExport(module, lookup.first, owner);
+        if ((exported ? exported->hash : 0) != lookup.second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ModuleCompiler::generate(Module& module) {
+    if (!module.ast) {
+        parse(module);
+    }
+    module.lookups.clear();
+    std::unordered_set<std::string> seen;
+    CodeGenerator::FunctionResolver resolver = [&](Symbol name) -> FunctionStmt* {
+        const std::string& text = symbols.name(name);
+        size_t owner;
+        const Export* exported = findExport(module, text, owner);
+        if (seen.insert(text).second) {
+            module.lookups.emplace_back(text, exported ? exported->hash : 0);
+        }
+        return exported ? exportedFunction(owner, *exported) : nullptr;
+    };
+    try {
+        CodeGenerator generator(symbols);
+        module.unit = generator.generateUnit(module.ast.get(), resolver);
+    } catch (const std::exception& e) {
+        throw std::runtime_error(module.path + ": " + e.what());
+    }
+    for (auto& dependency : module.unit.dependencies) {
+        size_t owner;
+        dependency.second = findExport(module, dependency.first, owner)->hash;
+    }
+}
+
+std::string ModuleCompiler::entryPath(uint64_t hash) const {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << ".unit";
+    return (fs::path(cacheDir) / name.str()).string();
+}
+
+// A missing, corrupt or outdated entry is simply not used
+bool ModuleCompiler::readEntry(Module& module) {
+    if (cacheDir.empty()) return false;
+    std::string entry;
+    try {
+        entry = readFile(entryPath(module.hash));
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    try {
+        BytecodeReader reader(entry.data(), entry.size());
+        if (reader.readU32() != MODULE_MAGIC || reader.readU32() != MODULE_VERSION ||
+            reader.readU64() != module.hash || reader.readU64() != module.source.size()) {
+            return false;
+        }
+        std::vector<std::string> imports(reader.readU32());
+        for (auto& imported : imports) {
+            imported = reader.readString();
+        }
+        std::vector<Export> exports(reader.readU32());
+        for (auto& exported : exports) {
+            exported.name = reader.readString();
+            exported.hash = reader.readU64();
+            exported.begin = reader.readU64();
+            exported.end = reader.readU64();
+        }
+        std::vector<std::pair<std::string, uint64_t>> lookups(reader.readU32());
+        for (auto& lookup : lookups) {
+            lookup.first = reader.readString();
+            lookup.second = reader.readU64();
+        }
+        module.unit = reader.readUnit();
+        module.imports = std::move(imports);
+        module.exports = std::move(exports);
+        module.lookups = std::move(lookups);
+    } catch (const std::exception&) {
+        return false;
+    }
+    for (size_t i = 0; i < module.exports.size(); i++) {
+        module.exportIndex[module.exports[i].name] = i;
+    }
+    module.cached = true;
+    return true;
+}
+
+void ModuleCompiler::writeEntry(const Module& module) {
+    if (cacheDir.empty()) return;
+    // Write to a temporary file first so readers never see a partial entry;
+    // it is named after the process, since another may write the same entry
+    std::string path = entryPath(module.hash);
+    std::string tempPath = path + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        BytecodeWriter writer(file);
+        writer.writeU32(MODULE_MAGIC);
+        writer.writeU32(MODULE_VERSION);
+        writer.writeU64(module.hash);
+        writer.writeU64(module.source.size());
+        writer.writeU32(static_cast<uint32_t>(module.imports.size()));
+        for (const auto& imported : module.imports) {
+            writer.writeString(imported);
+        }
+        writer.writeU32(static_cast<uint32_t>(module.exports.size()));
+        for (const auto& exported : module.exports) {
+            writer.writeString(exported.name);
+            writer.writeU64(exported.hash);
+            writer.writeU64(exported.begin);
+            writer.writeU64(exported.end);
+        }
+        writer.writeU32(static_cast<uint32_t>(module.lookups.size()));
+        for (const auto& lookup : module.lookups) {
+            writer.writeString(lookup.first);
+            writer.writeU64(lookup.second);
+        }
+        writer.writeUnit(module.unit);
+        if (!file) return;
+    }
+    std::rename(tempPath.c_str(), path.c_str());
+}
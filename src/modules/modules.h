@@ -0,0 +1,98 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include "../ast/ast.h"
+#include "../codegen/bytecode.h"
+#include "../codegen/linker.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Whether `block` has a top-level `import`, so it must be compiled as modules
+bool importsModules(const BlockStmt& block);
+
+struct ModuleStats {
+    size_t modules = 0;
+    size_t compiled = 0;  // Modules whose bytecode was generated; the rest came from the cache
+    double compileMs = 0;
+};
+
+// Compiles a program split into files with `import "file";`. Every file is
+// a module, compiled on its own to a BytecodeUnit with an export table of
+// the functions it defines, and the units are linked into one program:
+// each module's top-level code runs once, after the modules it imports.
+// Top-level variables are shared by name by all modules, as if the files
+// were concatenated. A module can call its own functions and those of the
+// modules it imports, directly or through other imports, so the bodies of
+// the functions it calls resolve the same from there; function names must
+// be unique in the program.
+//
+// Units are cached in a directory, one file per module named after a hash
+// of its text. A cached unit is reused if the module's text is unchanged and
+// every name it looked up in its imports still finds the same definition,
+// so editing a module recompiles it and the modules that call the functions
+// that changed, and only relinks the rest.
+class ModuleCompiler {
+public:
+    // `cacheDir`: created if missing; empty to compile every module. The
+    // ASTs are numbered with `symbols`.
+    ModuleCompiler(const std::string& cacheDir, SymbolTable& symbols);
+
+    // The program whose main module `source` was read from `path`. `root`
+    // is its AST if the caller already parsed it with the same symbols.
+    BytecodeProgram compile(const std::string& path, const std::string& source,
+                            std::unique_ptr<BlockStmt> root = nullptr);
+    const ModuleStats& stats() const { return lastStats; }
+
+private:
+    // A function the module defines, with a hash of its source text and
+    // where that text is, so importers can parse just this function
+    struct Export {
+        std::string name;
+        uint64_t hash;
+        size_t begin;
+        size_t end;
+    };
+
+    struct Module {
+        std::string path;                    // As opened
+        std::string source;
+        uint64_t hash = 0;                   // Of `source`
+        std::vector<std::string> imports;    // As written, relative to `path`
+        std::vector<size_t> visible;         // Modules imported directly or indirectly
+        std::vector<Export> exports;
+        std::unordered_map<std::string, size_t> exportIndex;
+        // Names generating the unit looked up in the imports, with the
+        // hash of the definition found, or 0 if none was
+        std::vector<std::pair<std::string, uint64_t>> lookups;
+        BytecodeUnit unit;
+        bool cached = false;                 // Imports, exports, lookups and unit read from the cache
+
+        std::unique_ptr<BlockStmt> ast;      // Without the imports; only if it was parsed
+        std::unordered_map<std::string, FunctionStmt*> functions;  // Of `ast` or parsed for importers
+        std::vector<std::unique_ptr<BlockStmt>> functionAsts;
+    };
+
+    std::string cacheDir;
+    SymbolTable& symbols;
+    std::vector<std::unique_ptr<Module>> modules;  // Imports before their importers
+    std::unordered_map<std::string, size_t> moduleIndex;  // By canonical path
+    ModuleStats lastStats;
+
+    size_t load(const std::string& path, const std::string& canonical, std::string source,
+                std::unique_ptr<BlockStmt> ast, std::vector<std::string>& importing);
+    void parse(Module& module);
+    const Export* findExport(const Module& module, const std::string& name, size_t& owner) const;
+    FunctionStmt* exportedFunction(size_t owner, const Export& exported);
+    bool upToDate(const Module& module) const;
+    void generate(Module& module);
+
+    std::string entryPath(uint64_t hash) const;
+    bool readEntry(Module& module);
+    void writeEntry(const Module& module);
+};
+
+#endif
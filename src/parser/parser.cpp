@@ -3,14 +3,15 @@
 #include "../ast/ast.h"
 
 // Constructor
-Parser::Parser(const std::vector<Token>& tokens) : tokens(tokens) {}
+Parser::Parser(std::vector<Token> tokens) : tokens(std::move(tokens)) {}
 
 // Helper methods
-Token Parser::peek() {
-    return (index < tokens.size()) ? tokens[index] : Token{TokenType::EOF_TYPE, ""};
+const Token& Parser::peek() {
+    static const Token eof{TokenType::EOF_TYPE, ""};
+    return (index < tokens.size()) ? tokens[index] : eof;
 }
 
-Token Parser::advance() {
+const Token& Parser::advance() {
     return tokens[index++];
 }
 
@@ -26,7 +27,16 @@ bool Parser::check(TokenType type) {
     return peek().type == type;
 }
 
-Token Parser::consume(TokenType type, const std::string& message) {
+bool Parser::checkNext(TokenType type) {
+    return index + 1 < tokens.size() && tokens[index + 1].type == type;
+}
+
+// Contextual keywords are plain identifiers everywhere else
+bool Parser::checkWord(Symbol word) {
+    return check(TokenType::IDENTIFIER) && peek().symbol == word;
+}
+
+const Token& Parser::consume(TokenType type, const std::string& message) {
     if (check(type)) return advance();
     throw std::runtime_error(message);
 }
@@ -37,13 +47,16 @@ std::unique_ptr<ASTNode> Parser::parseExpression() {
 }
 
 std::unique_ptr<ASTNode> Parser::parseAssignment() {
-    auto expr = parseEquality();
+    auto expr = parseOr();
     
     if (match(TokenType::EQUAL)) {
         auto value = parseAssignment();
         if (auto* var = dynamic_cast<VariableExpr*>(expr.get())) {
             return std::make_unique<AssignmentExpr>(var->name, std::move(value));
         }
+        if (auto* index = dynamic_cast<IndexExpr*>(expr.get())) {
+            return std::make_unique<IndexAssignExpr>(std::move(index->object), std::move(index->key), std::move(value));
+        }
         // Error: Invalid assignment target
         throw std::runtime_error("Invalid assignment target");
     }
@@ -51,6 +64,30 @@ std::unique_ptr<ASTNode> Parser::parseAssignment() {
     return expr;
 }
 
+std::unique_ptr<ASTNode> Parser::parseOr() {
+    auto expr = parseAnd();
+    
+    while (match(TokenType::OR)) {
+        Token op = tokens[index - 1];
+        auto right = parseAnd();
+        expr = std::make_unique<LogicalExpr>(op, std::move(expr), std::move(right));
+    }
+    
+    return expr;
+}
+
+std::unique_ptr<ASTNode> Parser::parseAnd() {
+    auto expr = parseEquality();
+    
+    while (match(TokenType::AND)) {
+        Token op = tokens[index - 1];
+        auto right = parseEquality();
+        expr = std::make_unique<LogicalExpr>(op, std::move(expr), std::move(right));
+    }
+    
+    return expr;
+}
+
 std::unique_ptr<ASTNode> Parser::parseEquality() {
     auto expr = parseComparison();
     
@@ -89,17 +126,29 @@ std::unique_ptr<ASTNode> Parser::parseTerm() {
 }
 
 std::unique_ptr<ASTNode> Parser::parseFactor() {
-    auto expr = parsePrimary();
+    auto expr = parseIndex();
     
     while (match(TokenType::STAR) || match(TokenType::SLASH)) {
         Token op = tokens[index - 1];
-        auto right = parsePrimary();
+        auto right = parseIndex();
         expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
     }
     
     return expr;
 }
 
+std::unique_ptr<ASTNode> Parser::parseIndex() {
+    auto expr = parsePrimary();
+    
+    while (match(TokenType::LEFT_BRACKET)) {
+        auto key = parseExpression();
+        consume(TokenType::RIGHT_BRACKET, "Expect ']' after index");
+        expr = std::make_unique<IndexExpr>(std::move(expr), std::move(key));
+    }
+    
+    return expr;
+}
+
 std::unique_ptr<ASTNode> Parser::parsePrimary() {
     if (match(TokenType::NUMBER) || match(TokenType::STRING) || 
         match(TokenType::BOOLEAN) || match(TokenType::NULL_TYPE)) {
@@ -107,7 +156,11 @@ std::unique_ptr<ASTNode> Parser::parsePrimary() {
     }
     
     if (match(TokenType::IDENTIFIER)) {
-        return std::make_unique<VariableExpr>(tokens[index - 1]);
+        Token name = tokens[index - 1];
+        if (match(TokenType::LEFT_PAREN)) {
+            return finishCall(name);
+        }
+        return std::make_unique<VariableExpr>(name);
     }
     
     if (match(TokenType::LEFT_PAREN)) {
@@ -116,17 +169,72 @@ std::unique_ptr<ASTNode> Parser::parsePrimary() {
         return expr;
     }
     
+    if (match(TokenType::LEFT_BRACE)) {
+        return finishMap();
+    }
+    
+    if (check(TokenType::ERROR)) {
+        throw std::runtime_error(peek().value);
+    }
+    
     throw std::runtime_error("Expect expression");
 }
 
+std::unique_ptr<ASTNode> Parser::finishCall(Token callee) {
+    std::vector<std::unique_ptr<ASTNode>> arguments;
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            arguments.push_back(parseExpression());
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments");
+    return std::make_unique<CallExpr>(callee, std::move(arguments));
+}
+
+// A map literal; a `{` that starts a statement is a block instead
+std::unique_ptr<ASTNode> Parser::finishMap() {
+    std::vector<std::pair<std::unique_ptr<ASTNode>, std::unique_ptr<ASTNode>>> entries;
+    if (!check(TokenType::RIGHT_BRACE)) {
+        do {
+            auto key = parseExpression();
+            consume(TokenType::COLON, "Expect ':' after map key");
+            entries.emplace_back(std::move(key), parseExpression());
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after map entries");
+    return std::make_unique<MapExpr>(std::move(entries));
+}
+
 // Statement parsing
 std::unique_ptr<Statement> Parser::parseStatement() {
+    if (match(TokenType::FUN)) return parseFunctionDeclaration();
+    if (match(TokenType::RETURN)) return parseReturnStatement();
     if (match(TokenType::PRINT)) return parsePrintStatement();
     if (match(TokenType::VAR)) return parseVarDeclaration();
     if (match(TokenType::LEFT_BRACE)) return parseBlock();
     if (match(TokenType::IF)) return parseIfStatement();
     if (match(TokenType::WHILE)) return parseWhileStatement();
     if (match(TokenType::FOR)) return parseForStatement();
+    if (checkWord(SymbolTable::PARALLEL) && checkNext(TokenType::FOR)) {
+        advance();
+        advance();
+        return parseParallelForStatement();
+    }
+    if (checkWord(SymbolTable::SPAWN) && checkNext(TokenType::LEFT_BRACE)) {
+        advance();
+        return std::make_unique<SpawnStmt>(parseStatement());
+    }
+    if (checkWord(SymbolTable::CHECKPOINT) && checkNext(TokenType::SEMICOLON)) {
+        advance();
+        advance();
+        return std::make_unique<CheckpointStmt>();
+    }
+    if (checkWord(SymbolTable::IMPORT) && checkNext(TokenType::STRING)) {
+        advance();
+        Token path = advance();
+        consume(TokenType::SEMICOLON, "Expect ';' after import");
+        return std::make_unique<ImportStmt>(path);
+    }
     return parseExpressionStatement();
 }
 
@@ -193,9 +301,47 @@ std::unique_ptr<Statement> Parser::parsePrintStatement() {
     return std::make_unique<PrintStmt>(std::move(expr));
 }
 
+std::unique_ptr<Statement> Parser::parseFunctionDeclaration() {
+    Token name = consume(TokenType::IDENTIFIER, "Expect function name");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after function name");
+
+    std::vector<Token> params;
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            params.push_back(consume(TokenType::IDENTIFIER, "Expect parameter name"));
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before function body");
+
+    auto block = parseBlock();
+    auto body = std::move(static_cast<BlockStmt*>(block.get())->statements);
+    return std::make_unique<FunctionStmt>(name, std::move(params), std::move(body));
+}
+
+std::unique_ptr<Statement> Parser::parseReturnStatement() {
+    std::unique_ptr<ASTNode> value;
+    if (!check(TokenType::SEMICOLON)) {
+        value = parseExpression();
+    }
+    consume(TokenType::SEMICOLON, "Expect ';' after return value");
+    return std::make_unique<ReturnStmt>(std::move(value));
+}
+
 std::unique_ptr<Statement> Parser::parseForStatement() {
     consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'");
     
+    // `for (var x in iterable)`
+    if (check(TokenType::VAR) && checkNext(TokenType::IDENTIFIER) && index + 2 < static_cast<int>(tokens.size()) &&
+        tokens[index + 2].type == TokenType::IDENTIFIER && tokens[index + 2].symbol == SymbolTable::IN) {
+        advance();
+        Token variable = advance();
+        advance();
+        auto iterable = parseExpression();
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after for-in iterable");
+        return std::make_unique<ForInStmt>(variable, std::move(iterable), parseStatement());
+    }
+    
     // Initialization
     std::unique_ptr<Statement> initializer;
     if (match(TokenType::VAR)) {
@@ -212,7 +358,7 @@ std::unique_ptr<Statement> Parser::parseForStatement() {
         condition = parseExpression();
     } else {
         // No condition means infinite loop
-        condition = std::make_unique<LiteralExpr>(Token{TokenType::BOOLEAN, "true"});
+        condition = std::make_unique<LiteralExpr>(Token{TokenType::BOOLEAN, "true", true});
     }
     consume(TokenType::SEMICOLON, "Expect ';' after loop condition");
     
@@ -223,7 +369,7 @@ std::unique_ptr<Statement> Parser::parseForStatement() {
         increment = std::make_unique<ExpressionStmt>(std::move(expr));
     } else {
         // No increment
-        increment = std::make_unique<ExpressionStmt>(std::make_unique<LiteralExpr>(Token{TokenType::NUMBER, "0"}));
+        increment = std::make_unique<ExpressionStmt>(std::make_unique<LiteralExpr>(Token{TokenType::NUMBER, "0", int64_t{0}}));
     }
     consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses");
     
@@ -252,6 +398,70 @@ std::unique_ptr<Statement> Parser::parseForStatement() {
     return std::make_unique<BlockStmt>(std::move(statements));
 }
 
+std::unique_ptr<Statement> Parser::parseParallelForStatement() {
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'parallel for'");
+    consume(TokenType::VAR, "Expect 'var' in parallel for initializer");
+    Token variable = consume(TokenType::IDENTIFIER, "Expect loop variable name");
+    consume(TokenType::EQUAL, "Expect '=' after loop variable");
+    auto start = parseExpression();
+    consume(TokenType::SEMICOLON, "Expect ';' after loop initializer");
+    
+    // Condition: i < end or i <= end
+    const std::string conditionError = "parallel for condition must be '" + variable.value +
+                                       " < end' or '" + variable.value + " <= end'";
+    if (consume(TokenType::IDENTIFIER, conditionError).symbol != variable.symbol) {
+        throw std::runtime_error(conditionError);
+    }
+    bool inclusive;
+    if (match(TokenType::LESS)) {
+        inclusive = false;
+    } else if (match(TokenType::LESS_EQUAL)) {
+        inclusive = true;
+    } else {
+        throw std::runtime_error(conditionError);
+    }
+    auto end = parseTerm();
+    consume(TokenType::SEMICOLON, "Expect ';' after loop condition");
+    
+    // Increment: i = i + <positive integer>
+    const std::string incrementError = "parallel for increment must be '" + variable.value +
+                                       " = " + variable.value + " + <positive integer>'";
+    if (consume(TokenType::IDENTIFIER, incrementError).symbol != variable.symbol) {
+        throw std::runtime_error(incrementError);
+    }
+    consume(TokenType::EQUAL, incrementError);
+    if (consume(TokenType::IDENTIFIER, incrementError).symbol != variable.symbol) {
+        throw std::runtime_error(incrementError);
+    }
+    consume(TokenType::PLUS, incrementError);
+    Token stepToken = consume(TokenType::NUMBER, incrementError);
+    const int64_t* step = std::get_if<int64_t>(&stepToken.literal);
+    if (!step || *step <= 0 || *step > INT32_MAX) {
+        throw std::runtime_error(incrementError);
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parallel for clauses");
+    
+    // Optional reduce(kind var, ...)
+    std::vector<std::pair<Token, Token>> reductions;
+    if (checkWord(SymbolTable::REDUCE) && checkNext(TokenType::LEFT_PAREN)) {
+        advance();
+        advance();
+        do {
+            Token kind = consume(TokenType::IDENTIFIER, "Expect reduction kind");
+            if (kind.symbol < SymbolTable::SUM || kind.symbol > SymbolTable::CONCAT) {
+                throw std::runtime_error("Unknown reduction '" + kind.value + "', expected sum, min, max or concat");
+            }
+            Token name = consume(TokenType::IDENTIFIER, "Expect reduction variable name");
+            reductions.emplace_back(kind, name);
+        } while (match(TokenType::COMMA));
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after reductions");
+    }
+    
+    auto body = parseStatement();
+    return std::make_unique<ParallelForStmt>(variable, std::move(start), std::move(end), inclusive,
+                                             static_cast<int>(*step), std::move(reductions), std::move(body));
+}
+
 // Main parsing method
 std::vector<std::unique_ptr<Statement>> Parser::parse() {
     std::vector<std::unique_ptr<Statement>> statements;
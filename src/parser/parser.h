@@ -11,20 +11,27 @@ class Parser {
         std::vector<Token> tokens;
         int index = 0;
 
-        Token peek();
-        Token advance();
+        const Token& peek();
+        const Token& advance();
         bool match(TokenType type);
         bool check(TokenType type);
-        Token consume(TokenType type, const std::string& message);
+        bool checkNext(TokenType type);
+        bool checkWord(Symbol word);
+        const Token& consume(TokenType type, const std::string& message);
 
         // Expression parsing
         std::unique_ptr<ASTNode> parseExpression();
         std::unique_ptr<ASTNode> parseAssignment();
+        std::unique_ptr<ASTNode> parseOr();
+        std::unique_ptr<ASTNode> parseAnd();
         std::unique_ptr<ASTNode> parseEquality();
         std::unique_ptr<ASTNode> parseComparison();
         std::unique_ptr<ASTNode> parseTerm();
         std::unique_ptr<ASTNode> parseFactor();
+        std::unique_ptr<ASTNode> parseIndex();
         std::unique_ptr<ASTNode> parsePrimary();
+        std::unique_ptr<ASTNode> finishMap();
+        std::unique_ptr<ASTNode> finishCall(Token callee);
 
         // Statement parsing
         std::unique_ptr<Statement> parseStatement();
@@ -34,10 +41,13 @@ class Parser {
         std::unique_ptr<Statement> parseIfStatement();
         std::unique_ptr<Statement> parseWhileStatement();
         std::unique_ptr<Statement> parseForStatement();
+        std::unique_ptr<Statement> parseParallelForStatement();
         std::unique_ptr<Statement> parsePrintStatement();
+        std::unique_ptr<Statement> parseFunctionDeclaration();
+        std::unique_ptr<Statement> parseReturnStatement();
 
     public:
-        Parser(const std::vector<Token> &tokens);
+        Parser(std::vector<Token> tokens);
         std::vector<std::unique_ptr<Statement>> parse();
 };
 #endif
\ No newline at end of file
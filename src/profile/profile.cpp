@@ -0,0 +1,101 @@
+#include "profile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Text format, one record per line:
+//   compii-profile <version> <source hash, hex>
+//   if <node> <then count> <else count>
+//   types <node> <operand types mask>
+const uint32_t PROFILE_VERSION = 2;
+
+ProfileRecorder::ProfileRecorder(const BytecodeProgram& program, std::vector<ProfileSite> sites, uint64_t sourceHash)
+    : perInstruction(new Counters[program.instructions.size()]), sites(std::move(sites)), sourceHash(sourceHash) {}
+
+void ProfileRecorder::write(const std::string& path) const {
+    // Unrolled loops give one node several sites, so counts are summed
+    std::map<uint32_t, uint64_t> executions;
+    std::map<uint32_t, Profile::Branch> branches;
+    std::map<uint32_t, uint64_t> types;
+    for (const ProfileSite& site : sites) {
+        const Counters& counters = perInstruction[site.pc];
+        switch (site.kind) {
+            case SiteKind::IF_ENTRY:
+                executions[site.node] += counters.executed.load(std::memory_order_relaxed);
+                break;
+            case SiteKind::TO_ELSE:
+                branches[site.node].elseCount += counters.taken.load(std::memory_order_relaxed);
+                break;
+            case SiteKind::OPERANDS:
+                types[site.node] |= counters.types.load(std::memory_order_relaxed);
+                break;
+        }
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not write profile " + path);
+    }
+    file << "compii-profile " << PROFILE_VERSION << " " << std::hex << sourceHash << std::dec << "\n";
+    for (const auto& [node, count] : executions) {
+        if (count == 0) continue;
+        uint64_t elseCount = branches[node].elseCount;
+        file << "if " << node << " " << count - elseCount << " " << elseCount << "\n";
+    }
+    for (const auto& [node, mask] : types) {
+        if (mask == 0) continue;
+        file << "types " << node << " " << mask << "\n";
+    }
+    if (!file) {
+        throw std::runtime_error("Could not write profile " + path);
+    }
+}
+
+Profile::Profile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open profile " + path);
+    }
+    std::string magic;
+    uint32_t version = 0;
+    if (!(file >> magic >> version >> std::hex >> sourceHash_ >> std::dec) || magic != "compii-profile" ||
+        version != PROFILE_VERSION) {
+        throw std::runtime_error("Not a profile: " + path);
+    }
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        std::istringstream record(line);
+        std::string kind;
+        uint32_t node;
+        if (!(record >> kind >> node)) {
+            throw std::runtime_error("Malformed profile " + path);
+        }
+        if (kind == "if") {
+            Branch& branch = branches[node];
+            if (!(record >> branch.thenCount >> branch.elseCount)) {
+                throw std::runtime_error("Malformed profile " + path);
+            }
+        } else if (kind == "types") {
+            if (!(record >> types[node])) {
+                throw std::runtime_error("Malformed profile " + path);
+            }
+        } else {
+            throw std::runtime_error("Malformed profile " + path);
+        }
+    }
+}
+
+const Profile::Branch* Profile::branch(uint32_t node) const {
+    auto it = branches.find(node);
+    return it == branches.end() ? nullptr : &it->second;
+}
+
+uint64_t Profile::operandTypes(uint32_t node) const {
+    auto it = types.find(node);
+    return it == types.end() ? 0 : it->second;
+}
+
+bool Profile::integersOnly(uint32_t node) const {
+    return operandTypes(node) == operandBit(TRACE_INT, TRACE_INT);
+}
@@ -0,0 +1,104 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "../codegen/bytecode.h"
+#include "../trace/trace.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Profile-guided compilation. A run with --profile-out counts how often each
+// if took its then and else arms, and which operand types each arithmetic
+// operation and comparison saw. A compile with --profile-use reads that back
+// (see CodeGenerator::setProfile).
+//
+// Code is identified by the pre-order index of its AST node in the program,
+// which does not depend on how the code was laid out, so a profile taken
+// from one build can guide the next compile of the same source. Profiles
+// record a hash of the source and are only used for the source they were
+// taken from.
+
+// What the instruction at `pc` tells about AST node `node`
+enum class SiteKind : uint8_t {
+    IF_ENTRY,  // First instruction of an if: runs once per execution
+    TO_ELSE,   // Conditional jump taken when the else arm runs
+    OPERANDS,  // Arithmetic or comparison
+};
+
+struct ProfileSite {
+    size_t pc;
+    uint32_t node;
+    SiteKind kind;
+};
+
+// Bit of an operand types mask for a left and right operand of the given
+// types (TraceType)
+inline uint64_t operandBit(uint8_t left, uint8_t right) {
+    return uint64_t{1} << (left * (TRACE_OBJECT + 1) + right);
+}
+
+// Counts for one program while it runs. Parallel loop workers share it.
+class ProfileRecorder {
+public:
+    // `sites` describe `program`, as reported by CodeGenerator::profileSites()
+    ProfileRecorder(const BytecodeProgram& program, std::vector<ProfileSite> sites, uint64_t sourceHash);
+
+    // The instruction at `pc` is about to run; `types` are the top two
+    // stack values' types as in TraceRecord
+    void record(size_t pc, uint8_t types) {
+        Counters& counters = perInstruction[pc];
+        counters.executed.fetch_add(1, std::memory_order_relaxed);
+        uint64_t bit = operandBit(types >> 4, types & 0xF);
+        if (!(counters.types.load(std::memory_order_relaxed) & bit)) {
+            counters.types.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+
+    // The conditional jump at `pc` was taken
+    void taken(size_t pc) {
+        perInstruction[pc].taken.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Writes the profile; throws std::runtime_error if it cannot
+    void write(const std::string& path) const;
+
+private:
+    struct Counters {
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> taken{0};
+        std::atomic<uint64_t> types{0};
+    };
+    std::unique_ptr<Counters[]> perInstruction;
+    std::vector<ProfileSite> sites;
+    uint64_t sourceHash;
+};
+
+// A profile file read back for compiling
+class Profile {
+public:
+    struct Branch {
+        uint64_t thenCount = 0;
+        uint64_t elseCount = 0;
+    };
+
+    // Throws std::runtime_error if the file is missing or malformed
+    explicit Profile(const std::string& path);
+
+    uint64_t sourceHash() const { return sourceHash_; }
+    // How often the if at `node` ran each arm; null if it never ran
+    const Branch* branch(uint32_t node) const;
+    // Operand types seen at `node` (operandBit); 0 if it never ran
+    uint64_t operandTypes(uint32_t node) const;
+    // Whether `node` ran, always with two integer operands
+    bool integersOnly(uint32_t node) const;
+
+private:
+    uint64_t sourceHash_ = 0;
+    std::map<uint32_t, Branch> branches;
+    std::map<uint32_t, uint64_t> types;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "input.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Blocks of standard input and of files that cannot be mapped are read this
+// many bytes at a time
+static const size_t BLOCK_SIZE = 1 << 20;
+
+// Reads until `size` bytes are filled or the input ends; returns the bytes read
+static size_t readFully(int fd, char* bytes, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, bytes + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // End of input; errors end it too
+        }
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+ObjectRef InputBuffer::mapFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open file '" + path + "'");
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode)) {
+        close(fd);
+        throw std::runtime_error("Cannot read file '" + path + "'");
+    }
+    InputBuffer* buffer = new InputBuffer();
+    ObjectRef owner(buffer);
+    if (S_ISREG(info.st_mode)) {
+        buffer->length = static_cast<size_t>(info.st_size);
+        if (buffer->length > 0) {
+            void* data = mmap(nullptr, buffer->length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map file '" + path + "'");
+            }
+            madvise(data, buffer->length, MADV_SEQUENTIAL);
+            buffer->data = static_cast<char*>(data);
+            buffer->mapped = true;
+        }
+    } else {
+        // A pipe or device: read it all, doubling the buffer as it fills
+        size_t capacity = BLOCK_SIZE;
+        buffer->data = new char[capacity];
+        for (;;) {
+            buffer->length += readFully(fd, buffer->data + buffer->length, capacity - buffer->length);
+            if (buffer->length < capacity) {
+                break;
+            }
+            char* larger = new char[capacity * 2];
+            std::memcpy(larger, buffer->data, buffer->length);
+            delete[] buffer->data;
+            buffer->data = larger;
+            capacity *= 2;
+        }
+    }
+    close(fd);
+    return owner;
+}
+
+InputBuffer::InputBuffer(size_t capacity) : data(new char[capacity]), length(capacity) {}
+
+InputBuffer::~InputBuffer() {
+    if (mapped) {
+        munmap(data, length);
+    } else {
+        delete[] data;
+    }
+}
+
+bool nextLine(std::string_view text, size_t& pos, std::string_view& line) {
+    if (pos >= text.size()) {
+        return false;
+    }
+    const char* start = text.data() + pos;
+    const char* newline = static_cast<const char*>(std::memchr(start, '\n', text.size() - pos));
+    size_t length = newline ? static_cast<size_t>(newline - start) : text.size() - pos;
+    pos += newline ? length + 1 : length;
+    if (length > 0 && start[length - 1] == '\r') {
+        length--;
+    }
+    line = std::string_view(start, length);
+    return true;
+}
+
+bool LineReader::next(StringRef& line) {
+    for (;;) {
+        const char* bytes = static_cast<InputBuffer*>(block.get())->bytes();
+        if (std::memchr(bytes + pos, '\n', end - pos) || (eof && pos < end)) {
+            std::string_view view;
+            size_t at = 0;
+            nextLine(std::string_view(bytes + pos, end - pos), at, view);
+            pos += at;
+            line = StringRef::slice(view, block);
+            return true;
+        }
+        if (eof || !fill()) {
+            if (pos == end) {
+                return false;
+            }
+        }
+    }
+}
+
+StringRef LineReader::rest() {
+    while (fill()) {
+    }
+    const char* bytes = static_cast<InputBuffer*>(block.get())->bytes();
+    StringRef text = StringRef::slice(std::string_view(bytes + pos, end - pos), block);
+    pos = end;
+    return text;
+}
+
+bool LineReader::fill() {
+    if (eof) {
+        return false;
+    }
+    InputBuffer* buffer = static_cast<InputBuffer*>(block.get());
+    if (end == buffer->size()) {
+        // Lines already handed out still point into the full block, so the
+        // unread bytes move to a new one
+        size_t unread = end - pos;
+        InputBuffer* next = new InputBuffer(std::max(BLOCK_SIZE, 2 * unread));
+        std::memcpy(next->bytes(), buffer->bytes() + pos, unread);
+        block = ObjectRef(next);
+        buffer = next;
+        pos = 0;
+        end = unread;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, buffer->bytes() + end, buffer->size() - end);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        eof = true;  // Read errors end the input too
+        return false;
+    }
+    end += static_cast<size_t>(n);
+    return true;
+}
+
+StandardInput& standardInput() {
+    static StandardInput* input = new StandardInput();  // Outlives static destructors
+    return *input;
+}
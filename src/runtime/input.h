@@ -0,0 +1,72 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "object.h"
+#include "string_ref.h"
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Bytes of a file or of standard input. Strings read from them are slices
+// (see StringRef::slice) that keep the buffer alive, so reading a line or a
+// whole file copies nothing.
+class InputBuffer : public Object {
+public:
+    // Maps the file read-only. Throws std::runtime_error if it cannot be
+    // opened or mapped.
+    static ObjectRef mapFile(const std::string& path);
+    // `capacity` bytes on the heap, to be filled through bytes()
+    explicit InputBuffer(size_t capacity);
+    ~InputBuffer() override;
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    const char* typeName() const override { return "buffer"; }
+    char* bytes() { return data; }
+    const char* bytes() const { return data; }
+    size_t size() const { return length; }
+
+private:
+    InputBuffer() = default;
+    char* data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+};
+
+// The line starting at `pos` in `text`, without its "\n" or "\r\n"; moves
+// `pos` past it. False if `pos` is at the end.
+bool nextLine(std::string_view text, size_t& pos, std::string_view& line);
+
+// Reads a file descriptor in large blocks and cuts it into lines. Each line
+// is a slice of the block it was found in; a line that crosses the end of a
+// block is moved to the start of the next one.
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    // The next line; false at the end of the input
+    bool next(StringRef& line);
+    // Everything not read yet, in one string
+    StringRef rest();
+
+private:
+    int fd;
+    ObjectRef block{new InputBuffer(0)};
+    size_t pos = 0;   // Start of the unread bytes in `block`
+    size_t end = 0;   // End of the bytes read into `block`
+    bool eof = false;
+
+    // Reads more into a block that starts with the unread bytes; false at
+    // the end of the input
+    bool fill();
+};
+
+// Standard input. Any thread may read it while holding `mutex`.
+struct StandardInput {
+    std::mutex mutex;
+    LineReader reader{0};
+};
+StandardInput& standardInput();
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+
+// Text of numbers in printing and string concatenation. Doubles get the
+// shortest text that reads back as the same value (`0.1`, `1.5`, `1e+20`),
+// in fixed or scientific notation, whichever is shorter. None of this
+// depends on the locale.
+
+// Room the formatters need: "-1.2345678901234567e-308" is 24 characters
+constexpr size_t NUMBER_TEXT_MAX = 32;
+
+// Write the text of `value` at `out`, which has room for NUMBER_TEXT_MAX
+// characters, and return its end. No terminating NUL is written.
+inline char* formatNumber(int64_t value, char* out) {
+    return std::to_chars(out, out + NUMBER_TEXT_MAX, value).ptr;
+}
+
+inline char* formatNumber(double value, char* out) {
+    return std::to_chars(out, out + NUMBER_TEXT_MAX, value).ptr;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// A mutable value on the heap, such as a channel. Objects are shared by
+// reference: copying a value that holds one copies the reference, and the
+// object is freed when the last reference goes away. Reference counts are
+// atomic since tasks on other threads may hold references.
+struct Object {
+    std::atomic<uint32_t> refCount{1};
+
+    virtual ~Object() = default;
+    // Used in error messages and for printing, e.g. "channel"
+    virtual const char* typeName() const = 0;
+};
+
+// Counted reference to an Object; never null
+class ObjectRef {
+public:
+    // Adopts the reference `object` was created with
+    explicit ObjectRef(Object* object) noexcept : object(object) {}
+    ObjectRef(const ObjectRef& other) noexcept : object(other.object) {
+        object->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    ObjectRef(ObjectRef&& other) noexcept : object(other.object) { other.object = nullptr; }
+    ObjectRef& operator=(const ObjectRef& other) noexcept {
+        ObjectRef copy(other);
+        std::swap(object, copy.object);
+        return *this;
+    }
+    ObjectRef& operator=(ObjectRef&& other) noexcept {
+        std::swap(object, other.object);
+        return *this;
+    }
+    ~ObjectRef() {
+        if (object && object->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete object;
+        }
+    }
+
+    Object* get() const { return object; }
+    // The object as a `T`, or null if it is something else
+    template <typename T>
+    T* as() const { return dynamic_cast<T*>(object); }
+
+    // Objects are equal only to themselves
+    friend bool operator==(const ObjectRef& a, const ObjectRef& b) { return a.object == b.object; }
+    friend bool operator!=(const ObjectRef& a, const ObjectRef& b) { return a.object != b.object; }
+
+private:
+    Object* object;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+#include <string>
+
+// SHA-256 of `size` bytes at `data`, as 64 lowercase hex digits. Used where a
+// hash names content that someone else could choose, such as the playground's
+// shared result cache, so that two programs cannot be made to collide.
+std::string sha256Hex(const char* data, size_t size);
+
+#endif
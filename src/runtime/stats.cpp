@@ -0,0 +1,102 @@
+#include "stats.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+#include <sys/resource.h>
+
+namespace {
+
+// Written once before any other thread exists, so a plain flag suffices
+bool counting = false;
+std::atomic<uint64_t> allocationCount{0};
+std::atomic<uint64_t> allocatedBytes{0};
+
+void* allocate(size_t size) {
+    if (counting) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+double wallTimeMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+void enableAllocationCounting() {
+    counting = true;
+}
+
+AllocationCounts allocationCounts() {
+    AllocationCounts counts;
+    counts.count = allocationCount.load(std::memory_order_relaxed);
+    counts.bytes = allocatedBytes.load(std::memory_order_relaxed);
+    return counts;
+}
+
+double cpuTimeMs() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+long peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  // Kilobytes on Linux
+}
+
+StatsReport::Scope::Scope(StatsReport* report, const char* name) : report(report) {
+    if (!report) return;
+    phase.name = name;
+    wallStart = wallTimeMs();
+    cpuStart = cpuTimeMs();
+    allocationsStart = allocationCounts();
+}
+
+StatsReport::Scope::~Scope() {
+    if (!report) return;
+    phase.wallMs = wallTimeMs() - wallStart;
+    phase.cpuMs = cpuTimeMs() - cpuStart;
+    AllocationCounts now = allocationCounts();
+    phase.allocations.count = now.count - allocationsStart.count;
+    phase.allocations.bytes = now.bytes - allocationsStart.bytes;
+    report->phases.push_back(phase);
+}
+
+void StatsReport::setCount(const std::string& name, uint64_t value) {
+    counts.emplace_back(name, value);
+}
+
+void StatsReport::write(std::ostream& out) const {
+    AllocationCounts total = allocationCounts();
+    out << std::fixed << std::setprecision(3) << "{\"phases\":[";
+    for (size_t i = 0; i < phases.size(); i++) {
+        const Phase& phase = phases[i];
+        out << (i ? "," : "") << "{\"name\":\"" << phase.name << "\",\"wall_ms\":" << phase.wallMs
+            << ",\"cpu_ms\":" << phase.cpuMs << ",\"allocations\":" << phase.allocations.count
+            << ",\"allocated_bytes\":" << phase.allocations.bytes << "}";
+    }
+    out << "],\"counts\":{";
+    for (size_t i = 0; i < counts.size(); i++) {
+        out << (i ? "," : "") << "\"" << counts[i].first << "\":" << counts[i].second;
+    }
+    out << "},\"allocations\":" << total.count << ",\"allocated_bytes\":" << total.bytes
+        << ",\"peak_rss_kb\":" << peakRssKb() << "}" << std::endl;
+}
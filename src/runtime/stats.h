@@ -0,0 +1,62 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Allocations made through the global operator new since counting was
+// enabled. The replacement operators (stats.cpp) count nothing until then.
+struct AllocationCounts {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+
+// Call before starting any threads
+void enableAllocationCounting();
+AllocationCounts allocationCounts();
+
+// Process CPU time (all threads) in milliseconds
+double cpuTimeMs();
+// Peak resident set size in kilobytes
+long peakRssKb();
+
+// Per-phase costs of one compiler run, written as a single JSON object for
+// `--stats`
+class StatsReport {
+public:
+    struct Phase {
+        std::string name;
+        double wallMs = 0;
+        double cpuMs = 0;
+        AllocationCounts allocations;
+    };
+
+    // Measures the enclosing scope as one phase; does nothing without a
+    // report
+    class Scope {
+    public:
+        Scope(StatsReport* report, const char* name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        StatsReport* report;
+        Phase phase;
+        double wallStart = 0;
+        double cpuStart = 0;
+        AllocationCounts allocationsStart;
+    };
+
+    void setCount(const std::string& name, uint64_t value);
+    void write(std::ostream& out) const;
+
+private:
+    std::vector<Phase> phases;
+    std::vector<std::pair<std::string, uint64_t>> counts;
+};
+
+#endif
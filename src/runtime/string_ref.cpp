@@ -0,0 +1,145 @@
+#include "string_ref.h"
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+// Interned strings are never freed, so the table's keys can view their bytes
+struct InternTable {
+    std::mutex mutex;
+    std::unordered_map<std::string_view, StringObject*> strings;
+};
+
+static InternTable& internTable() {
+    static InternTable* table = new InternTable();  // Outlives static destructors
+    return *table;
+}
+
+StringObject* StringRef::allocate(size_t length) {
+    void* memory = ::operator new(sizeof(StringObject) + length + 1);
+    StringObject* object = new (memory) StringObject;
+    object->refCount.store(1, std::memory_order_relaxed);
+    object->interned = false;
+    object->slice = false;
+    object->length = length;
+    object->hash = 0;
+    return object;
+}
+
+void StringRef::finish(StringObject* object) {
+    char* chars = const_cast<char*>(object->chars());
+    chars[object->length] = '\0';
+    object->hash = std::hash<std::string_view>()(std::string_view(chars, object->length));
+}
+
+StringObject* StringRef::internObject(std::string_view text) {
+    InternTable& table = internTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.strings.find(text);
+    if (it != table.strings.end()) {
+        return it->second;
+    }
+    StringObject* object = allocate(text.size());
+    std::memcpy(const_cast<char*>(object->chars()), text.data(), text.size());
+    finish(object);
+    object->interned = true;
+    object->refCount.store(StringObject::IMMORTAL, std::memory_order_relaxed);
+    table.strings.emplace(std::string_view(object->chars(), object->length), object);
+    return object;
+}
+
+StringRef::StringRef() {
+    static StringObject* empty = internObject("");
+    object = empty;
+}
+
+StringRef::StringRef(const StringRef& other) noexcept : object(other.object) {
+    retain();
+}
+
+StringRef::StringRef(StringRef&& other) noexcept : object(other.object) {
+    other.object = StringRef().object;
+}
+
+StringRef& StringRef::operator=(const StringRef& other) noexcept {
+    if (object != other.object) {
+        other.retain();
+        release();
+        object = other.object;
+    }
+    return *this;
+}
+
+StringRef& StringRef::operator=(StringRef&& other) noexcept {
+    if (this != &other) {
+        release();
+        object = other.object;
+        other.object = StringRef().object;
+    }
+    return *this;
+}
+
+StringRef::~StringRef() {
+    release();
+}
+
+void StringRef::retain() const {
+    if (object->refCount.load(std::memory_order_relaxed) != StringObject::IMMORTAL) {
+        object->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void StringRef::release() {
+    if (object->refCount.load(std::memory_order_relaxed) == StringObject::IMMORTAL) {
+        return;
+    }
+    if (object->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (object->slice) {
+            delete static_cast<StringSlice*>(object);
+            return;
+        }
+        object->~StringObject();
+        ::operator delete(object);
+    }
+}
+
+StringRef StringRef::intern(std::string_view text) {
+    return StringRef(internObject(text));
+}
+
+StringRef StringRef::make(std::string_view text) {
+    return concat(text, std::string_view());
+}
+
+StringRef StringRef::concat(std::string_view left, std::string_view right) {
+    if (left.empty() && right.empty()) {
+        return StringRef();
+    }
+    StringObject* object = allocate(left.size() + right.size());
+    char* chars = const_cast<char*>(object->chars());
+    std::memcpy(chars, left.data(), left.size());
+    std::memcpy(chars + left.size(), right.data(), right.size());
+    finish(object);
+    return StringRef(object);
+}
+
+StringRef StringRef::slice(std::string_view text, ObjectRef owner) {
+    if (text.empty()) {
+        return StringRef();
+    }
+    StringSlice* object = new StringSlice(text.data(), std::move(owner));
+    object->refCount.store(1, std::memory_order_relaxed);
+    object->interned = false;
+    object->slice = true;
+    object->length = text.size();
+    object->hash = std::hash<std::string_view>()(text);
+    return StringRef(object);
+}
+
+StringRef StringRef::interned() const {
+    if (object->interned) {
+        return *this;
+    }
+    return intern(view());
+}
@@ -0,0 +1,105 @@
+#ifndef STRING_REF_H
+#define STRING_REF_H
+
+#include "object.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Immutable string: this header is immediately followed by `length` bytes
+// and a terminating NUL, unless it is a StringSlice. The hash is computed
+// once at creation.
+struct StringObject {
+    static const uint32_t IMMORTAL = UINT32_MAX;
+    
+    std::atomic<uint32_t> refCount;  // IMMORTAL for interned strings
+    bool interned;
+    bool slice;                      // A StringSlice
+    size_t length;
+    size_t hash;
+    
+    inline const char* chars() const;
+};
+
+// A string whose bytes are part of a buffer owned by another object, such as
+// a line of a mapped file. It keeps that object alive. The bytes are not
+// NUL-terminated.
+struct StringSlice : StringObject {
+    const char* data;
+    ObjectRef owner;
+    
+    StringSlice(const char* data, ObjectRef owner) : data(data), owner(std::move(owner)) {}
+};
+
+const char* StringObject::chars() const {
+    return slice ? static_cast<const StringSlice*>(this)->data : reinterpret_cast<const char*>(this + 1);
+}
+
+// Handle to a StringObject. Copying one bumps a reference count, except for
+// interned strings, which live for the whole process: copying those is a
+// plain pointer copy, and two interned strings are equal exactly when they
+// are the same object.
+class StringRef {
+public:
+    StringRef();  // The interned empty string
+    StringRef(const StringRef& other) noexcept;
+    StringRef(StringRef&& other) noexcept;
+    StringRef& operator=(const StringRef& other) noexcept;
+    StringRef& operator=(StringRef&& other) noexcept;
+    ~StringRef();
+    
+    // Returns the canonical copy of `text`, creating it on first use.
+    // Thread-safe.
+    static StringRef intern(std::string_view text);
+    // A new reference-counted string
+    static StringRef make(std::string_view text);
+    static StringRef concat(std::string_view left, std::string_view right);
+    // A string viewing `text` without copying it; `owner` must keep the
+    // bytes alive and unchanged
+    static StringRef slice(std::string_view text, ObjectRef owner);
+    // Wraps a string that was not allocated here, such as one inside a
+    // mapped snapshot file. It must be IMMORTAL and not interned, and must
+    // outlive every reference to it.
+    static StringRef wrap(const StringObject* object) { return StringRef(const_cast<StringObject*>(object)); }
+    
+    // The canonical copy of this string
+    StringRef interned() const;
+    
+    std::string_view view() const { return {object->chars(), object->length}; }
+    const char* data() const { return object->chars(); }  // Not NUL-terminated for slices
+    size_t size() const { return object->length; }
+    bool empty() const { return object->length == 0; }
+    size_t hash() const { return object->hash; }
+    bool isInterned() const { return object->interned; }
+    bool isSlice() const { return object->slice; }
+    std::string str() const { return std::string(view()); }
+    
+    friend bool operator==(const StringRef& a, const StringRef& b) {
+        if (a.object == b.object) return true;
+        if (a.object->interned && b.object->interned) return false;
+        return a.object->length == b.object->length && a.object->hash == b.object->hash &&
+               a.view() == b.view();
+    }
+    friend bool operator!=(const StringRef& a, const StringRef& b) { return !(a == b); }
+    friend bool operator<(const StringRef& a, const StringRef& b) { return a.view() < b.view(); }
+    friend bool operator<=(const StringRef& a, const StringRef& b) { return a.view() <= b.view(); }
+    friend bool operator>(const StringRef& a, const StringRef& b) { return a.view() > b.view(); }
+    friend bool operator>=(const StringRef& a, const StringRef& b) { return a.view() >= b.view(); }
+    friend std::ostream& operator<<(std::ostream& out, const StringRef& s) { return out << s.view(); }
+    
+private:
+    explicit StringRef(StringObject* object) : object(object) {}  // Adopts one reference
+    
+    static StringObject* allocate(size_t length);
+    static StringObject* internObject(std::string_view text);
+    static void finish(StringObject* object);
+    void retain() const;
+    void release();
+    
+    StringObject* object;
+};
+
+#endif
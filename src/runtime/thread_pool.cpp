@@ -0,0 +1,114 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+
+// Pool and worker index of the worker running on this thread, if any
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    size_t index = currentPool == this
+        ? currentWorker
+        : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    // Taking the lock orders this wakeup after a worker's empty check
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeup.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    idle.wait(lock, [this] { return pending.load() == 0; });
+}
+
+bool ThreadPool::takeTask(size_t index, Task& task) {
+    // Own deque: newest first, for locality
+    {
+        Worker& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    // Steal the oldest task of another worker
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+        Worker& victim = *queues[(index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    
+    while (true) {
+        Task task;
+        if (takeTask(index, task)) {
+            task();
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                idle.notify_all();
+            }
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (stopping) return;
+        // Recheck under the lock so a concurrent submit cannot be missed
+        bool empty = true;
+        for (auto& queue : queues) {
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            if (!queue->tasks.empty()) {
+                empty = false;
+                break;
+            }
+        }
+        if (empty) {
+            wakeup.wait(lock);
+        }
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool([] {
+        const char* threads = std::getenv("COMPII_THREADS");
+        return threads ? static_cast<size_t>(std::strtoul(threads, nullptr, 10)) : 0;
+    }());
+    return pool;
+}
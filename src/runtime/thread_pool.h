@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads with one task deque per worker. A worker
+// takes its newest task first and, when its own deque is empty, steals the
+// oldest task of another worker.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+    
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+    
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    
+    // Tasks submitted from a worker go to that worker's own deque
+    void submit(Task task);
+    
+    // Blocks until every submitted task has finished
+    void wait();
+    
+    size_t size() const { return workers.size(); }
+    
+    // Process-wide pool for parallel loops, created on first use. Its size
+    // comes from the COMPII_THREADS environment variable, else one thread
+    // per core.
+    static ThreadPool& shared();
+    
+private:
+    struct Worker {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+    
+    std::vector<std::unique_ptr<Worker>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    std::condition_variable idle;
+    std::atomic<size_t> pending{0};     // Submitted but not finished
+    std::atomic<size_t> nextQueue{0};   // Round-robin for outside submitters
+    bool stopping = false;
+    
+    void workerLoop(size_t index);
+    bool takeTask(size_t index, Task& task);
+};
+
+#endif
@@ -2,29 +2,201 @@ const express = require("express");
 const cors = require("cors");
 const fs = require("fs");
 const path = require("path");
-const { exec } = require("child_process");
+const os = require("os");
+const { execFile } = require("child_process");
+
+const compilerPath = path.join(__dirname, "compii.exe");
+
+// Per-session incremental compile cache
+const sessionDir = path.join(os.tmpdir(), "compii-sessions");
+fs.mkdirSync(sessionDir, { recursive: true });
+const SESSION_PATTERN = /^[A-Za-z0-9_-]{1,64}$/;
+let tempCounter = 0;
+
+// A program that reads no input has output that only depends on its
+// bytecode. Results are kept by bytecode hash in memory, least recently used
+// first, and optionally saved to COMPII_RESULT_CACHE so they survive
+// restarts. Programs that read input are always run.
+const RESULT_CACHE_BYTES = Number(process.env.COMPII_RESULT_CACHE_BYTES) || 16 * 1024 * 1024;
+const RESULT_CACHE_FILE = process.env.COMPII_RESULT_CACHE;
+const SAVE_DELAY_MS = 1000;
+// Programs are killed after this long, so one that never finishes does not
+// hold its pending cache entry, and every request waiting on it, forever
+const RUN_TIMEOUT_MS = Number(process.env.COMPII_RUN_TIMEOUT_MS) || 10000;
+
+class ResultCache {
+  constructor(maxBytes, file) {
+    this.maxBytes = maxBytes;
+    this.file = file;
+    this.entries = new Map(); // hash -> { output, size }, oldest use first
+    this.bytes = 0;
+    this.pending = new Map(); // hash -> promise of the running program's result
+    this.saveTimer = null;
+    this.stats = { hits: 0, misses: 0, coalesced: 0, evictions: 0 };
+    // Results of another compiler build may differ
+    this.stamp = fs.existsSync(compilerPath) ? String(fs.statSync(compilerPath).mtimeMs) : "";
+    this.load();
+  }
+
+  get(hash) {
+    const entry = this.entries.get(hash);
+    if (entry) {
+      this.entries.delete(hash);
+      this.entries.set(hash, entry);
+    }
+    return entry;
+  }
+
+  set(hash, output) {
+    const size = hash.length + Buffer.byteLength(output);
+    if (size > this.maxBytes) return;
+    const old = this.entries.get(hash);
+    if (old) {
+      this.bytes -= old.size;
+      this.entries.delete(hash);
+    }
+    this.entries.set(hash, { output, size });
+    this.bytes += size;
+    for (const [oldest, entry] of this.entries) {
+      if (this.bytes <= this.maxBytes) break;
+      this.entries.delete(oldest);
+      this.bytes -= entry.size;
+      this.stats.evictions++;
+    }
+    this.scheduleSave();
+  }
+
+  // Runs `run` for a hash that is not cached, once however many requests
+  // ask for it at the same time. `run` resolves to { output, cacheable }.
+  async lookup(hash, run) {
+    const entry = this.get(hash);
+    if (entry) {
+      this.stats.hits++;
+      return { output: entry.output, cached: true };
+    }
+    if (this.pending.has(hash)) {
+      this.stats.coalesced++;
+      return this.pending.get(hash);
+    }
+    this.stats.misses++;
+    const result = run()
+      .then((result) => {
+        if (result.cacheable) this.set(hash, result.output);
+        return { output: result.output, cached: false };
+      })
+      .finally(() => this.pending.delete(hash));
+    this.pending.set(hash, result);
+    return result;
+  }
+
+  metrics() {
+    const requests = this.stats.hits + this.stats.misses + this.stats.coalesced;
+    return {
+      ...this.stats,
+      hitRate: requests ? (this.stats.hits + this.stats.coalesced) / requests : 0,
+      entries: this.entries.size,
+      bytes: this.bytes,
+      maxBytes: this.maxBytes,
+      running: this.pending.size,
+    };
+  }
+
+  load() {
+    if (!this.file || !fs.existsSync(this.file)) return;
+    try {
+      const saved = JSON.parse(fs.readFileSync(this.file, "utf8"));
+      if (saved.stamp !== this.stamp) return;
+      for (const [hash, output] of saved.entries) this.set(hash, output);
+    } catch (error) {
+      console.warn(`Ignoring result cache ${this.file}: ${error.message}`);
+    }
+  }
+
+  // Writes at most once per SAVE_DELAY_MS, through a temporary file so a
+  // crash never leaves a partial cache behind
+  scheduleSave() {
+    if (!this.file || this.saveTimer) return;
+    this.saveTimer = setTimeout(() => {
+      this.saveTimer = null;
+      const entries = [...this.entries].map(([hash, entry]) => [hash, entry.output]);
+      const temp = `${this.file}.tmp`;
+      fs.writeFile(temp, JSON.stringify({ stamp: this.stamp, entries }), (error) => {
+        if (error) return console.warn(`Could not save result cache: ${error.message}`);
+        fs.rename(temp, this.file, () => {});
+      });
+    }, SAVE_DELAY_MS);
+    this.saveTimer.unref();
+  }
+}
+
+const resultCache = new ResultCache(RESULT_CACHE_BYTES, RESULT_CACHE_FILE);
+
+// Resolves to { error, stdout, stderr } of a compii run; `input` is its
+// standard input. `error.killed` is set if it ran out of time.
+function runCompiler(args, input = "") {
+  return new Promise((resolve) => {
+    const options = { timeout: RUN_TIMEOUT_MS, killSignal: "SIGKILL" };
+    const child = execFile(compilerPath, args, options, (error, stdout, stderr) =>
+      resolve({ error, stdout, stderr }));
+    child.stdin.on("error", () => {}); // The program may exit without reading it all
+    child.stdin.end(input);
+  });
+}
 
 const app = express();
 app.use(cors());
 app.use(express.json());
 app.use(express.static(__dirname)); // serve index.html and other static files
 
-app.post("/run", (req, res) => {
+app.post("/run", async (req, res) => {
   const code = req.body.code;
-  const tempFile = path.join(__dirname, "temp.compii");
-  const compilerPath = path.join(__dirname, "compii.exe");
+  const session = req.body.session;
+  const input = typeof req.body.input === "string" ? req.body.input : "";
+  // Every request compiles and runs its own copy of the code, so the
+  // program that is run is the one that was hashed even when requests of
+  // one session overlap
+  const tempFile = path.join(os.tmpdir(), `compii-${process.pid}-${tempCounter++}.compii`);
+  let flags = [];
 
-  fs.writeFileSync(tempFile, code);
+  // Sessions recompile only the statements that changed since their last run
+  if (typeof session === "string" && SESSION_PATTERN.test(session)) {
+    flags = ["--incremental", path.join(sessionDir, `${session}.cache`)];
+  }
 
-  exec(`"${compilerPath}" "${tempFile}"`, (error, stdout, stderr) => {
-    if (error) {
-      return res.json({ output: stderr || error.message });
+  fs.writeFileSync(tempFile, code);
+  try {
+    // Compile errors are reported exactly as a run would report them
+    const compiled = await runCompiler([...flags, "--bytecode-hash", tempFile]);
+    if (compiled.error) {
+      return res.json({ output: compiled.stderr || compiled.error.message });
     }
-    res.json({ output: stdout });
-  });
+    const match = compiled.stderr.match(/^\[incremental\] (.*)$/m);
+    const compileInfo = match ? match[1] : undefined;
+
+    // Programs may read the request's input but not the server's files
+    const run = async () => {
+      const { error, stdout, stderr } = await runCompiler([...flags, "--no-file-input", tempFile], input);
+      if (error) {
+        // A runtime error is as repeatable as output; a killed or missing
+        // compiler is not
+        const output = error.killed ? `${stdout}Program stopped after ${RUN_TIMEOUT_MS} ms` : stderr || error.message;
+        return { output, cacheable: error.code === 1 };
+      }
+      return { output: stdout, cacheable: true };
+    };
+    const [hash, readsInput] = compiled.stdout.trim().split(" ");
+    const result = readsInput ? await run() : await resultCache.lookup(hash, run);
+    res.json({ output: result.output, compileInfo, cached: result.cached });
+  } finally {
+    fs.unlink(tempFile, () => {});
+  }
+});
+
+app.get("/metrics", (req, res) => {
+  res.json({ resultCache: resultCache.metrics() });
 });
 
 const PORT = 5000;
 app.listen(PORT, () => {
   console.log(`✅ Server running at http://localhost:${PORT}`);
-});
\ No newline at end of file
+});
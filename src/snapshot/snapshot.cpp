@@ -0,0 +1,256 @@
+#include "snapshot.h"
+#include "../codegen/serializer.h"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[4] = {'C', 'M', 'P', 'S'};
+const uint32_t SNAPSHOT_VERSION = 8;
+
+// Hash of this string as computed by StringRef; images carry their hash, so a
+// build that hashes differently must not load them
+const char HASH_PROBE[] = "compii snapshot";
+
+// File layout: header, program (BytecodeWriter encoding), global records,
+// then the string images. Offsets are from the start of the file.
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hashProbe;
+    uint64_t pc;
+    uint64_t programOffset;
+    uint64_t programSize;
+    uint64_t globalsOffset;
+    uint64_t globalCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+enum class SlotType : uint8_t { INT, DOUBLE, BOOL, STRING, INTERNED_STRING };
+
+// One global variable. Strings hold the file offset of their image.
+struct SnapshotSlot {
+    SlotType type;
+    uint8_t padding[7];
+    uint64_t bits;
+};
+
+const size_t ALIGNMENT = alignof(StringObject);
+
+size_t alignUp(size_t offset) {
+    return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+size_t hashProbe() {
+    return StringRef::make(HASH_PROBE).hash();
+}
+
+// Read-only istream over bytes that are already in memory
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(const char* begin, size_t size) {
+        char* p = const_cast<char*>(begin);
+        setg(p, p, p + size);
+    }
+};
+
+[[noreturn]] void corrupt(const std::string& path) {
+    throw std::runtime_error("Corrupt snapshot file: " + path);
+}
+
+} // namespace
+
+void writeSnapshot(const std::string& path, const BytecodeProgram& program, size_t pc,
+                   const std::vector<Value>& globals) {
+    std::ostringstream encoded;
+    BytecodeWriter writer(encoded);
+    writer.writeProgram(program);
+    std::string programBytes = encoded.str();
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.hashProbe = hashProbe();
+    header.pc = pc;
+    header.programOffset = sizeof(SnapshotHeader);
+    header.programSize = programBytes.size();
+    header.globalsOffset = alignUp(header.programOffset + header.programSize);
+    header.globalCount = globals.size();
+    header.stringsOffset = header.globalsOffset + globals.size() * sizeof(SnapshotSlot);
+
+    // Each distinct string is stored once
+    std::string strings;
+    std::unordered_map<std::string_view, uint64_t> stored;
+    std::vector<SnapshotSlot> slots(globals.size());
+    for (size_t i = 0; i < globals.size(); i++) {
+        const Value& value = globals[i];
+        SnapshotSlot& slot = slots[i];
+        if (std::holds_alternative<int64_t>(value)) {
+            slot.type = SlotType::INT;
+            slot.bits = static_cast<uint64_t>(std::get<int64_t>(value));
+        } else if (std::holds_alternative<double>(value)) {
+            slot.type = SlotType::DOUBLE;
+            double d = std::get<double>(value);
+            std::memcpy(&slot.bits, &d, sizeof(d));
+        } else if (std::holds_alternative<bool>(value)) {
+            slot.type = SlotType::BOOL;
+            slot.bits = std::get<bool>(value) ? 1 : 0;
+        } else if (const ObjectRef* ref = std::get_if<ObjectRef>(&value)) {
+            throw std::runtime_error(std::string("Cannot save a ") + ref->get()->typeName() + " in a snapshot");
+        } else {
+            const StringRef& text = std::get<StringRef>(value);
+            slot.type = text.isInterned() ? SlotType::INTERNED_STRING : SlotType::STRING;
+            auto it = stored.find(text.view());
+            if (it != stored.end()) {
+                slot.bits = it->second;
+                continue;
+            }
+            alignas(StringObject) char image[sizeof(StringObject)] = {};
+            StringObject* object = new (image) StringObject;
+            object->refCount.store(StringObject::IMMORTAL, std::memory_order_relaxed);
+            object->interned = false;
+            object->slice = false;
+            object->length = text.size();
+            object->hash = text.hash();
+
+            strings.resize(alignUp(strings.size()), '\0');
+            slot.bits = header.stringsOffset + strings.size();
+            strings.append(image, sizeof(image));
+            strings.append(text.data(), text.size());
+            strings.push_back('\0');
+            stored.emplace(text.view(), slot.bits);
+        }
+    }
+    header.stringsSize = strings.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not write snapshot " + path);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(programBytes.data(), programBytes.size());
+    std::string padding(header.globalsOffset - header.programOffset - header.programSize, '\0');
+    file.write(padding.data(), padding.size());
+    file.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(SnapshotSlot));
+    file.write(strings.data(), strings.size());
+    if (!file) {
+        throw std::runtime_error("Could not write snapshot " + path);
+    }
+}
+
+Snapshot::Snapshot(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open snapshot " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        close(fd);
+        corrupt(path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    // Private and read-only: string images are never written, and their
+    // pages are only read in when a string is used
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        throw std::runtime_error("Could not map snapshot " + path);
+    }
+
+    try {
+        const char* base = static_cast<const char*>(data);
+        SnapshotHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SNAPSHOT_VERSION) {
+            throw std::runtime_error("Not a snapshot file: " + path);
+        }
+        if (header.hashProbe != hashProbe()) {
+            throw std::runtime_error("Snapshot " + path + " was written by an incompatible build");
+        }
+        auto inFile = [&](uint64_t offset, uint64_t length) {
+            return offset <= size && length <= size - offset;
+        };
+        if (!inFile(header.programOffset, header.programSize) ||
+            header.globalCount > size / sizeof(SnapshotSlot) ||
+            !inFile(header.globalsOffset, header.globalCount * sizeof(SnapshotSlot)) ||
+            header.globalsOffset % ALIGNMENT != 0 ||
+            !inFile(header.stringsOffset, header.stringsSize)) {
+            corrupt(path);
+        }
+
+        MemoryBuffer buffer(base + header.programOffset, header.programSize);
+        std::istream in(&buffer);
+        BytecodeReader reader(in);
+        program_ = reader.readProgram();
+        resumePc_ = header.pc;
+
+        const auto* slots = reinterpret_cast<const SnapshotSlot*>(base + header.globalsOffset);
+        uint64_t stringsEnd = header.stringsOffset + header.stringsSize;
+        globals_.reserve(header.globalCount);
+        for (uint64_t i = 0; i < header.globalCount; i++) {
+            const SnapshotSlot& slot = slots[i];
+            switch (slot.type) {
+                case SlotType::INT:
+                    globals_.emplace_back(static_cast<int64_t>(slot.bits));
+                    break;
+                case SlotType::DOUBLE: {
+                    double d;
+                    std::memcpy(&d, &slot.bits, sizeof(d));
+                    globals_.emplace_back(d);
+                    break;
+                }
+                case SlotType::BOOL:
+                    globals_.emplace_back(slot.bits != 0);
+                    break;
+                case SlotType::STRING:
+                case SlotType::INTERNED_STRING: {
+                    if (slot.bits < header.stringsOffset || slot.bits % ALIGNMENT != 0 ||
+                        stringsEnd - slot.bits < sizeof(StringObject) + 1) {
+                        corrupt(path);
+                    }
+                    const auto* object = reinterpret_cast<const StringObject*>(base + slot.bits);
+                    if (object->refCount.load(std::memory_order_relaxed) != StringObject::IMMORTAL ||
+                        object->interned || object->slice || object->length > stringsEnd - slot.bits - sizeof(StringObject) - 1 ||
+                        object->chars()[object->length] != '\0') {
+                        corrupt(path);
+                    }
+                    // Interned strings must stay canonical; the rest are used in place
+                    StringRef text = StringRef::wrap(object);
+                    if (slot.type == SlotType::INTERNED_STRING) {
+                        globals_.emplace_back(text.interned());
+                    } else {
+                        globals_.emplace_back(std::move(text));
+                    }
+                    break;
+                }
+                default:
+                    corrupt(path);
+            }
+        }
+    } catch (...) {
+        globals_.clear();
+        munmap(data, size);
+        data = nullptr;
+        throw;
+    }
+}
+
+Snapshot::~Snapshot() {
+    // Strings in the globals point into the mapping
+    globals_.clear();
+    if (data) {
+        munmap(data, size);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "../codegen/bytecode.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// VM state saved at a `checkpoint;` statement, so that a later run can start
+// from there instead of repeating the work before it. Checkpoints only occur
+// in top-level code with an empty operand stack, so the state is the program,
+// the global variables and the pc to continue at.
+//
+// The file is laid out to be mapped rather than parsed: globals are fixed-size
+// records, and each string is stored as a complete StringObject image that
+// the loaded values point into. Like the bytecode cache, a snapshot is only
+// meant to be read by the build that wrote it.
+
+// Writes a snapshot of `globals` that resumes `program` at `pc`; throws
+// std::runtime_error if the file cannot be written
+void writeSnapshot(const std::string& path, const BytecodeProgram& program, size_t pc,
+                   const std::vector<Value>& globals);
+
+// A snapshot file mapped into memory. Strings in globals() live in the
+// mapping, so values taken from it must not outlive this object.
+class Snapshot {
+public:
+    // Throws std::runtime_error if the file is missing or malformed
+    explicit Snapshot(const std::string& path);
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    const BytecodeProgram& program() const { return program_; }
+    size_t resumePc() const { return resumePc_; }
+    const std::vector<Value>& globals() const { return globals_; }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+    BytecodeProgram program_;
+    size_t resumePc_ = 0;
+    std::vector<Value> globals_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "stream.h"
+#include "../lexer/lexer.h"
+#include "../parser/parser.h"
+#include "../codegen/codegen.h"
+#include "../codegen/vm.h"
+#include "../incremental/incremental.h"
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Read size; doubled while a single statement does not fit
+static const size_t READ_BLOCK = 64 * 1024;
+
+// Longest time output waits in the buffer
+static const std::chrono::milliseconds FLUSH_INTERVAL(50);
+
+int runStream(const std::string& path, bool checked, bool fileInput, std::ostream& out, std::ostream& err) {
+    try {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open " + path);
+        }
+        
+        // One table for the whole stream: the generator keeps slots by symbol
+        // from chunk to chunk
+        SymbolTable symbols;
+        CodeGenerator generator(symbols);
+        VirtualMachine vm(out, err);
+        vm.setChecked(checked);
+        vm.setFileInput(fileInput);
+        // Function bodies stay in the program, and their ASTs are kept for
+        // inlining into later statements
+        std::vector<std::unique_ptr<Statement>> functions;
+        
+        std::string buffer;
+        size_t pos = 0;
+        size_t block = READ_BLOCK;
+        bool atEnd = false;
+        auto lastFlush = std::chrono::steady_clock::now();
+        
+        while (true) {
+            SourceChunk chunk;
+            if (!nextTopLevel(buffer, pos, atEnd, chunk)) {
+                if (atEnd) break;
+                
+                // Drop consumed text, then read more
+                buffer.erase(0, pos);
+                pos = 0;
+                if (buffer.size() + READ_BLOCK > block) block *= 2;
+                size_t used = buffer.size();
+                buffer.resize(used + block);
+                file.read(&buffer[used], static_cast<std::streamsize>(block));
+                buffer.resize(used + static_cast<size_t>(file.gcount()));
+                atEnd = !file;
+                continue;
+            }
+            pos = chunk.end;
+            
+            std::vector<std::unique_ptr<Statement>> statements;
+            {
+                Lexer lexer(buffer.substr(chunk.begin, chunk.end - chunk.begin), symbols);
+                Parser parser(lexer.tokenize());
+                statements = parser.parse();
+            }
+            for (auto& stmt : statements) {
+                const BytecodeProgram& program = generator.generateNext(stmt.get());
+                if (dynamic_cast<FunctionStmt*>(stmt.get())) {
+                    functions.push_back(std::move(stmt));
+                }
+                if (!vm.executeNext(program)) {
+                    out.flush();
+                    return 1;
+                }
+            }
+            
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastFlush >= FLUSH_INTERVAL) {
+                out.flush();
+                lastFlush = now;
+            }
+        }
+        out.flush();
+        return 0;
+    } catch (const std::exception& e) {
+        out.flush();
+        err << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <ostream>
+#include <string>
+
+// Runs a script one top-level statement at a time: each statement is read,
+// lexed, parsed, compiled and executed before the next one is read, and its
+// tokens and AST are freed once its bytecode exists. Only function
+// declarations and global values stay in memory, so scripts of any size run
+// in bounded memory. Output is flushed as it is produced.
+//
+// Returns 0 on success, 1 after a compile or runtime error; the output of the
+// statements before the error has already been written. `fileInput` is
+// passed to VirtualMachine::setFileInput().
+int runStream(const std::string& path, bool checked, bool fileInput, std::ostream& out, std::ostream& err);
+
+#endif
@@ -0,0 +1,92 @@
+#include "trace.h"
+#include "../codegen/serializer.h"
+#include <cstring>
+#include <stdexcept>
+
+std::atomic<uint64_t> TraceSink::nextId{1};
+thread_local TraceSink::Buffer* TraceSink::current = nullptr;
+thread_local uint64_t TraceSink::currentId = 0;
+
+TraceSink::TraceSink(const std::string& path, const BytecodeProgram& program, uint32_t sampleInterval)
+    : id(nextId++), file(path, std::ios::binary | std::ios::trunc), sampleInterval(sampleInterval),
+      started(std::chrono::steady_clock::now()) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not write trace " + path);
+    }
+    TraceHeader header = {};
+    std::memcpy(header.magic, "CMPT", sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.sampleInterval = sampleInterval;
+    header.recordSize = sizeof(TraceRecord);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    BytecodeWriter(file).writeProgram(program);
+    if (!file) {
+        throw std::runtime_error("Could not write trace " + path);
+    }
+    writer = std::thread([this] { writerLoop(); });
+}
+
+TraceSink::~TraceSink() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& buffer : buffers) {
+            Block& block = buffer->blocks[buffer->active];
+            if (!block.records.empty()) {
+                block.queued = true;
+                pending.emplace_back(buffer.get(), &block);
+            }
+        }
+        stopping = true;
+    }
+    wakeWriter.notify_one();
+    writer.join();
+}
+
+TraceSink::Buffer* TraceSink::attach() {
+    auto buffer = std::make_unique<Buffer>();
+    for (Block& block : buffer->blocks) {
+        block.records.reserve(BLOCK_RECORDS);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer->thread = static_cast<uint32_t>(buffers.size());
+    current = buffer.get();
+    currentId = id;
+    buffers.push_back(std::move(buffer));
+    return current;
+}
+
+void TraceSink::submit(Buffer* buffer) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Block& full = buffer->blocks[buffer->active];
+    full.queued = true;
+    pending.emplace_back(buffer, &full);
+    wakeWriter.notify_one();
+    
+    buffer->active = (buffer->active + 1) % RING_BLOCKS;
+    Block& next = buffer->blocks[buffer->active];
+    blockFree.wait(lock, [&] { return !next.queued; });
+}
+
+void TraceSink::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wakeWriter.wait(lock, [&] { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            return;  // Stopping, and everything is written
+        }
+        auto [buffer, block] = pending.front();
+        pending.pop_front();
+        lock.unlock();
+        writeBlock(*buffer, *block);
+        block->records.clear();
+        lock.lock();
+        block->queued = false;
+        blockFree.notify_all();
+    }
+}
+
+void TraceSink::writeBlock(const Buffer& buffer, const Block& block) {
+    TraceBlockHeader header = {buffer.thread, static_cast<uint32_t>(block.records.size())};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(block.records.data()), block.records.size() * sizeof(TraceRecord));
+}
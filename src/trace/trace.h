@@ -0,0 +1,131 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../codegen/bytecode.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Binary execution trace. A trace file starts with a TraceHeader and the
+// program (BytecodeWriter::writeProgram), followed by blocks of records, each
+// a TraceBlockHeader and `count` TraceRecords from one thread in execution
+// order. `compii-trace` (trace/trace_tool.cpp) analyzes it.
+
+struct TraceHeader {
+    char magic[4];            // "CMPT"
+    uint32_t version;
+    uint32_t sampleInterval;  // Instructions between timestamps; 0 for none
+    uint32_t recordSize;
+};
+
+struct TraceBlockHeader {
+    uint32_t thread;
+    uint32_t count;
+};
+
+// One executed instruction, recorded before it runs. `types` holds the type
+// tags (TraceType) of the top stack value in the low four bits and of the one
+// below it in the high four. A record whose op is TIMESTAMP_OP is a
+// timestamp instead: nanoseconds since tracing started, the low 32 bits in
+// `pc` and the next 16 in `high`.
+struct TraceRecord {
+    uint32_t pc;
+    uint8_t op;
+    uint8_t types;
+    uint16_t high;
+};
+
+enum TraceType : uint8_t { TRACE_NONE, TRACE_INT, TRACE_DOUBLE, TRACE_BOOL, TRACE_STRING, TRACE_OBJECT };
+
+const uint8_t TIMESTAMP_OP = 0xFF;
+const uint32_t TRACE_VERSION = 8;
+
+inline uint8_t traceType(const Value& value) {
+    return static_cast<uint8_t>(value.index() + 1);  // Follows the Value alternatives
+}
+
+// Collects records into a ring of blocks per thread. Full blocks are written
+// to the file by a background thread; a thread only waits if its whole ring
+// is still queued for writing.
+class TraceSink {
+public:
+    // Opens `path` and writes the header and program; throws
+    // std::runtime_error if it cannot be written. A timestamp is recorded
+    // every `sampleInterval` instructions per thread (0: never).
+    TraceSink(const std::string& path, const BytecodeProgram& program, uint32_t sampleInterval);
+    // Writes out what every thread has recorded. No thread may still be
+    // recording.
+    ~TraceSink();
+    TraceSink(const TraceSink&) = delete;
+    TraceSink& operator=(const TraceSink&) = delete;
+
+    void record(size_t pc, OpCode op, uint8_t types) {
+        Buffer* buffer = current;
+        if (currentId != id) {
+            buffer = attach();
+        }
+        if (sampleInterval && ++buffer->sinceStamp >= sampleInterval) {
+            buffer->sinceStamp = 0;
+            uint64_t now = static_cast<uint64_t>((std::chrono::steady_clock::now() - started).count());
+            append(buffer, {static_cast<uint32_t>(now), TIMESTAMP_OP, 0, static_cast<uint16_t>(now >> 32)});
+        }
+        append(buffer, {static_cast<uint32_t>(pc), static_cast<uint8_t>(op), types, 0});
+    }
+
+private:
+    static const size_t BLOCK_RECORDS = 4096;
+    static const size_t RING_BLOCKS = 8;
+
+    struct Block {
+        std::vector<TraceRecord> records;
+        bool queued = false;  // Waiting for the writer thread
+    };
+
+    // Per-thread ring; `active` is the block being filled
+    struct Buffer {
+        uint32_t thread;
+        Block blocks[RING_BLOCKS];
+        size_t active = 0;
+        uint32_t sinceStamp = 0;
+    };
+
+    uint64_t id;  // Unique per sink, so a thread can tell its buffer is stale
+    std::ofstream file;
+    uint32_t sampleInterval;
+    std::chrono::steady_clock::time_point started;
+
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable blockFree;
+    std::deque<std::pair<Buffer*, Block*>> pending;  // Full blocks in order
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    bool stopping = false;
+    std::thread writer;
+
+    static std::atomic<uint64_t> nextId;
+    static thread_local Buffer* current;
+    static thread_local uint64_t currentId;
+
+    void append(Buffer* buffer, TraceRecord record) {
+        Block& block = buffer->blocks[buffer->active];
+        block.records.push_back(record);
+        if (block.records.size() == BLOCK_RECORDS) {
+            submit(buffer);
+        }
+    }
+
+    Buffer* attach();
+    void submit(Buffer* buffer);
+    void writerLoop();
+    void writeBlock(const Buffer& buffer, const Block& block);
+};
+
+#endif
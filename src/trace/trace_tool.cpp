@@ -0,0 +1,238 @@
+// compii-trace: summarizes a trace written by `compii --trace`.
+//
+// Records are replayed per thread in execution order. A conditional jump
+// counts as taken when the next instruction on its thread is not the one after it;
+// a jump to an earlier PC is a loop back edge, and its target the loop
+// header. Iterations of a parallel loop are counted at the start of its body.
+
+#include "trace.h"
+#include "../codegen/serializer.h"
+#include "../codegen/verifier.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Instructions that either fall through or jump
+bool isBranch(OpCode op) {
+    return isConditionalJump(op) || op == OpCode::LOOP_INC_JMP || op == OpCode::ITER_NEXT;
+}
+
+const char* opcodeName(uint8_t op) {
+    static const char* const names[] = {
+        "PUSH", "POP", "STORE", "LOAD", "STORE_LOCAL", "LOAD_LOCAL", "ADD", "SUB", "MUL", "DIV",
+        "ADD_INT", "SUB_INT", "MUL_INT", "CMP_EQ", "CMP_NE", "CMP_LT", "CMP_LE", "CMP_GT", "CMP_GE",
+        "JMP", "JMP_IF_FALSE", "JMP_IF_TRUE", "JEQ", "JNE", "JLT", "JLE", "JGT", "JGE", "JEQ_INT",
+        "JNE_INT", "JLT_INT", "JLE_INT", "JGT_INT", "JGE_INT", "LOOP_INC_JMP", "ITER", "ITER_NEXT",
+        "CALL", "TAIL_CALL", "RET", "PAR_FOR", "PAR_END", "SPAWN", "TASK_END", "CHAN_NEW", "SEND", "RECV",
+        "MAP_NEW", "MAP_INSERT", "INDEX", "INDEX_SET", "MAP_HAS", "MAP_DELETE", "MAP_SIZE",
+        "READ_LINE", "READ_ALL", "LINES", "PRINT", "SNAPSHOT", "HALT"};
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(OpCode::HALT) + 1,
+                  "every opcode needs a name");
+    return op <= static_cast<uint8_t>(OpCode::HALT) ? names[op] : "?";
+}
+
+const char* typeName(uint8_t tag) {
+    static const char* const names[] = {"-", "int", "double", "bool", "string", "object"};
+    return tag <= TRACE_OBJECT ? names[tag] : "?";
+}
+
+struct InstructionStats {
+    uint64_t count = 0;
+    uint64_t taken = 0;                    // Conditional jumps only
+    uint64_t backEdges = 0;                // As a loop header
+    std::map<uint8_t, uint64_t> types;     // By TraceRecord::types
+};
+
+struct ThreadState {
+    bool started = false;
+    TraceRecord last = {};
+    uint64_t instructions = 0;
+    uint64_t firstStamp = 0;
+    uint64_t lastStamp = 0;
+    uint64_t stamps = 0;
+};
+
+class Analyzer {
+public:
+    explicit Analyzer(std::istream& in) : in(in) {}
+
+    void run(std::ostream& out) {
+        readHeader();
+        std::vector<TraceRecord> records;
+        TraceBlockHeader block;
+        while (in.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+            if (block.count > (1u << 24)) {
+                throw std::runtime_error("Corrupt trace block");
+            }
+            records.resize(block.count);
+            if (!in.read(reinterpret_cast<char*>(records.data()), block.count * sizeof(TraceRecord))) {
+                throw std::runtime_error("Truncated trace");
+            }
+            if (block.thread >= threads.size()) {
+                threads.resize(block.thread + 1);
+            }
+            for (const TraceRecord& record : records) {
+                replay(threads[block.thread], record);
+            }
+        }
+        report(out);
+    }
+
+private:
+    std::istream& in;
+    TraceHeader header = {};
+    BytecodeProgram program;
+    std::vector<InstructionStats> stats;
+    std::vector<ThreadState> threads;
+
+    void readHeader() {
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, "CMPT", 4) != 0) {
+            throw std::runtime_error("Not a compii trace");
+        }
+        if (header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+            throw std::runtime_error("Unsupported trace version");
+        }
+        program = BytecodeReader(in).readProgram();
+        stats.resize(program.instructions.size());
+    }
+
+    void replay(ThreadState& thread, const TraceRecord& record) {
+        if (record.op == TIMESTAMP_OP) {
+            uint64_t stamp = record.pc | static_cast<uint64_t>(record.high) << 32;
+            if (thread.stamps++ == 0) thread.firstStamp = stamp;
+            thread.lastStamp = stamp;
+            return;
+        }
+        if (record.pc >= stats.size()) {
+            throw std::runtime_error("Trace does not match its program");
+        }
+        InstructionStats& current = stats[record.pc];
+        current.count++;
+        current.types[record.types]++;
+        thread.instructions++;
+
+        if (thread.started) {
+            const TraceRecord& last = thread.last;
+            auto op = static_cast<OpCode>(last.op);
+            if (isBranch(op) && record.pc != last.pc + 1) {
+                stats[last.pc].taken++;
+            }
+            if ((op == OpCode::JMP || isBranch(op)) && record.pc <= last.pc) {
+                current.backEdges++;
+            }
+        }
+        thread.started = true;
+        thread.last = record;
+    }
+
+    std::string location(size_t pc) const {
+        const FunctionInfo* owner = nullptr;
+        for (const FunctionInfo& fn : program.functions) {
+            if (fn.entry <= pc && (!owner || fn.entry > owner->entry)) owner = &fn;
+        }
+        return owner ? owner->name : "<main>";
+    }
+
+    static std::string percent(uint64_t part, uint64_t whole) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << (whole ? 100.0 * part / whole : 0.0) << "%";
+        return text.str();
+    }
+
+    void report(std::ostream& out) const {
+        uint64_t total = 0;
+        for (const ThreadState& thread : threads) total += thread.instructions;
+        out << total << " instructions on " << threads.size() << " thread(s)\n";
+        for (size_t t = 0; t < threads.size(); t++) {
+            const ThreadState& thread = threads[t];
+            if (thread.stamps < 2) continue;
+            double ms = (thread.lastStamp - thread.firstStamp) / 1e6;
+            out << "  thread " << t << ": " << std::fixed << std::setprecision(3) << ms << " ms between the first and last"
+                << " timestamp (one every " << header.sampleInterval << " instructions)\n";
+        }
+
+        out << "\nLoops\n";
+        out << "  " << std::left << std::setw(8) << "header" << std::setw(16) << "in" << std::right
+            << std::setw(14) << "iterations" << std::setw(10) << "entries" << std::setw(12) << "per entry" << "\n";
+        for (size_t pc = 0; pc < stats.size(); pc++) {
+            const InstructionStats& header = stats[pc];
+            if (!header.backEdges) continue;
+            uint64_t entries = header.count - header.backEdges;
+            out << "  " << std::left << std::setw(8) << pc << std::setw(16) << location(pc) << std::right
+                << std::setw(14) << header.backEdges << std::setw(10) << entries << std::setw(12) << std::fixed
+                << std::setprecision(1) << (entries ? static_cast<double>(header.backEdges) / entries : 0.0) << "\n";
+        }
+        for (const ParallelLoopInfo& loop : program.parallelLoops) {
+            uint64_t iterations = stats[loop.bodyStart].count;
+            uint64_t entries = stats[loop.bodyStart - 1].count;  // The PAR_FOR
+            if (!entries) continue;
+            out << "  " << std::left << std::setw(8) << loop.bodyStart << std::setw(16)
+                << location(loop.bodyStart) + " (par)" << std::right << std::setw(14) << iterations
+                << std::setw(10) << entries << std::setw(12) << std::fixed << std::setprecision(1)
+                << static_cast<double>(iterations) / entries << "\n";
+        }
+
+        out << "\nBranches\n";
+        out << "  " << std::left << std::setw(8) << "pc" << std::setw(14) << "" << std::setw(16) << "in" << std::right
+            << std::setw(14) << "taken" << std::setw(14) << "not taken" << std::setw(10) << "taken" << "\n";
+        for (size_t pc = 0; pc < stats.size(); pc++) {
+            const InstructionStats& branch = stats[pc];
+            OpCode op = program.instructions[pc].op;
+            if (!branch.count || !isBranch(op)) continue;
+            out << "  " << std::left << std::setw(8) << pc << std::setw(14) << opcodeName(static_cast<uint8_t>(op))
+                << std::setw(16) << location(pc) << std::right
+                << std::setw(14) << branch.taken << std::setw(14) << branch.count - branch.taken
+                << std::setw(10) << percent(branch.taken, branch.count) << "\n";
+        }
+
+        // Operand types of instructions that consume values
+        out << "\nOperand types\n";
+        for (size_t pc = 0; pc < stats.size(); pc++) {
+            const InstructionStats& instr = stats[pc];
+            if (!instr.count) continue;
+            size_t pops = stackEffect(program.instructions[pc], program).pops;
+            if (pops == 0) continue;
+            out << "  " << std::left << std::setw(8) << pc << std::setw(14) << opcodeName(static_cast<uint8_t>(program.instructions[pc].op))
+                << std::right << std::setw(12) << instr.count << " ";
+            std::vector<std::pair<uint64_t, uint8_t>> mix;
+            for (const auto& entry : instr.types) mix.emplace_back(entry.second, entry.first);
+            std::sort(mix.rbegin(), mix.rend());
+            for (const auto& entry : mix) {
+                uint8_t top = entry.second & 0xF;
+                uint8_t below = entry.second >> 4;
+                out << " " << (pops > 1 ? std::string(typeName(below)) + "," : "") << typeName(top) << " "
+                    << percent(entry.first, instr.count);
+            }
+            out << "\n";
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <trace_file>" << std::endl;
+        return 1;
+    }
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open " << argv[1] << std::endl;
+        return 1;
+    }
+    try {
+        Analyzer(file).run(std::cout);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}